@@ -21,11 +21,30 @@
 #include "bluemoon.h"
 #include "net.h"
 
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+
+/* Search state is kept separately for each searching thread */
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 extern int verbose;
 
 
 /* #define DEBUG */
 
+/* Count search statistics (comment out to remove all overhead) */
+#define STATS
+
+#ifdef STATS
+#include <sys/time.h>
+#endif
+
 
 /*
  * Action types.
@@ -72,25 +91,89 @@ typedef struct action
  */
 #define MAX_ACTION 50
 
+/*
+ * Stages of legal action generation.
+ */
+#define GEN_START    0
+#define GEN_USE      1
+#define GEN_PLAY     2
+#define GEN_SUPPORT  3
+#define GEN_NONE     4
+#define GEN_SATISFY  5
+#define GEN_DONE     6
+
+/*
+ * State of legal action generation.
+ *
+ * Legal actions are produced one at a time, in the same order a full list
+ * would have, so that searches stopping early never pay for the legality
+ * checks of the remaining actions.  The game state must not change while
+ * actions are being generated.
+ */
+typedef struct legal_gen
+{
+	/* Game state */
+	game *g;
+
+	/* Current stage */
+	int stage;
+
+	/* Next card to examine */
+	int i;
+
+	/* Number of actions produced so far */
+	int n;
+
+	/* Actions found but not yet returned */
+	action buf[MAX_ACTION];
+	int buf_pos, buf_len;
+
+} legal_gen;
+
+/*
+ * State kept by one level of the search.
+ *
+ * These are kept in a preallocated arena instead of on the stack, so that
+ * deep searches do not depend on the size of a thread's stack.
+ */
+typedef struct search_frame
+{
+	/* Copy of game being searched */
+	game sim;
+
+	/* Actions being generated, or best path saved during a later turn */
+	union
+	{
+		legal_gen gen;
+		action path[MAX_ACTION];
+	} u;
+
+} search_frame;
+
+/*
+ * Most search frames used at once by a thread.
+ */
+#define MAX_FRAMES 256
+
 /*
  * Current best path.
  */
-static action best_path[MAX_ACTION];
+static THREAD_LOCAL action best_path[MAX_ACTION];
 
 #ifdef DEBUG
 /* Actions in current evaluated path */
-static action cur_path[MAX_ACTION];
+static THREAD_LOCAL action cur_path[MAX_ACTION];
 #endif
 
 /*
  * Current best path position.
  */
-static int best_path_pos;
+static THREAD_LOCAL int best_path_pos;
 
 /*
  * Current best path score.
  */
-static double best_path_score;
+static THREAD_LOCAL double best_path_score;
 
 /*
  * Information about choice to make.
@@ -100,12 +183,15 @@ typedef struct node
 	/* Callback */
 	choose_result callback;
 
-	/* Legal combinations */
-	int legal[5000];
+	/* Legal combinations (grown as needed) */
+	int *legal;
 
 	/* Number of combinations */
 	int num_legal;
 
+	/* Space allocated for combinations */
+	int max_legal;
+
 	/* Card choices */
 	design *choices[DECK_SIZE];
 
@@ -117,2336 +203,6718 @@ typedef struct node
 
 } node;
 
+/*
+ * Most legal combinations stored for one choice.
+ */
+#define MAX_LEGAL 65536
+
 /*
  * Choices to make.
  */
-static node nodes[10];
+static THREAD_LOCAL node nodes[10];
 
 /*
  * Current choice.
  */
-static int node_pos;
+static THREAD_LOCAL int node_pos;
 
 /*
  * Number of upcoming choices.
  */
-static int node_len;
+static THREAD_LOCAL int node_len;
 
 /*
  * Prevent recursive chooses.
  */
-static int inside_choose;
+static THREAD_LOCAL int inside_choose;
 
 /*
  * String used for AI assist purposes.
  */
-static char *assist_str;
+static THREAD_LOCAL char *assist_str;
 
 /*
  * Flag used when checking for no option but retreat.
  */
-static int must_retreat;
-static int checking_retreat;
+static THREAD_LOCAL int must_retreat;
+static THREAD_LOCAL int checking_retreat;
 
 /*
  * Flag used when checking for opponent's response to declined fight.
  */
-static int checking_decline;
-
+static THREAD_LOCAL int checking_decline;
 
 /*
- * A neural net for each player.
+ * Cache of forced retreat results.
+ *
+ * Many leaves of a turn's search leave the opponent facing exactly the
+ * same situation, so we remember the result of each forced retreat check.
+ * Entries are only valid while their age matches the current age, which
+ * is advanced whenever the networks (and hence our opponent model) change.
  */
-net learner[2];
+#define RETREAT_CACHE_SIZE 4096
 
-/* Neural net inputs */
-#define NET_INPUT 443
+typedef struct retreat_entry
+{
+	/* Hash of relevant game state */
+	unsigned long long key;
 
-/* Number of hidden nodes */
-#define HIDDEN_NODES 50
+	/* Age this entry was stored */
+	int age;
 
-/*
- * Set an input value of the neural net.
- */
-#define SET_INPUT(l, n, x) (l)->input_value[(n)] = (x)
+	/* Retreat was forced */
+	int forced;
+
+} retreat_entry;
+
+static THREAD_LOCAL retreat_entry retreat_cache[RETREAT_CACHE_SIZE];
 
 /*
- * Copy a game structure and set the "simulation" flag.
+ * Cache of turn-ending leaf scores.
  *
- * If a game is a simulation, certain actions like drawing cards are
- * faked in such a way as to not give the AI unfair information.
+ * A leaf's score depends only on the state reached, so scores are kept
+ * for the rest of the turn.  Leaves reached by playing cards in another
+ * order are shared, and when a random event forces a new search from the
+ * state actually reached, only leaves that differ (for instance by the
+ * card revealed) are evaluated again.
  */
-static void simulate_game(game *sim, game *orig)
+#define LEAF_CACHE_SIZE 8192
+
+typedef struct leaf_entry
 {
-	/* Copy game */
-	memcpy(sim, orig, sizeof(game));
+	/* Hash of game state */
+	unsigned long long key;
 
-	/* Check for original game */
-	if (!sim->simulation)
-	{
-		/* Set simulation flag */
-		sim->simulation = 1;
+	/* Age this entry was stored */
+	int age;
 
-		/* Remember who initiated simulation */
-		sim->sim_turn = sim->turn;
+	/* Score of leaf */
+	double score;
 
-		/* Set both players control interfaces to AI */
-		sim->p[0].control = &ai_func;
-		sim->p[1].control = &ai_func;
+} leaf_entry;
 
-		/* Reset random seed */
-		sim->random_seed = 0;
-	}
-}
+static THREAD_LOCAL leaf_entry leaf_cache[LEAF_CACHE_SIZE];
 
 /*
- * Evaluate the current game state.
+ * Current age of search caches.
  */
-static double eval_game(game *g, int who)
-{
-	player *p;
-	card *c;
-	int n = 0, i, j;
-	int power, stack, bluff, bad_bluff;
-	net *l;
+static THREAD_LOCAL int cache_age = 1;
 
-	/* Get player's network */
-	l = &learner[who];
+/*
+ * Number of threads used to evaluate an opponent's choices.
+ */
+int ai_threads = 1;
 
-	/* Check for no learner loaded */
-	if (!l->num_inputs) return 0.5;
+/*
+ * Margin for skipping evaluation of clearly worse leaves (0 is off).
+ *
+ * When set, a turn-ending leaf whose heuristic estimate is worse than the
+ * estimate of the best leaf found so far by more than this margin is not
+ * evaluated by the network.
+ */
+double ai_prune = 0;
 
-	/* Loop over each player */
-	for (i = 0; i < 2; i++)
-	{
-		/* Get player pointer */
-		p = &g->p[i];
+/*
+ * Heuristic weights for dragons and cards left, fitted to how network
+ * scores differ between sibling leaves.  Power at the end of a turn does
+ * not help predict those differences, so it is not used.
+ */
+#define PRUNE_DRAGON 0.047
+#define PRUNE_CARD 0.0053
 
-		/* Loop over cards in deck */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+/*
+ * Pruning margin used by the current search.
+ */
+static THREAD_LOCAL double prune_margin;
 
-			/* Set input for active cards (except leadership) */
-			SET_INPUT(l, n++, c->active && !c->random_fake &&
-			                  c->d_ptr->type != TYPE_LEADERSHIP &&
-			                  (who == i || c->loc_known));
-		}
+/*
+ * Score and heuristic estimate of the best leaf evaluated so far.
+ */
+static THREAD_LOCAL double prune_score, prune_est;
 
-		/* Loop over cards in deck */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+/*
+ * Number of guesses at the opponent's unknown cards to check for forced
+ * retreat (0 assumes every unknown card is in hand).
+ */
+int ai_samples = 0;
 
-			/* Set input for cards in hand (if known) */
-			SET_INPUT(l, n++, (who == i || c->loc_known) &&
-			                  c->where == LOC_HAND &&
-			                  !c->random_fake);
-		}
+/*
+ * Most guesses checked.
+ */
+#define MAX_SAMPLES 16
 
-		/* Loop over cards in deck */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+/*
+ * Number of turns after the current one to search exactly once all
+ * hidden information is known (0 is off).
+ */
+int ai_endgame = 0;
 
-			/* Set input for used cards */
-			SET_INPUT(l, n++, (who == i || c->loc_known) &&
-			                  !c->random_fake &&
-			                  (c->where == LOC_DISCARD ||
-			                   c->where == LOC_LEADERSHIP ||
-					   (c->where == LOC_COMBAT &&
-			                    !c->active)));
-		}
+/*
+ * Number of positions trained before network weights are changed (0
+ * changes them after each position).
+ */
+int ai_batch = 0;
 
-		/* Loop over cards in deck */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+/*
+ * Precision used to evaluate positions while searching (NET_DOUBLE,
+ * NET_FLOAT or NET_INT8).  Training always uses full precision.
+ */
+int ai_precision = NET_DOUBLE;
 
-			/* Set input for cards loaded on ship */
-			SET_INPUT(l, n++, (c->ship != NULL));
-		}
-	}
+/*
+ * Normalize results approximately while searching.  Training always uses
+ * exact results.
+ */
+int ai_fast = 0;
 
-	/* Get evaluating player */
-	p = &g->p[who];
+/*
+ * Number of games trained between checkpoints of the networks (0 is off).
+ */
+int ai_checkpoint_games = 0;
 
-	/* Loop over cards in deck */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+/*
+ * Minutes between checkpoints of the networks (0 is off).
+ */
+int ai_checkpoint_mins = 0;
 
-		/* Set input for "special" card */
-		SET_INPUT(l, n++, c->text_boosted || c->on_bottom || c->bluff);
-	}
+/*
+ * Start from the checkpoint of a network if it has more training than
+ * the network's own file.
+ */
+int ai_resume = 0;
 
-	/* Assume no bad bluff */
-	bad_bluff = 0;
+/*
+ * Prefix of shard files that trained positions are written to (NULL
+ * writes no positions).
+ */
+char *ai_shard = NULL;
 
-	/* Loop over cards in deck */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+/*
+ * Size in megabytes at which a new shard file is started.
+ */
+int ai_shard_size = 64;
 
-		/* Skip non-bluff cards */
-		if (!c->bluff) continue;
+/*
+ * Size of endgame solution cache.
+ */
+#define SOLVE_CACHE_SIZE 4096
 
-		/* Check for bad bluff */
-		if ((!g->fight_element && !(c->icons & ICON_BLUFF_F)) ||
-		     (g->fight_element && !(c->icons & ICON_BLUFF_E)))
-		{
-			/* Bluff is bad */
-			bad_bluff = 1;
-		}
-	}
+/*
+ * Solved score of a position at the start of a turn.
+ */
+typedef struct solve_entry
+{
+	/* Full state key */
+	unsigned long long key;
 
-	/* Set input for a bad bluff */
-	SET_INPUT(l, n++, bad_bluff);
+	/* Cache age when stored */
+	int age;
 
-	/* Set input for game over */
-	SET_INPUT(l, n++, g->game_over);
+	/* Number of turns searched */
+	int turns;
 
-	/* Set input for fight started */
-	SET_INPUT(l, n++, g->fight_started);
+	/* Score is only an upper bound */
+	int upper;
 
-	/* Set inputs for fight element (only if started) */
-	SET_INPUT(l, n++, g->fight_element && g->fight_started);
-	SET_INPUT(l, n++, !g->fight_element && g->fight_started);
+	/* Score for player who initiated simulation */
+	double score;
 
-	/* Loop over players */
-	for (i = 0; i < 2; i++)
-	{
-		/* Get player pointer */
-		p = &g->p[i];
+} solve_entry;
 
-		/* Set input if it is this player's turn */
-		SET_INPUT(l, n++, g->turn == i && !g->game_over);
+/*
+ * Endgame solutions found by this thread.
+ */
+static THREAD_LOCAL solve_entry solve_cache[SOLVE_CACHE_SIZE];
 
-		/* Check for fight started */
-		if (g->fight_started)
-		{
-			/* Compute power level */
-			power = compute_power(g, i);
-		}
-		else
-		{
-			/* Assume no power */
-			power = 0;
-		}
+/*
+ * Current search scores finished games exactly.
+ */
+static THREAD_LOCAL int solving;
 
-		/* Loop over possible power values */
-		for (j = 0; j < 15; j++)
-		{
-			/* Set input if player has this much power */
-			SET_INPUT(l, n++, power > j);
-		}
+/*
+ * Number of turns still to be searched exactly.
+ */
+static THREAD_LOCAL int solve_turns;
 
-		/* Count active cards */
-		stack = p->stack[LOC_COMBAT] + p->stack[LOC_SUPPORT];
+/*
+ * Stop searching a turn once a path better than this is found, because
+ * the previous turn will not allow it (never, by default).
+ */
+static THREAD_LOCAL double solve_cutoff = 2;
 
-		/* Assume no bluff cards */
-		bluff = 0;
+/*
+ * Check whether the current turn has been searched far enough.
+ */
+#define SOLVE_CUTOFF() (best_path_score > solve_cutoff)
 
-		/* Loop over cards */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+/*
+ * Most threads allowed.
+ */
+#define MAX_THREADS 16
 
-			/* Check for bluff card */
-			if (c->bluff)
-			{
-				/* Bluff cards do not count for dragons */
-				stack--;
+/*
+ * Fewest combinations worth evaluating in parallel.
+ */
+#define PARALLEL_MIN 16
 
-				/* Count bluffs */
-				bluff++;
+/*
+ * Combinations of an opponent's choice waiting to be evaluated.
+ */
+typedef struct choice_batch
+{
+	/* Game state before choice */
+	game *g;
+
+	/* Player making choice and player whose cards are chosen */
+	int chooser, who;
+
+	/* Card choices */
+	design **choices;
+
+	/* Callback and data to pass to it */
+	choose_result callback;
+	void *data;
+
+	/* Combinations to try */
+	int *combo;
+
+	/* Score of each combination (or -10 if illegal) */
+	double *score;
+
+	/* Network inputs of the position after each combination */
+	unsigned char *input;
+
+	/* Number of combinations */
+	int num_combo;
+
+	/* Space allocated for combinations */
+	int max_combo;
+
+} choice_batch;
+
+static choice_batch batch;
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Network for each thread to use when evaluating combinations.
+ */
+static net evaluator[MAX_THREADS];
+
+/*
+ * Number of helper threads preparing batched combinations.
+ */
+static int num_helpers;
+
+/*
+ * Lock and conditions used to hand batches to helper threads.
+ */
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t batch_done = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Number of batches handed out, and helpers still working on the last.
+ */
+static int batch_round, batch_left;
+#endif
+
+/*
+ * Networks used by this thread's search (or NULL to use the learners).
+ */
+static THREAD_LOCAL net *search_net;
+
+/*
+ * Networks trained by this thread, when it plays its own training games
+ * (see ai_train_start()).
+ */
+static THREAD_LOCAL net trainer[2];
+
+/*
+ * Networks sharing the inference weights of this thread's trainers, used
+ * to search in reduced precision or with fast normalization.
+ */
+static THREAD_LOCAL net trainer_infer[2];
+
+/*
+ * Number of positions trained by this thread.
+ */
+static THREAD_LOCAL int train_count;
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Lock held while merging training into the learners.
+ */
+static pthread_mutex_t train_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Networks for a second search thread to use.
+ */
+static net helper_net[2];
+#endif
+
+/*
+ * Kinds of decisions made while pondering.
+ */
+#define PONDER_TURN     1
+#define PONDER_BLUFF    2
+
+/*
+ * Most pondered decisions remembered.
+ */
+#define PONDER_MAX      32
+
+/*
+ * A decision made ahead of time while the opponent was thinking.
+ */
+typedef struct ponder_entry
+{
+	/* Kind of decision */
+	int kind;
+
+	/* Key of game state (as we see it) the decision was made from */
+	unsigned long long key;
+
+	/* Whether to call bluff */
+	int call;
+
+	/* Best path found for turn */
+	action path[MAX_ACTION];
+
+} ponder_entry;
+
+/*
+ * Decisions made while pondering.
+ *
+ * Decisions about earlier positions are kept, since the states they were
+ * made for may still be reached.  Once full, the oldest is replaced.
+ */
+static ponder_entry ponder_result[PONDER_MAX];
+static int num_ponder, ponder_pos;
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Game state being pondered, and the next one to ponder.
+ */
+static game ponder_game, ponder_next;
+
+/*
+ * Key of the position last handed to the pondering thread.
+ */
+static unsigned long long ponder_key;
+
+/*
+ * Networks for the pondering thread to use.
+ */
+static net ponder_net[2];
+
+/*
+ * Pondering thread has been started.
+ */
+static int ponder_started;
+
+/*
+ * A new position is waiting, and the thread is working on one.
+ */
+static int ponder_queued, ponder_busy;
+
+/*
+ * Pondering thread.
+ */
+static pthread_t ponder_thread;
+
+/*
+ * Lock and condition used to hand positions to the pondering thread.
+ */
+static pthread_mutex_t ponder_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ponder_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+/*
+ * Ask pondering thread to stop as soon as possible.
+ */
+static volatile int ponder_abort;
+
+/*
+ * This thread is pondering.
+ */
+static THREAD_LOCAL int in_ponder;
+
+/*
+ * Flag asking this thread's search to stop early.
+ */
+static THREAD_LOCAL volatile int *stop_flag;
+
+/*
+ * Counter of positions searched by this thread.
+ */
+static THREAD_LOCAL volatile int *progress;
+
+/*
+ * Check whether the current search should stop.
+ *
+ * A decision that will be used is only cut short once a complete path
+ * has been found, so that the best path so far can be followed.
+ */
+#define SEARCH_STOPPED() \
+	(stop_flag && *stop_flag && (in_ponder || best_path_score > -1))
+
+
+#ifdef STATS
+/*
+ * Statistics about work done in a search.
+ */
+typedef struct search_stats
+{
+	/* Action nodes expanded in each turn phase */
+	int nodes[PHASE_OVER + 1];
+
+	/* Game copies made */
+	int sims;
+
+	/* Game states evaluated */
+	int evals;
+
+	/* Forced retreat checks (and those answered by bounds or cache) */
+	int retreat, retreat_bound, retreat_cached;
+
+	/* Guesses of unknown cards checked for forced retreat */
+	int retreat_guess;
+
+	/* Leaf scores found in cache */
+	int leaf_cached;
+
+	/* Leaves not evaluated by heuristic pre-filter */
+	int pruned;
+
+	/* Declined fight checks */
+	int decline;
+
+	/* Turns searched exactly (and scores found in cache) */
+	int solved, solve_cached;
+
+	/* Choice combinations tried */
+	int combos;
+
+	/* Deepest action path */
+	int max_depth;
+
+	/* Most search frames used (and searches cut short for lack of them) */
+	int max_frames, frames_full;
+
+} search_stats;
+
+/*
+ * Statistics for this thread's current search.
+ */
+static THREAD_LOCAL search_stats stats;
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Statistics saved by helper threads.
+ */
+static search_stats thread_stats[MAX_THREADS];
+#endif
+
+/*
+ * Report of the statistics of this thread's last decision.
+ */
+static THREAD_LOCAL char stats_str[1024];
+
+/*
+ * Report of the last decision made by any thread.
+ */
+static char last_stats[1024];
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Lock held while copying the last report.
+ */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Count an event.
+ */
+#define STAT_ADD(x) (stats.x++)
+
+/*
+ * Track deepest action path.
+ */
+#define STAT_DEPTH(d) ((d) > stats.max_depth ? stats.max_depth = (d) : 0)
+
+/*
+ * Track most search frames used.
+ */
+#define STAT_FRAMES(n) ((n) > stats.max_frames ? stats.max_frames = (n) : 0)
+
+#else
+
+/* Statistics are not counted */
+#define STAT_ADD(x)
+#define STAT_DEPTH(d)
+#define STAT_FRAMES(n)
+
+#endif
+
+/*
+ * A neural net for each player.
+ */
+net learner[2];
+
+/*
+ * Networks sharing the learners' weights, used to evaluate positions in
+ * reduced precision or with fast normalization.
+ */
+static net infer_net[2];
+
+/*
+ * Checkpoint of a network during a long training run.
+ *
+ * The learner's weights are copied when a checkpoint is due, and the copy
+ * is written to disk by a thread of its own so that games keep being
+ * played.  The training count saved with the weights tells how recent a
+ * checkpoint is.
+ */
+typedef struct checkpoint
+{
+	/* Copy of weights to write */
+	net snap;
+
+	/* File to write */
+	char fname[1040];
+
+	/* Time of last checkpoint */
+	time_t last;
+
+	/* Copy is being written */
+	int busy;
+
+#ifdef HAVE_PTHREAD_H
+	/* Thread writing copy */
+	pthread_t thread;
+
+	/* Thread has been started and not waited for */
+	int started;
+#endif
+
+} checkpoint;
+
+/*
+ * Checkpoint of each learner.
+ */
+static checkpoint ckpt[2];
+
+/*
+ * Set an input value of the neural net.
+ */
+#define SET_INPUT(l, n, x) (l)->input_value[(n)] = (x)
+
+#ifdef STATS
+/*
+ * Names of turn phases used in statistics reports.
+ */
+static char *phase_name[PHASE_OVER + 1] =
+{
+	"none", "start", "begin", "leader", "retreat", "char", "support",
+	"after_sb", "announce", "refresh", "end", "over"
+};
+
+/*
+ * Clear statistics and remember when a decision started.
+ */
+static void start_stats(struct timeval *start)
+{
+	/* Clear counters */
+	memset(&stats, 0, sizeof(search_stats));
+
+	/* Get current time */
+	gettimeofday(start, NULL);
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Add statistics gathered by another thread.
+ */
+static void merge_stats(search_stats *s)
+{
+	int i;
+
+	/* Add node counts */
+	for (i = 0; i <= PHASE_OVER; i++) stats.nodes[i] += s->nodes[i];
+
+	/* Add other counts */
+	stats.sims += s->sims;
+	stats.evals += s->evals;
+	stats.retreat += s->retreat;
+	stats.retreat_bound += s->retreat_bound;
+	stats.retreat_cached += s->retreat_cached;
+	stats.retreat_guess += s->retreat_guess;
+	stats.leaf_cached += s->leaf_cached;
+	stats.pruned += s->pruned;
+	stats.decline += s->decline;
+	stats.solved += s->solved;
+	stats.solve_cached += s->solve_cached;
+	stats.combos += s->combos;
+
+	/* Add searches cut short */
+	stats.frames_full += s->frames_full;
+
+	/* Track deepest path and most frames */
+	STAT_DEPTH(s->max_depth);
+	STAT_FRAMES(s->max_frames);
+}
+#endif
+
+/*
+ * Create a report of the statistics of a decision.
+ *
+ * The report is one line of "key=value" pairs, printed if verbose.
+ */
+static void report_stats(char *decision, struct timeval *start)
+{
+	struct timeval end;
+	long usec;
+	char *ptr = stats_str;
+	int i, total = 0;
+
+	/* Get current time */
+	gettimeofday(&end, NULL);
+
+	/* Compute time taken */
+	usec = (end.tv_sec - start->tv_sec) * 1000000L +
+	       (end.tv_usec - start->tv_usec);
+
+	/* Count all nodes */
+	for (i = 0; i <= PHASE_OVER; i++) total += stats.nodes[i];
+
+	/* Start report */
+	ptr += sprintf(ptr, "stats: decision=%s usec=%ld nodes=%d",
+	               decision, usec, total);
+
+	/* Add nodes of each phase */
+	for (i = 0; i <= PHASE_OVER; i++)
+	{
+		/* Skip phases with no nodes */
+		if (!stats.nodes[i]) continue;
+
+		/* Add count */
+		ptr += sprintf(ptr, " nodes_%s=%d", phase_name[i],
+		               stats.nodes[i]);
+	}
+
+	/* Add other counts */
+	sprintf(ptr, " sims=%d evals=%d retreat=%d retreat_bound=%d "
+	             "retreat_cached=%d retreat_guess=%d leaf_cached=%d "
+	             "pruned=%d decline=%d solved=%d solve_cached=%d combos=%d "
+	             "max_depth=%d frame_size=%d frames=%d frames_full=%d",
+	        stats.sims, stats.evals, stats.retreat, stats.retreat_bound,
+	        stats.retreat_cached, stats.retreat_guess, stats.leaf_cached,
+	        stats.pruned, stats.decline, stats.solved, stats.solve_cached,
+	        stats.combos, stats.max_depth, (int)sizeof(search_frame),
+	        stats.max_frames, stats.frames_full);
+
+	/* Print report if asked */
+	if (verbose) printf("%s\n", stats_str);
+
+#ifdef HAVE_PTHREAD_H
+	/* Acquire lock */
+	pthread_mutex_lock(&stats_lock);
+#endif
+
+	/* Save report for other threads to see */
+	strcpy(last_stats, stats_str);
+
+#ifdef HAVE_PTHREAD_H
+	/* Release lock */
+	pthread_mutex_unlock(&stats_lock);
+#endif
+}
+#endif
+
+/*
+ * Return report of statistics of the AI's last decision.
+ */
+void ai_debug_stats(char *buf)
+{
+#ifdef STATS
+#ifdef HAVE_PTHREAD_H
+	/* Acquire lock */
+	pthread_mutex_lock(&stats_lock);
+#endif
+
+	/* Copy report (made by whichever thread decided last) */
+	strcpy(buf, last_stats);
+
+#ifdef HAVE_PTHREAD_H
+	/* Release lock */
+	pthread_mutex_unlock(&stats_lock);
+#endif
+#else
+	/* No statistics available */
+	strcpy(buf, "");
+#endif
+}
+
+/*
+ * Copy a game structure and set the "simulation" flag.
+ *
+ * If a game is a simulation, certain actions like drawing cards are
+ * faked in such a way as to not give the AI unfair information.
+ */
+static void simulate_game(game *sim, game *orig)
+{
+	/* Count copies */
+	STAT_ADD(sims);
+
+	/* Copy game */
+	memcpy(sim, orig, sizeof(game));
+
+	/* Check for original game */
+	if (!sim->simulation)
+	{
+		/* Set simulation flag */
+		sim->simulation = 1;
+
+		/* Remember who initiated simulation */
+		sim->sim_turn = sim->turn;
+
+		/* Set both players control interfaces to AI */
+		sim->p[0].control = &ai_func;
+		sim->p[1].control = &ai_func;
+
+		/* Reset random seed */
+		sim->random_seed = 0;
+	}
+}
+
+/*
+ * Set the network's inputs from the current game state.
+ */
+static void set_inputs(game *g, int who, net *l)
+{
+	player *p;
+	card *c;
+	int n = 0, i, j;
+	int power, stack, bluff, bad_bluff;
+
+	/* Loop over each player */
+	for (i = 0; i < 2; i++)
+	{
+		/* Get player pointer */
+		p = &g->p[i];
+
+		/* Loop over cards in deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Set input for active cards (except leadership) */
+			SET_INPUT(l, n++, c->active && !c->random_fake &&
+			                  c->d_ptr->type != TYPE_LEADERSHIP &&
+			                  (who == i || c->loc_known));
+		}
+
+		/* Loop over cards in deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Set input for cards in hand (if known) */
+			SET_INPUT(l, n++, (who == i || c->loc_known) &&
+			                  c->where == LOC_HAND &&
+			                  !c->random_fake);
+		}
+
+		/* Loop over cards in deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Set input for used cards */
+			SET_INPUT(l, n++, (who == i || c->loc_known) &&
+			                  !c->random_fake &&
+			                  (c->where == LOC_DISCARD ||
+			                   c->where == LOC_LEADERSHIP ||
+					   (c->where == LOC_COMBAT &&
+			                    !c->active)));
+		}
+
+		/* Loop over cards in deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Set input for cards loaded on ship */
+			SET_INPUT(l, n++, (c->ship != NULL));
+		}
+	}
+
+	/* Get evaluating player */
+	p = &g->p[who];
+
+	/* Loop over cards in deck */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Set input for "special" card */
+		SET_INPUT(l, n++, c->text_boosted || c->on_bottom || c->bluff);
+	}
+
+	/* Assume no bad bluff */
+	bad_bluff = 0;
+
+	/* Loop over cards in deck */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip non-bluff cards */
+		if (!c->bluff) continue;
+
+		/* Check for bad bluff */
+		if ((!g->fight_element && !(c->icons & ICON_BLUFF_F)) ||
+		     (g->fight_element && !(c->icons & ICON_BLUFF_E)))
+		{
+			/* Bluff is bad */
+			bad_bluff = 1;
+		}
+	}
+
+	/* Set input for a bad bluff */
+	SET_INPUT(l, n++, bad_bluff);
+
+	/* Set input for game over */
+	SET_INPUT(l, n++, g->game_over);
+
+	/* Set input for fight started */
+	SET_INPUT(l, n++, g->fight_started);
+
+	/* Set inputs for fight element (only if started) */
+	SET_INPUT(l, n++, g->fight_element && g->fight_started);
+	SET_INPUT(l, n++, !g->fight_element && g->fight_started);
+
+	/* Loop over players */
+	for (i = 0; i < 2; i++)
+	{
+		/* Get player pointer */
+		p = &g->p[i];
+
+		/* Set input if it is this player's turn */
+		SET_INPUT(l, n++, g->turn == i && !g->game_over);
+
+		/* Check for fight started */
+		if (g->fight_started)
+		{
+			/* Compute power level */
+			power = compute_power(g, i);
+		}
+		else
+		{
+			/* Assume no power */
+			power = 0;
+		}
+
+		/* Loop over possible power values */
+		for (j = 0; j < 15; j++)
+		{
+			/* Set input if player has this much power */
+			SET_INPUT(l, n++, power > j);
+		}
+
+		/* Count active cards */
+		stack = p->stack[LOC_COMBAT] + p->stack[LOC_SUPPORT];
+
+		/* Assume no bluff cards */
+		bluff = 0;
+
+		/* Loop over cards */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Check for bluff card */
+			if (c->bluff)
+			{
+				/* Bluff cards do not count for dragons */
+				stack--;
+
+				/* Count bluffs */
+				bluff++;
+			}
+		}
+
+		/* Loop over stack sizes */
+		for (j = 0; j < 8; j++)
+		{
+			/* Set input if player has this many cards played */
+			SET_INPUT(l, n++, stack > j);
+		}
+
+		/* Loop over bluff counts */
+		for (j = 0; j < 4; j++)
+		{
+			/* Set input if player has this many bluffs */
+			SET_INPUT(l, n++, bluff > j);
+		}
+
+		/* Count cards in hand */
+		stack = p->stack[LOC_HAND];
+
+		/* Loop over hand sizes */
+		for (j = 0; j < 10; j++)
+		{
+			/* Set input if player has this many cards */
+			SET_INPUT(l, n++, stack > j);
+		}
+
+		/* Count cards in draw deck and hand */
+		stack = p->stack[LOC_DRAW] + p->stack[LOC_HAND];
+
+		/* Loop over deck sizes */
+		for (j = 0; j < 30; j++)
+		{
+			/* Set input if player has this many cards */
+			SET_INPUT(l, n++, stack > j);
+		}
+
+		/* Assume no characters */
+		stack = 0;
+
+		/* Loop over deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Skip non-characters */
+			if (c->d_ptr->type != TYPE_CHARACTER) continue;
+
+			/* Skip cards not in hand */
+			if (c->where == LOC_HAND &&
+			    (who == i || c->loc_known) &&
+			    !c->random_fake)
+			{
+				/* Add more character */
+				stack++;
+			}
+		}
+
+		/* Loop over character counts */
+		for (j = 0; j < 5; j++)
+		{
+			/* Set input if player has this many characters */
+			SET_INPUT(l, n++, stack > j);
+		}
+
+		/* Assume no undisclosed cards */
+		stack = 0;
+
+		/* Loop over deck */
+		for (j = 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			c = &p->deck[j];
+
+			/* Skip cards not in hand */
+			if (c->where != LOC_HAND) continue;
+
+			/* Skip disclosed cards */
+			if (c->disclosed) continue;
+
+			/* Count undisclosed cards */
+			stack++;
+		}
+
+		/* Loop over disclose counts */
+		for (j = 0; j < 6; j++)
+		{
+			/* Set input if player has this cards disclosed */
+			SET_INPUT(l, n++, stack > j);
+		}
+
+		/* Set input if player is first to run out of cards */
+		SET_INPUT(l, n++, p->no_cards);
+
+		/* Loop over dragon counts */
+		for (j = 0; j < 3; j++)
+		{
+			/* Set input if player has this many dragons */
+			SET_INPUT(l, n++, p->dragons > j);
+		}
+
+		/* Set input if player has instant victory */
+		SET_INPUT(l, n++, p->instant_win);
+	}
+}
+
+/*
+ * Evaluate the current game state with the given network.
+ */
+static double eval_net(game *g, int who, net *l)
+{
+#ifdef DEBUG
+	int i;
+#endif
+
+	/* Count evaluations */
+	STAT_ADD(evals);
+
+	/* Check for no learner loaded */
+	if (!l->num_inputs) return 0.5;
+
+	/* Set inputs */
+	set_inputs(g, who, l);
+
+	/* Compute network value */
+	compute_net(l);
+
+#ifdef DEBUG
+	/* Print score and path to get here */
+	if (verbose && !checking_retreat && best_path_pos > 0)
+	{
+		printf("%.12lf: ", l->win_prob[who]);
+
+		for (i = 0; i <= best_path_pos; i++)
+		{
+			action a;
+
+			a = cur_path[i];
+
+			switch (a.act)
+			{
+				case ACT_NONE: break;
+				case ACT_RETREAT: printf("Retreat "); break;
+				case ACT_RETRIEVE: printf("Retrieve %s ", a.arg->name); break;
+				case ACT_PLAY: printf("Play %s ", a.arg->name); break;
+				case ACT_PLAY_NO: printf("Play (no) %s ", a.arg->name); break;
+				case ACT_ANN_FIRE: printf("Announce fire "); break;
+				case ACT_ANN_EARTH: printf("Announce earth "); break;
+				case ACT_USE: printf("Use %s ", a.arg->name); break;
+				case ACT_SATISFY: printf("Satsify %s ", a.arg->name); break;
+				case ACT_CHOOSE: printf("Choose %d ", a.chosen); break;
+				case ACT_LAND: printf("Land %s ", a.arg->name); break;
+				case ACT_LOAD: printf("Load %s on %s ", a.arg->name, a.target->name); break;
+				case ACT_BLUFF: printf("Bluff %s ", a.arg->name); break;
+				case ACT_REVEAL: printf("Reveal %s ", a.arg->name); break;
+			}
+		}
+
+		if (must_retreat) printf("Force retreat");
+
+		if (checking_decline)
+		{
+			printf("Responding %s", g->fight_element ? "earth" : "fire");
+		}
+	
+		printf("\n");
+	}
+#endif
+
+	/* Return output */
+	return l->win_prob[who];
+}
+
+/*
+ * Return the network this thread evaluates a player's positions with.
+ */
+static net *eval_network(int who)
+{
+	/* Check for thread with its own networks */
+	if (search_net)
+	{
+		/* Check for trainer with reduced precision weights */
+		if (search_net == trainer && trainer[who].quantized)
+			return &trainer_infer[who];
+
+		/* Use thread's network */
+		return &search_net[who];
+	}
+
+	/* Check for reduced precision weights or fast normalization */
+	if (learner[who].quantized) return &infer_net[who];
+
+	/* Use player's network */
+	return &learner[who];
+}
+
+/*
+ * Evaluate the current game state.
+ */
+static double eval_game(game *g, int who)
+{
+	/* Evaluate with this thread's network */
+	return eval_net(g, who, eval_network(who));
+}
+
+/*
+ * Return the network trained by this thread for the given player.
+ */
+static net *train_learner(int who)
+{
+	/* Check for thread training its own networks */
+	if (search_net == trainer) return &trainer[who];
+
+	/* Use player's network */
+	return &learner[who];
+}
+
+/*
+ * Positions trained are written to shard files for training later.
+ *
+ * Each file starts with SHARD_MAGIC and the time the run started, and
+ * the rest is only ever appended to.  Each position is one record:
+ *
+ *   size     4 bytes, number of bytes in record data
+ *   data:
+ *     game     4 bytes, number of game within the run
+ *     people   1 byte each for the network's player and the opponent
+ *     turn     1 byte, 1 if the network's player is to move
+ *     result   1 byte each for the crystals of the player and opponent
+ *     instant  1 byte, 1 if the player won instantly, 2 if opponent did
+ *     count    2 bytes, number of features
+ *     features 2 bytes each, an input of the network, repeated for its
+ *              value (inputs not given are 0)
+ *   crc      4 bytes, CRC-32 of record data
+ *
+ * Numbers are stored least significant byte first.  A record cut short
+ * by a crash can be found by its size or checksum.
+ */
+#define SHARD_MAGIC "BMSHARD1"
+
+/*
+ * Records of positions of the game being played for each player, written
+ * when the game is over.
+ */
+static THREAD_LOCAL unsigned char *shard_buf[2];
+
+/*
+ * Bytes used and available in the records of each player.
+ */
+static THREAD_LOCAL int shard_used[2], shard_alloc[2];
+
+/*
+ * Number of the game being played.
+ */
+static THREAD_LOCAL unsigned int shard_game;
+
+/*
+ * Shard file being written.
+ */
+static FILE *shard_file;
+
+/*
+ * Number of shard file being written and bytes written to it.
+ */
+static int shard_num;
+static long shard_bytes;
+
+/*
+ * Number of games started and time the run started.
+ */
+static unsigned int shard_games;
+static time_t shard_stamp;
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Lock held while writing shard files.
+ */
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * Store a number in a record, least significant byte first.
+ */
+static void put_number(unsigned char *buf, unsigned int x, int bytes)
+{
+	int i;
+
+	/* Loop over bytes */
+	for (i = 0; i < bytes; i++)
+	{
+		/* Store one byte */
+		buf[i] = (x >> (8 * i)) & 0xff;
+	}
+}
+
+/*
+ * Compute the CRC-32 of a block of data.
+ */
+static unsigned int shard_crc(unsigned char *buf, int len)
+{
+	unsigned int crc = 0xffffffff;
+	int i, j;
+
+	/* Loop over bytes */
+	for (i = 0; i < len; i++)
+	{
+		/* Add byte */
+		crc ^= buf[i];
+
+		/* Loop over bits */
+		for (j = 0; j < 8; j++)
+		{
+			/* Divide by polynomial */
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+
+	/* Return checksum */
+	return ~crc;
+}
+
+/*
+ * Start the next shard file, skipping files left by earlier runs.
+ *
+ * The shard lock should be held.  Return -1 on failure.
+ */
+static int open_shard(void)
+{
+	unsigned char head[12];
+	char fname[1100];
+	int fd;
+
+	/* Check for first shard */
+	if (!shard_stamp) shard_stamp = time(NULL);
+
+	/* Look for a file not made yet */
+	while (1)
+	{
+		/* Create shard filename */
+		sprintf(fname, "%s.%04d.shard", ai_shard, shard_num++);
+
+		/* Try to create file */
+		fd = open(fname, O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0644);
+
+		/* Done if created */
+		if (fd >= 0) break;
+
+		/* Check for failure other than file existing */
+		if (errno != EEXIST)
+		{
+			/* Error */
+			printf("Couldn't create %s!\n", fname);
+
+			/* Stop writing positions */
+			ai_shard = NULL;
+			return -1;
+		}
+	}
+
+	/* Open file */
+	shard_file = fdopen(fd, "ab");
+
+	/* Write header */
+	memcpy(head, SHARD_MAGIC, 8);
+	put_number(head + 8, (unsigned int)shard_stamp, 4);
+	fwrite(head, 1, 12, shard_file);
+
+	/* Count bytes written */
+	shard_bytes = 12;
+
+	/* Success */
+	return 0;
+}
+
+/*
+ * Finish writing the current shard file.
+ */
+static void close_shard(void)
+{
+#ifdef HAVE_PTHREAD_H
+	/* Other threads may be writing */
+	pthread_mutex_lock(&shard_lock);
+#endif
+
+	/* Check for shard file open */
+	if (shard_file)
+	{
+		/* Close file */
+		if (fclose(shard_file)) printf("Couldn't write shard!\n");
+
+		/* No file open */
+		shard_file = NULL;
+	}
+
+#ifdef HAVE_PTHREAD_H
+	/* Done */
+	pthread_mutex_unlock(&shard_lock);
+#endif
+}
+
+/*
+ * Add a record of the position just evaluated by a network to the
+ * records of the player's game.
+ */
+static void shard_position(game *g, int who, net *l)
+{
+	unsigned char *rec;
+	int i, j, n = 0, size;
+
+	/* Check for first position of new game */
+	if (!shard_used[0] && !shard_used[1])
+	{
+#ifdef HAVE_PTHREAD_H
+		/* Other threads may be counting games */
+		pthread_mutex_lock(&shard_lock);
+#endif
+
+		/* Number game */
+		shard_game = shard_games++;
+
+#ifdef HAVE_PTHREAD_H
+		/* Done */
+		pthread_mutex_unlock(&shard_lock);
+#endif
+	}
+
+	/* Count features (not including bias) */
+	for (i = 0; i < l->num_inputs; i++) n += l->input_value[i];
+
+	/* Compute size of record */
+	size = 4 + 12 + 2 * n + 4;
+
+	/* Check for more space needed */
+	if (shard_used[who] + size > shard_alloc[who])
+	{
+		/* Make more space */
+		shard_alloc[who] = 2 * (shard_used[who] + size);
+		shard_buf[who] = (unsigned char *)realloc(shard_buf[who],
+		                                          shard_alloc[who]);
+	}
+
+	/* Get start of record */
+	rec = shard_buf[who] + shard_used[who];
+
+	/* Save size of data */
+	put_number(rec, size - 8, 4);
+
+	/* Save game number */
+	put_number(rec + 4, shard_game, 4);
+
+	/* Save people */
+	rec[8] = g->p[who].p_ptr - peoples;
+	rec[9] = g->p[!who].p_ptr - peoples;
+
+	/* Save whether player is to move */
+	rec[10] = (g->turn == who);
+
+	/* Save number of features */
+	put_number(rec + 14, n, 2);
+
+	/* Start features */
+	n = 0;
+
+	/* Loop over inputs */
+	for (i = 0; i < l->num_inputs; i++)
+	{
+		/* Save input once for each unit of its value */
+		for (j = 0; j < l->input_value[i]; j++)
+		{
+			/* Save input */
+			put_number(rec + 16 + 2 * n++, i, 2);
+		}
+	}
+
+	/* Record is done except for result */
+	shard_used[who] += size;
+}
+
+/*
+ * Write the records of a player's game, now that its result is known.
+ */
+static void shard_game_over(game *g, int who)
+{
+	unsigned char *rec;
+	int pos, size;
+
+	/* Loop over records */
+	for (pos = 0; pos < shard_used[who]; pos += size + 8)
+	{
+		/* Get record */
+		rec = shard_buf[who] + pos;
+
+		/* Get size of data */
+		size = rec[0] | rec[1] << 8 | rec[2] << 16 | rec[3] << 24;
+
+		/* Save crystals */
+		rec[11] = g->p[who].crystals;
+		rec[12] = g->p[!who].crystals;
+
+		/* Save instant win */
+		rec[13] = g->p[who].instant_win ? 1 :
+		          g->p[!who].instant_win ? 2 : 0;
+
+		/* Save checksum of data */
+		put_number(rec + 4 + size, shard_crc(rec + 4, size), 4);
+	}
+
+#ifdef HAVE_PTHREAD_H
+	/* Write one game at a time */
+	pthread_mutex_lock(&shard_lock);
+#endif
+
+	/* Check for new shard needed */
+	if (ai_shard && (!shard_file || shard_bytes + shard_used[who] >
+	                 ai_shard_size * 1024L * 1024L))
+	{
+		/* Finish current shard */
+		if (shard_file && fclose(shard_file))
+			printf("Couldn't write shard!\n");
+
+		/* Start next shard */
+		shard_file = NULL;
+		open_shard();
+	}
+
+	/* Write records */
+	if (shard_file)
+	{
+		/* Append records of game and push them to the file */
+		if (fwrite(shard_buf[who], 1, shard_used[who], shard_file) !=
+		    (size_t)shard_used[who] || fflush(shard_file))
+		{
+			/* Error */
+			printf("Couldn't write shard!\n");
+
+			/* Give up on file (its last game may be cut short) */
+			fclose(shard_file);
+			shard_file = NULL;
+
+			/* Stop writing positions */
+			ai_shard = NULL;
+		}
+		else
+		{
+			/* Count bytes written */
+			shard_bytes += shard_used[who];
+		}
+	}
+
+#ifdef HAVE_PTHREAD_H
+	/* Done */
+	pthread_mutex_unlock(&shard_lock);
+#endif
+
+	/* Start over */
+	shard_used[who] = 0;
+}
+
+/*
+ * Perform a training iteration.
+ *
+ * The "desired" array is passed only at the end of the game.  Otherwise
+ * we train the network to give results (using past inputs) to be like our
+ * results using current inputs.
+ */
+static void perform_training(game *g, int who, double *desired)
+{
+	double target[2];
+	double lambda = 1.0;
+	int i;
+	net *l;
+
+	/* Get correct network to train */
+	l = train_learner(who);
+
+	/* Check for uninitialized network */
+	if (!l->num_inputs) return;
+
+	/* Cached results may depend on old network */
+	cache_age++;
+
+	/* Get current state (in full precision) */
+	eval_net(g, who, l);
+
+	/* Write position to shards if asked */
+	if (ai_shard) shard_position(g, who, l);
+
+	/* Store current inputs */
+	store_net(l);
+
+	/* Check for passed in results */
+	if (desired)
+	{
+		/* Copy results */
+		target[0] = desired[0];
+		target[1] = desired[1];
+
+		/* Train current inputs with desired outputs */
+		train_net(l, lambda, target);
+		train_count++;
+	}
+	else
+	{
+		/* Copy results */
+		target[0] = l->win_prob[0];
+		target[1] = l->win_prob[1];
+	}
+
+	/* Loop over past inputs (starting with most recent) */
+	for (i = l->num_past - 2; i >= 0; i--)
+	{
+		/* Copy past inputs to network */
+		recall_net(l, i);
+
+		/* Compute net */
+		compute_net(l);
+
+		/* Train using this */
+		train_net(l, lambda, target);
+		train_count++;
+
+		/* Reduce training amount for less recent results */
+		lambda *= 0.9;
+	}
+
+	/* Check for reduced precision weights */
+	if (l->quantized)
+	{
+		/* Make them again from trained weights */
+		quantize_net(l, l->quantized);
+
+		/* Start over with new weights */
+		if (l == &trainer[who]) reset_net(&trainer_infer[who]);
+		else reset_net(&infer_net[who]);
+	}
+}
+
+/*
+ * Make the name of the checkpoint file of a player's network.
+ */
+static void checkpoint_name(char *buf, game *g, int who)
+{
+	/* Add suffix to network filename */
+	sprintf(buf, DATADIR "/networks/bluemoon.net.%s.%s.ckpt",
+	                                     g->p[who].p_ptr->name,
+	                                     g->p[!who].p_ptr->name);
+}
+
+/*
+ * Write the copy of a network's weights made for a checkpoint.
+ */
+static void *checkpoint_worker(void *arg)
+{
+	checkpoint *c = (checkpoint *)arg;
+
+	/* Save copy of weights */
+	save_net(&c->snap, c->fname);
+
+#ifdef HAVE_PTHREAD_H
+	/* Game threads check for checkpoints being written */
+	pthread_mutex_lock(&train_lock);
+#endif
+
+	/* Done writing */
+	c->busy = 0;
+
+#ifdef HAVE_PTHREAD_H
+	/* Done */
+	pthread_mutex_unlock(&train_lock);
+#endif
+
+	/* Done */
+	return NULL;
+}
+
+/*
+ * Wait for any checkpoint of a network still being written.
+ */
+static void wait_checkpoint(int who)
+{
+#ifdef HAVE_PTHREAD_H
+	/* Check for writing thread */
+	if (ckpt[who].started)
+	{
+		/* Wait for thread */
+		pthread_join(ckpt[who].thread, NULL);
+
+		/* Thread is gone */
+		ckpt[who].started = 0;
+	}
+#endif
+}
+
+/*
+ * Copy a learner's weights for a checkpoint, if one is due.
+ *
+ * The training lock should be held.  Return non-zero if a copy was made.
+ */
+static int copy_checkpoint(int who)
+{
+	checkpoint *c = &ckpt[who];
+	time_t now = time(NULL);
+
+	/* Check for checkpoints not used or last still being written */
+	if (!c->snap.num_inputs || c->busy) return 0;
+
+	/* Check for enough games or time since last checkpoint */
+	if ((!ai_checkpoint_games ||
+	     learner[who].num_training % ai_checkpoint_games) &&
+	    (!ai_checkpoint_mins ||
+	     now - c->last < ai_checkpoint_mins * 60)) return 0;
+
+	/* Copy weights */
+	copy_net(&c->snap, &learner[who]);
+
+	/* Copy is being written */
+	c->busy = 1;
+
+	/* Remember time */
+	c->last = now;
+
+	/* Copy made */
+	return 1;
+}
+
+/*
+ * Write a checkpoint copied by copy_checkpoint() to disk.
+ */
+static void write_checkpoint(game *g, int who)
+{
+	checkpoint *c = &ckpt[who];
+
+	/* Create checkpoint filename */
+	checkpoint_name(c->fname, g, who);
+
+#ifdef HAVE_PTHREAD_H
+	/* Clean up thread that wrote last checkpoint */
+	wait_checkpoint(who);
+
+	/* Write checkpoint in separate thread */
+	c->started = !pthread_create(&c->thread, NULL, checkpoint_worker,
+	                             c);
+
+	/* Done if thread started */
+	if (c->started) return;
+#endif
+
+	/* Write checkpoint in this thread instead */
+	checkpoint_worker(c);
+}
+
+/*
+ * Continue from a network's checkpoint, if it has more training than
+ * the network loaded.
+ */
+static void resume_checkpoint(game *g, int who)
+{
+	checkpoint *c = &ckpt[who];
+	char fname[1040], buf[1100];
+
+	/* Create checkpoint filename */
+	checkpoint_name(fname, g, who);
+
+	/* Load checkpoint into copy */
+	if (load_net(&c->snap, fname)) return;
+
+	/* Check for older checkpoint */
+	if (c->snap.num_training <= learner[who].num_training) return;
+
+	/* Use checkpoint's weights */
+	copy_net(&learner[who], &c->snap);
+
+	/* Create message */
+	sprintf(buf, "Resuming %s after %d games\n", fname,
+	        learner[who].num_training);
+
+	/* Send message */
+	message_add(buf);
+}
+
+#ifdef HAVE_PTHREAD_H
+/* Foward declaration */
+static void start_helpers(void);
+#endif
+
+/*
+ * Initialize AI.
+ */
+static void ai_initialize(game *g, int who)
+{
+	char fname[1024], buf[1024];
+
+	/* Stop thinking ahead with old network */
+	ai_ponder_stop();
+
+	/* Release weights of old network */
+	unmap_net(&learner[who]);
+
+	/* Create neural net */
+	make_learner(&learner[who], NET_INPUT, HIDDEN_NODES, NET_OUTPUT);
+
+	/* Restrict number of threads */
+	if (ai_threads > MAX_THREADS) ai_threads = MAX_THREADS;
+	if (ai_threads < 1) ai_threads = 1;
+
+#ifdef HAVE_PTHREAD_H
+	/* Start helper threads for evaluating large choices */
+	start_helpers();
+#endif
+
+	/* Forget cached results from any previous network */
+	cache_age++;
+
+	/* Set learning rate */
+	learner[who].alpha = 0.0001;
+	/* learner[who].alpha = 0.0; printf("WARNING: alpha is 0\n"); */
+
+	/* Set training batch size */
+	set_batch(&learner[who], ai_batch);
+
+	/* Create network filename */
+	sprintf(fname, DATADIR "/networks/bluemoon.net.%s.%s",
+	                                     g->p[who].p_ptr->name,
+	                                     g->p[!who].p_ptr->name);
+
+	/* Attempt to load net weights from disk (or the image cache) */
+	if (map_net(&learner[who], fname, 1))
+	{
+		/* Create warning message */
+		sprintf(buf,
+		        _("WARNING: Couldn't open %s, expect random play!\n"),
+		        fname);
+
+		/* Send message */
+		message_add(buf);
+	}
+
+	/* Check for checkpoints used */
+	if (ai_checkpoint_games || ai_checkpoint_mins || ai_resume)
+	{
+		/* Wait for last checkpoint to be written */
+		wait_checkpoint(who);
+
+		/* Create network with private weights to copy into */
+		if (!ckpt[who].snap.num_inputs)
+		{
+			/* Create network */
+			make_trainer(&ckpt[who].snap, &learner[who], 1);
+		}
+
+		/* Start timing checkpoints */
+		ckpt[who].last = time(NULL);
+
+		/* Check for resuming from checkpoint */
+		if (ai_resume) resume_checkpoint(g, who);
+	}
+
+	/* Check for search in reduced precision or with fast normalization */
+	if (ai_precision != NET_DOUBLE || ai_fast)
+	{
+		/* Make reduced precision weights */
+		quantize_net(&learner[who], ai_precision |
+		                            (ai_fast ? NET_FAST : 0));
+
+		/* Create network to use them */
+		make_evaluator(&infer_net[who], &learner[who]);
+	}
+
+	/* Evaluate starting position (in full precision) */
+	eval_net(g, who, &learner[who]);
+
+	/* Message */
+	if (verbose >= 1)
+	{
+		/* Print win probabilities of starting state */
+		printf("%s Start prob: %f %f\n", g->p[who].p_ptr->name,
+						 learner[who].win_prob[0],
+						 learner[who].win_prob[1]);
+	}
+}
+
+/*
+ * Return how many more bluff cards we can play before it is obvious that
+ * it is bad.
+ *
+ * Return a negative number if we are already at or past that point.
+ */
+static int check_auto_bluff(game *g, int future)
+{
+	player *p;
+	card *c;
+	int i;
+	int bluff = 0, unknown_f = 0, unknown_e = 0;
+
+	/* Get player pointer */
+	p = &g->p[g->turn];
+
+	/* Check for uncallable bluff */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards without category 3 special text */
+		if (c->d_ptr->special_cat != 3) continue;
+
+		/* Check for "you may not call bluff" text */
+		if (c->d_ptr->special_effect !=(S3_YOU_MAY_NOT | S3_CALL_BLUFF))
+		{
+			continue;
+		}
+
+		if (c->active && !c->text_ignored) return 99;
+
+		if (c->where == LOC_HAND && future) return 99;
+	}
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Check for fire bluff icon */
+		if (c->d_ptr->icons & ICON_BLUFF_F)
+		{
+			/* Count cards with unknown locations */
+			if (!c->loc_known) unknown_f++;
+		}
+
+		/* Check for earth bluff icon */
+		if (c->d_ptr->icons & ICON_BLUFF_E)
+		{
+			/* Count cards with unknown locations */
+			if (!c->loc_known) unknown_e++;
+		}
+
+		/* Count bluff cards */
+		if (c->bluff) bluff++;
+	}
+
+	/* Check for fight started */
+	if (g->fight_started)
+	{
+		/* Return number of excess unknown bluff cards */
+		return g->fight_element ? unknown_e - bluff : unknown_f - bluff;
+	}
+
+	/* Return number of excess unknown bluff cards in lesser element */
+	return unknown_e < unknown_f ? unknown_e - bluff : unknown_f - bluff;
+}
+
+/*
+ * Add a list of legal support phase actions to the given list.
+ *
+ * This includes loading ships and playing bluff cards.
+ */
+static int legal_support(game *g, action *legal, int n)
+{
+	player *p;
+	card *c, *d;
+	int i, j;
+
+	/* Get player pointer */
+	p = &g->p[g->turn];
+
+	/* Check for no support actions allowed */
+	if (!support_allowed(g)) return n;
+
+	/* Look for played ships */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Don't load ships when checking forced retreat */
+		if (checking_retreat) break;
+
+		/* Skip inactive cards */
+		if (!c->active) continue;
+
+		/* Skip non-ship cards */
+		if (!c->d_ptr->capacity) continue;
+
+		/* Loop over other cards */
+		for (j = p->last_played + 1; j < DECK_SIZE; j++)
+		{
+			/* Get card pointer */
+			d = &p->deck[j];
+
+			/* Skip ineligible cards */
+			if (!card_eligible(g, d->d_ptr)) continue;
+
+			/* Skip cards that aren't character/support/booster */
+			if (d->d_ptr->type != TYPE_CHARACTER &&
+			    d->d_ptr->type != TYPE_BOOSTER &&
+			    d->d_ptr->type != TYPE_SUPPORT) continue;
+
+			/* Check for legal loading */
+			if (load_allowed(g, c->d_ptr))
+			{
+				/* Add load action */
+				legal[n].act = ACT_LOAD;
+				legal[n].index = j;
+				legal[n].arg = d->d_ptr;
+				legal[n++].target = c->d_ptr;
+			}
+		}
+
+		/* XXX Stop after first ship with space */
+		break;
+	}
+
+	/* Check for bluffs illegal */
+	if (!bluff_legal(g, g->turn)) return n;
+
+	/* Check for no more unknown bluff cards available */
+	if (check_auto_bluff(g, 1) < 1) return n;
+
+	/* Look for bluff cards */
+	for (i = p->last_played + 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip ineligible cards */
+		if (!card_eligible(g, c->d_ptr)) continue;
+
+		/* Skip cards without bluff icons */
+		if (!(c->icons & ICON_BLUFF_MASK)) continue;
+
+		/* Add bluff action */
+		legal[n].act = ACT_BLUFF;
+		legal[n].index = i;
+		legal[n++].arg = c->d_ptr;
+
+		/* Any bluff is as good as another when checking retreat */
+		if (checking_retreat) break;
+	}
+
+	/* Return length of list */
+	return n;
+}
+
+/*
+ * Start generating legal actions from the given game state.
+ */
+static void start_legal(legal_gen *gen, game *g)
+{
+	/* Save game state */
+	gen->g = g;
+
+	/* Start at beginning */
+	gen->stage = GEN_START;
+	gen->n = 0;
+
+	/* No actions waiting */
+	gen->buf_pos = gen->buf_len = 0;
+}
+
+/*
+ * Queue actions for the phases where every action is cheap to find.
+ *
+ * Return true if the actions of the playing phases should be generated
+ * instead.
+ */
+static int queue_simple(legal_gen *gen)
+{
+	game *g = gen->g;
+	player *p;
+	card *c;
+	action *legal = gen->buf;
+	int power;
+	int i, n = 0;
+
+	/* Get player pointer */
+	p = &g->p[g->turn];
+
+	/* Switch on phase */
+	switch (p->phase)
+	{
+		/* Beginning of turn */
+		case PHASE_BEGIN:
+		{
+			/* Loop over cards */
+			for (i = p->last_played + 1; i < DECK_SIZE; i++)
+			{
+				/* Get card pointer */
+				c = &p->deck[i];
+
+				/* Skip inactive cards */
+				if (!c->active) continue;
+
+				/* Skip cards that aren't ships */
+				if (!c->d_ptr->capacity) continue;
+
+				/* Skip cards that are already landed */
+				if (c->landed) continue;
+
+				/* Add "land" action */
+				legal[n].act = ACT_LAND;
+				legal[n].index = i;
+				legal[n++].arg = c->d_ptr;
+			}
+
+			/* Loop over cards */
+			for (i = p->last_played + 1; i < DECK_SIZE; i++)
+			{
+				/* Get card pointer */
+				c = &p->deck[i];
+
+				/* Skip non-bluff cards */
+				if (!c->bluff) continue;
+
+				/* Don't reveal when checking retreat */
+				if (!checking_retreat)
+				{
+					/* Add "reveal" action */
+					legal[n].act = ACT_REVEAL;
+					legal[n].index = i;
+					legal[n++].arg = c->d_ptr;
+				}
+			}
+
+			/* Check for active cards that can be retrieved */
+			for (i = p->last_played + 1; i < DECK_SIZE; i++)
+			{
+				/* Get card pointer */
+				c = &p->deck[i];
+
+				/* Skip unretrieveable */
+				if (!retrieve_legal(g, c)) continue;
+
+				/* Add retrieve action */
+				legal[n].act = ACT_RETRIEVE;
+				legal[n].index = i;
+				legal[n++].arg = c->d_ptr;
+			}
+
+			/* No action is always allowed */
+			legal[n++].act = ACT_NONE;
+
+			/* Done */
+			break;
+		}
+
+		/* Play a card */
+		case PHASE_LEADER:
+		case PHASE_CHAR:
+		case PHASE_SUPPORT:
+		{
+			/* Generate these actions one at a time */
+			return 1;
+		}
+
+		/* Retreat phase */
+		case PHASE_RETREAT:
+		{
+			/* Retreat is always allowed */
+			legal[n++].act = ACT_RETREAT;
+
+			/* Not retreating is allowed as well */
+			legal[n++].act = ACT_NONE;
+
+			/* Done */
+			break;
+		}
+
+		/* Announce power */
+		case PHASE_ANNOUNCE:
+		{
+			/* Check for no fight */
+			if (!g->fight_started)
+			{
+				/* Both elements are allowed */
+				legal[n++].act = ACT_ANN_FIRE;
+				legal[n++].act = ACT_ANN_EARTH;
+			}
+			else
+			{
+				/* Get opponent's power */
+				power = compute_power(g, !g->turn);
+
+				/* Loop over our combat cards */
+				for (i = 1; i < DECK_SIZE; i++)
+				{
+					/* Get card pointer */
+					c = &p->deck[i];
+
+					/* Skip non-combat cards */
+					if (c->where != LOC_COMBAT) continue;
+
+					/* Skip inactive cards */
+					if (!c->active) continue;
+
+					/* Look for shield in fight element */
+					if (c->icons & (1 << g->fight_element))
+					{
+						/* Opponent has no power */
+						power = 0;
+					}
+				}
+
+				/* Check for enough power */
+				if (power <= compute_power(g, g->turn))
+				{
+					/* We can announce power */
+					legal[n++].act = ACT_ANN_FIRE +
+					                 g->fight_element;
+				}
+			}
+
+			/* Done */
+			break;
+		}
+
+		/* Ensure opponent cards are satisfied */
+		case PHASE_AFTER_SB:
+		{
+			/* Check for automatic bluff call */
+			if (check_auto_bluff(g, 0) < 0) break;
+
+			/* Check for legal end of support phase */
+			if (check_end_support(g))
+			{
+				/* Add advance phase action */
+				legal[n++].act = ACT_NONE;
+			}
+
+			/* Done */
+			break;
+		}
+
+		/* Phases where we can do nothing */
+		case PHASE_START:
+		case PHASE_REFRESH:
+		case PHASE_END:
+		case PHASE_OVER:
+		{
+			/* Only legal action is to do nothing */
+			legal[n++].act = ACT_NONE;
+
+			/* Done */
+			break;
+		}
+	}
+
+	/* Save number of actions queued */
+	gen->buf_len = n;
+
+	/* No further actions */
+	return 0;
+}
+
+/*
+ * Get the next legal action.
+ *
+ * "ACT_NONE" means to take no action and advance the phase counter.
+ *
+ * Return false once there are no more legal actions.
+ */
+static int next_legal(legal_gen *gen, action *a)
+{
+	game *g = gen->g;
+	player *p, *opp;
+	card *c;
+	action *legal = gen->buf;
+
+	/* Get player pointers */
+	p = &g->p[g->turn];
+	opp = &g->p[!g->turn];
+
+	/* Loop until an action is found */
+	while (1)
+	{
+		/* Check for queued action */
+		if (gen->buf_pos < gen->buf_len)
+		{
+			/* Return queued action */
+			*a = gen->buf[gen->buf_pos++];
+
+			/* Count actions */
+			gen->n++;
+			return 1;
+		}
+
+		/* Queue is empty */
+		gen->buf_pos = gen->buf_len = 0;
+
+		/* Switch on stage */
+		switch (gen->stage)
+		{
+			/* Beginning of generation */
+			case GEN_START:
+			{
+				/* Assume nothing follows simple actions */
+				gen->stage = GEN_DONE;
+
+				/* Queue actions of simple phases */
+				if (!queue_simple(gen)) break;
+
+				/* Check for automatic bluff call */
+				if (check_auto_bluff(g, 1) < 0) break;
+
+				/* Look for cards with special powers to use */
+				gen->stage = GEN_USE;
+				gen->i = 1;
+				break;
+			}
+
+			/* Using card powers */
+			case GEN_USE:
+			{
+				/* Loop over active cards */
+				for ( ; gen->i < DECK_SIZE; gen->i++)
+				{
+					/* Get card pointer */
+					c = &p->deck[gen->i];
+
+					/* Skip inactive cards */
+					if (!c->active) continue;
+
+					/* Skip cards with no special effect */
+					if (!c->d_ptr->special_cat) continue;
+
+					/* Skip cards with ignored text */
+					if (c->text_ignored) continue;
+
+					/* Skip cards already used */
+					if (c->used) continue;
+
+					/* Skip cards that can't be used anytime */
+					if (c->d_ptr->special_time != TIME_MYTURN)
+						continue;
+
+					/* Skip cards with no useful effect */
+					if (!special_possible(g, c->d_ptr)) continue;
+
+					/* Add action to use card power */
+					legal[0].act = ACT_USE;
+					legal[0].arg = c->d_ptr;
+					gen->buf_len = 1;
+
+					/* Resume after this card */
+					gen->i++;
+					break;
+				}
+
+				/* Check for action found */
+				if (gen->buf_len) break;
+
+				/* Always use special text first if possible */
+				if (gen->n)
+				{
+					/* No other actions */
+					gen->stage = GEN_DONE;
+					break;
+				}
+
+				/* Look for cards to play */
+				gen->stage = GEN_PLAY;
+				gen->i = p->last_played + 1;
+				break;
+			}
+
+			/* Playing cards */
+			case GEN_PLAY:
+			{
+				/* Look for cards to play */
+				for ( ; gen->i < DECK_SIZE; gen->i++)
+				{
+					/* Get card pointer */
+					c = &p->deck[gen->i];
+
+					/* Skip randomly chosen cards */
+					if (c->random_fake) continue;
+
+					/* Skip ineligible cards */
+					if (!card_eligible(g, c->d_ptr)) continue;
+
+					/* Check for illegal leadership card */
+					if (c->d_ptr->type == TYPE_LEADERSHIP &&
+					    p->phase != PHASE_LEADER) continue;
+
+					/* Check for illegal character card */
+					if (c->d_ptr->type == TYPE_CHARACTER &&
+					    p->phase != PHASE_CHAR) continue;
+
+					/* Check for illegal booster card */
+					if (c->d_ptr->type == TYPE_BOOSTER &&
+					    p->phase != PHASE_SUPPORT) continue;
+
+					/* Check for illegal support card */
+					if (c->d_ptr->type == TYPE_SUPPORT &&
+					    p->phase != PHASE_SUPPORT) continue;
+
+					/* Check card legality */
+					if (!card_allowed(g, c->d_ptr)) continue;
+
+					/* Check for optional special effect */
+					if (((c->d_ptr->special_cat == 4 &&
+					      c->d_ptr->special_effect &
+					      S4_OPTIONAL) ||
+					     (c->d_ptr->special_cat == 8 &&
+					      c->d_ptr->special_effect &
+					      S8_OPTIONAL)) &&
+					    !checking_retreat)
+					{
+						/* Playing card without effect */
+						legal[gen->buf_len].act = ACT_PLAY_NO;
+						legal[gen->buf_len].index = gen->i;
+						legal[gen->buf_len++].arg = c->d_ptr;
+					}
+
+					/* Playing card is allowed */
+					legal[gen->buf_len].act = ACT_PLAY;
+					legal[gen->buf_len].index = gen->i;
+					legal[gen->buf_len++].arg = c->d_ptr;
+
+					/* XXX Always play characters on ship */
+					if (p->phase == PHASE_CHAR && c->ship)
+					{
+						/* No other actions */
+						gen->stage = GEN_DONE;
+					}
+
+					/* Resume after this card */
+					gen->i++;
+					break;
+				}
+
+				/* Check for action found */
+				if (gen->buf_len) break;
+
+				/* Add support actions next */
+				gen->stage = GEN_SUPPORT;
+				break;
+			}
+
+			/* Support actions */
+			case GEN_SUPPORT:
+			{
+				/* Check for support phase */
+				if (p->phase == PHASE_SUPPORT)
+				{
+					/* Queue support actions */
+					gen->buf_len = legal_support(g, legal, 0);
+				}
+
+				/* Consider advancing phase next */
+				gen->stage = GEN_NONE;
+				break;
+			}
+
+			/* Advancing phase */
+			case GEN_NONE:
+			{
+				/* Check cards to satisfy next */
+				gen->stage = GEN_SATISFY;
+
+				/* Check every action when checking retreat */
+				if (checking_retreat && gen->n > 0) break;
+
+				/* Advance phase allowed unless character unplayed */
+				if (p->phase != PHASE_CHAR || p->char_played)
+				{
+					/* Add no action */
+					legal[0].act = ACT_NONE;
+					gen->buf_len = 1;
+				}
+
+				/* Done */
+				break;
+			}
+
+			/* Satisfying opponent's "discard or..." cards */
+			case GEN_SATISFY:
+			{
+				/* No more actions after this */
+				gen->stage = GEN_DONE;
+
+				/* No further actions if none are available so far */
+				if (!gen->n) break;
+
+				/* No need to satisfy cards in character phase */
+				if (p->phase == PHASE_CHAR) break;
+
+				/* Check for active opponent "discard or..." cards */
+				for (gen->i = 1; gen->i < DECK_SIZE; gen->i++)
+				{
+					/* Get card pointer */
+					c = &opp->deck[gen->i];
+
+					/* Skip non-active cards */
+					if (!c->active) continue;
+
+					/* Skip cards with text ignored */
+					if (c->text_ignored) continue;
+
+					/* Skip non-category 7 cards */
+					if (c->d_ptr->special_cat != 7) continue;
+
+					/* Skip non-discard cards */
+					if (!(c->d_ptr->special_effect &
+					      S7_DISCARD_MASK)) continue;
+
+					/* Skip satisfied cards */
+					if (c->used) continue;
+
+					/* Check for satisfaction impossible */
+					if (!satisfy_possible(g, c->d_ptr)) continue;
+
+					/* Add action to satisfy card */
+					legal[0].act = ACT_SATISFY;
+					legal[0].arg = c->d_ptr;
+					gen->buf_len = 1;
+
+					/* Stop looking for further cards */
+					break;
+				}
+
+				/* Done */
+				break;
+			}
+
+			/* No more actions */
+			case GEN_DONE:
+			{
+				/* Nothing left */
+				return 0;
+			}
+		}
+	}
+}
+
+/*
+ * This thread's search frames (allocated on first use).
+ */
+static THREAD_LOCAL search_frame *frames;
+
+/*
+ * Number of search frames in use.
+ */
+static THREAD_LOCAL int frame_pos;
+
+/*
+ * Get the next free search frame.
+ *
+ * Return NULL if every frame is in use, in which case the caller should
+ * not search any deeper.
+ */
+static search_frame *push_frame(void)
+{
+	/* Check for arena not allocated yet */
+	if (!frames)
+	{
+		/* Allocate arena */
+		frames = (search_frame *)malloc(sizeof(search_frame) *
+		                                MAX_FRAMES);
+
+		/* Check for failure */
+		if (!frames)
+		{
+			/* Error */
+			printf("Could not allocate search frames!\n");
+			return NULL;
+		}
+	}
+
+	/* Check for no frames left */
+	if (frame_pos == MAX_FRAMES)
+	{
+		/* Count searches cut short */
+		STAT_ADD(frames_full);
+		return NULL;
+	}
+
+	/* Track most frames used */
+	STAT_FRAMES(frame_pos + 1);
+
+	/* Return next frame */
+	return &frames[frame_pos++];
+}
+
+/*
+ * Release the most recently used search frame.
+ */
+static void pop_frame(void)
+{
+	/* One less frame in use */
+	frame_pos--;
+}
+
+#ifdef HAVE_PTHREAD_H
+/*
+ * Destroy this thread's search frames.
+ */
+static void free_frames(void)
+{
+	/* Free arena */
+	free(frames);
+
+	/* Clear pointer */
+	frames = NULL;
+}
+#endif
+
+/*
+ * Perform the given action.
+ */
+static void perform_act(game *g, action a)
+{
+	player *p, *opp;
+	int old_phase;
+
+	/* Get player pointers */
+	p = &g->p[g->turn];
+	opp = &g->p[!g->turn];
+
+	/* Remember current phase */
+	old_phase = p->phase;
+
+	/* Switch on action */
+	switch (a.act)
+	{
+		/* No action, advance phase counter */
+		case ACT_NONE:
+		{
+			/* Advance phase counter */
+			p->phase++;
+
+			/* Take care of bookkeeping */
+			switch (old_phase)
+			{
+				/* Start of turn */
+				case PHASE_START:
+
+					/* Start turn */
+					start_turn(g);
+
+					/* Done */
+					break;
+
+				/* After support/booster */
+				case PHASE_AFTER_SB:
+
+					/* End support phase */
+					end_support(g);
+					
+					/* Done */
+					break;
+
+				/* Refresh hand */
+				case PHASE_REFRESH:
+
+					/* Refresh */
+					refresh_phase(g);
+
+					/* Done */
+					break;
+
+				/* End of turn */
+				case PHASE_END:
+
+					/* End current turn */
+					end_turn(g);
+
+					/* Done */
+					break;
+
+				/* Move to next player */
+				case PHASE_OVER:
+
+					/* Player is done */
+					p->phase = PHASE_NONE;
+
+					/* Next player */
+					g->turn = !g->turn;
+
+					/* Start opponent's turn */
+					opp->phase = PHASE_START;
+
+					/* Done (completely) */
+					return;
+			}
+
+			/* Clear last played card */
+			p->last_played = 0;
+
+			/* Done */
+			break;
+		}
+
+		/* Retreat */
+		case ACT_RETREAT:
+		{
+			/* Retreat */
+			retreat(g);
+
+			/* Done */
+			break;
+		}
+
+		/* Retrieve a card */
+		case ACT_RETRIEVE:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Retrieve card */
+			retrieve_card(g, a.arg);
+
+			/* Done */
+			break;
+		}
+
+		/* Play a card */
+		case ACT_PLAY:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Play card */
+			play_card(g, a.arg, 0, 0);
+
+			/* Done */
+			break;
+		}
+
+		/* Play a card without special effect */
+		case ACT_PLAY_NO:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Play card */
+			play_card(g, a.arg, 1, 0);
+
+			/* Done */
+			break;
+		}
+
+		/* Announce power */
+		case ACT_ANN_FIRE:
+		case ACT_ANN_EARTH:
+		{
+			/* Increment phase counter */
+			p->phase++;
+
+			/* Announce power */
+			announce_power(g, a.act - ACT_ANN_FIRE);
+
+			/* Done */
+			break;
+		}
+
+		/* Use card special power */
+		case ACT_USE:
+		{
+			/* Use card */
+			use_special(g, a.arg);
+
+			/* Done */
+			break;
+		}
+
+		/* Satisfy opponent's "discard" card */
+		case ACT_SATISFY:
+		{
+			/* Satisfy requirement */
+			satisfy_discard(g, a.arg);
+
+			/* Done */
+			break;
+		}
+
+		/* Land a ship */
+		case ACT_LAND:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Land ship */
+			land_ship(g, a.arg);
+
+			/* Done */
+			break;
+		}
+
+		/* Load a card onto a ship */
+		case ACT_LOAD:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Load card */
+			load_card(g, a.arg, a.target);
+
+			/* Done */
+			break;
+		}
+
+		/* Play a bluff card */
+		case ACT_BLUFF:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Play bluff */
+			play_bluff(g, a.arg);
+
+			/* Done */
+			break;
+		}
+
+		/* Reveal a bluff card */
+		case ACT_REVEAL:
+		{
+			/* Set last played */
+			p->last_played = a.index;
+
+			/* Reveal bluff */
+			reveal_bluff(g, g->turn, a.arg);
+
+			/* Done */
+			break;
+		}
+	}
+}
+
+/* Foward declaration */
+static double find_action(game *g);
+
+/*
+ * Return the most a card's value may become after our increase effects.
+ *
+ * "boost" and "amount" hold the effect codes and values of the increase
+ * effects we may have, and "mask" the codes that apply to this type of
+ * card.  "other" is the card's value in the other element.  Raising to a
+ * value is done first and multiplying last, which gives at least as much
+ * as the order the effects are really applied in.
+ */
+static int boost_bound(int *boost, int *amount, int n, int mask, int e,
+                       int v, int other)
+{
+	int i, effect, add = 0, factor = 1;
+
+	/* Loop over increase effects */
+	for (i = 0; i < n; i++)
+	{
+		/* Get effect code */
+		effect = boost[i];
+
+		/* Skip effects on other types of cards */
+		if (!(effect & mask)) continue;
+
+		/* Skip effects on the other element */
+		if (!(effect & (e ? S1_EARTH_VAL : S1_FIRE_VAL))) continue;
+
+		/* Check for increase to value */
+		if ((effect & S1_TO_VALUE) && amount[i] > v) v = amount[i];
+
+		/* Check for increase to higher value */
+		if ((effect & S1_TO_HIGHER) && other > v) v = other;
+
+		/* Check for increase by value */
+		if (effect & S1_BY_VALUE) add += amount[i];
+
+		/* Check for increase to sum */
+		if (effect & S1_TO_SUM) add += other;
+
+		/* Check for increase by factor */
+		if ((effect & S1_BY_FACTOR) && amount[i] > 1)
+			factor *= amount[i];
+	}
+
+	/* Return largest value */
+	return (v + add) * factor;
+}
+
+/*
+ * Return the increase effect codes that apply to a type of card.
+ */
+static int boost_mask(int type)
+{
+	/* Check type */
+	switch (type)
+	{
+		/* Characters */
+		case TYPE_CHARACTER: return S1_ONE_CHAR | S1_ALL_CHAR;
+
+		/* Boosters */
+		case TYPE_BOOSTER: return S1_ONE_BOOSTER | S1_ALL_BOOSTER;
+
+		/* Supports (and bluffs, which are played as supports) */
+		case TYPE_SUPPORT: return S1_ONE_SUPPORT | S1_ALL_SUPPORT |
+		                          S1_BLUFF;
+	}
+
+	/* Other cards are not increased */
+	return 0;
+}
+
+/*
+ * Return the most power that extra support and booster cards can add.
+ *
+ * "sup" and "boost" hold the value of each card when played as a support
+ * (or bluff) and as a booster, or -1 if it cannot be played that way.  At
+ * most "max_s" supports and "max_b" boosters may be played, plus "either"
+ * more of either kind.
+ *
+ * This is a knapsack over the number of supports and boosters played;
+ * best[s][b] is the most power from s supports and b boosters.
+ */
+static int best_extras(int *sup, int *boost, int n, int max_s, int max_b,
+                       int either)
+{
+	int best[DECK_SIZE + 1][DECK_SIZE + 1];
+	int i, s, b, v, most_s, most_b, over, result = 0;
+
+	/* Compute most cards of each kind that could be played */
+	most_s = max_s + either > n ? n : max_s + either;
+	most_b = max_b + either > n ? n : max_b + either;
+
+	/* Start with nothing reachable but playing no cards */
+	for (s = 0; s <= most_s; s++)
+	{
+		/* Clear row */
+		for (b = 0; b <= most_b; b++) best[s][b] = -1;
+	}
+	best[0][0] = 0;
+
+	/* Add each card */
+	for (i = 0; i < n; i++)
+	{
+		/* Loop backwards so that each card is used only once */
+		for (s = most_s; s >= 0; s--)
+		{
+			for (b = most_b; b >= 0; b--)
+			{
+				/* Skip unreachable counts */
+				if (best[s][b] < 0) continue;
+
+				/* Check for card played as support */
+				if (sup[i] >= 0 && s < most_s)
+				{
+					/* Get power with card */
+					v = best[s][b] + sup[i];
+
+					/* Track best */
+					if (v > best[s + 1][b])
+						best[s + 1][b] = v;
+				}
+
+				/* Check for card played as booster */
+				if (boost[i] >= 0 && b < most_b)
+				{
+					/* Get power with card */
+					v = best[s][b] + boost[i];
+
+					/* Track best */
+					if (v > best[s][b + 1])
+						best[s][b + 1] = v;
+				}
+			}
+		}
+	}
+
+	/* Look for best allowed counts */
+	for (s = 0; s <= most_s; s++)
+	{
+		for (b = 0; b <= most_b; b++)
+		{
+			/* Count cards beyond the per-kind limits */
+			over = (s > max_s ? s - max_s : 0) +
+			       (b > max_b ? b - max_b : 0);
+
+			/* Skip counts that are not allowed */
+			if (over > either) continue;
+
+			/* Track best */
+			if (best[s][b] > result) result = best[s][b];
+		}
+	}
+
+	/* Return most power */
+	return result;
+}
+
+/*
+ * Return true if the current player cannot possibly reach the power
+ * needed to answer the opponent, no matter which cards are played.
+ *
+ * We compute an upper bound on the power the current player can have.
+ * A new character deactivates the old combat cards (unless it may be in
+ * their gang), so the character played is counted together with the old
+ * combat cards only if it has a gang icon.  Supports stay, FREE/PAIR/GANG
+ * cards are all counted, and the other supports and boosters are limited
+ * by the number of each allowed (see best_extras() above).  Every value
+ * is raised by all of our increase effects that could apply to it.  If
+ * we have texts that move cards, any of our cards may end up played.
+ *
+ * Against this we compare a lower bound on the opponent's power after our
+ * ignore and discard effects.  If no character can be played, retreat is
+ * forced as well.
+ *
+ * Cards with effects that are too complicated to bound make us give up
+ * (and return false), so that the full search is used instead.
+ */
+static int retreat_bound(game *g)
+{
+	player *p, *opp;
+	card *c, *list[DECK_SIZE];
+	int sup[DECK_SIZE], boost[DECK_SIZE];
+	int inc[DECK_SIZE], amount[DECK_SIZE];
+	int i, e, v, other, mask, effect, icons;
+	int num = 0, n = 0, num_inc = 0, anywhere = 0, total = 0;
+	int combat_sum = 0, support_sum = 0, free_sum = 0, extra_sum;
+	int best_char = -1, best_gang = -1, char_sum;
+	int max_support = 0, max_booster = 0, either = 1;
+	int ignore_mask = 0, ignore_value = 0, ignore_text = 0, removed = 0;
+	int max_power, min_power;
+
+	/* Get player pointers */
+	p = &g->p[g->turn];
+	opp = &g->p[!g->turn];
+
+	/* Get fight element */
+	e = g->fight_element;
+
+	/* Look for texts that move cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards that are neither active nor in hand */
+		if (!c->active && c->where != LOC_HAND) continue;
+
+		/* Skip randomly drawn cards (they can't be played) */
+		if (!c->active && c->random_fake) continue;
+
+		/* Skip cards without movement texts */
+		if (c->d_ptr->special_cat != 4) continue;
+
+		/* Skip active cards whose texts can no longer be used */
+		if (c->active &&
+		    c->d_ptr->special_time != TIME_MYTURN &&
+		    c->d_ptr->special_time != TIME_ENDSUPPORT) continue;
+
+		/* Any of our cards may be moved into our hand */
+		anywhere = 1;
+	}
+
+	/* Make list of cards we may play or use */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards that are neither active nor in hand */
+		if (!anywhere && !c->active && c->where != LOC_HAND) continue;
+
+		/* Skip randomly drawn cards (they can't be played) */
+		if (!anywhere && !c->active && c->random_fake) continue;
+
+		/* Ships are too complicated */
+		if (c->d_ptr->capacity || c->ship) return 0;
+
+		/* Add card to list */
+		list[num++] = c;
+	}
+
+	/* Look for special texts (which may stop being ignored) */
+	for (i = 0; i < num; i++)
+	{
+		/* Get card pointer */
+		c = list[i];
+
+		/* Get effect code */
+		effect = c->d_ptr->special_effect;
+
+		/* Check category */
+		switch (c->d_ptr->special_cat)
+		{
+			/* Ignore or increase effects */
+			case 1:
+
+				/* Check for ignore effect */
+				if (effect & S1_IGNORE)
+				{
+					/* Remember types of cards ignored */
+					ignore_mask |= effect;
+
+					/* Check for values ignored */
+					if (effect & (S1_FIRE_VAL | S1_EARTH_VAL |
+					              S1_ODD_VAL | S1_EVEN_VAL))
+					{
+						/* Values may be ignored */
+						ignore_value = 1;
+					}
+
+					/* Check for special text ignored */
+					if (effect & S1_SPECIAL) ignore_text = 1;
+					break;
+				}
+
+				/* Increases of texts are too complicated */
+				if (effect & S1_SPECIAL) return 0;
+
+				/* Check for increase of total power */
+				if (effect & (S1_TOTAL_POWER | S1_TOTAL_FIRE |
+				              S1_TOTAL_EARTH))
+				{
+					/* Track largest total */
+					if (c->d_ptr->special_value > total)
+						total = c->d_ptr->special_value;
+					break;
+				}
+
+				/* Remember increase of values */
+				inc[num_inc] = effect;
+				amount[num_inc++] = c->d_ptr->special_value;
+				break;
+
+			/* Play restrictions */
+			case 3:
+
+				/* Skip restrictions on opponent */
+				if (!(effect & S3_I_MAY_PLAY)) break;
+
+				/* Count extra supports allowed */
+				if (effect & S3_SUPPORT)
+					max_support += c->d_ptr->special_value;
+
+				/* Count extra boosters allowed */
+				if (effect & S3_BOOSTER)
+					max_booster += c->d_ptr->special_value;
+
+				/* Next card may be played as free */
+				if (effect & S3_AS_FREE) either++;
+				break;
+
+			/* Card movement */
+			case 4:
+
+				/* Extra attacks are too complicated */
+				if (effect & S4_ATTACK_AGAIN) return 0;
+
+				/* Remember types of opponent cards moved */
+				if (effect & S4_YOUR_CHAR)
+					removed |= TYPE_CHARACTER;
+				if (effect & S4_YOUR_BOOSTER)
+					removed |= TYPE_BOOSTER;
+				if (effect & S4_YOUR_SUPPORT)
+					removed |= TYPE_SUPPORT;
+				break;
+
+			/* Mutants */
+			case 5:
+
+				/* Element swaps are too complicated */
+				if (effect & S5_ELEMENT_SWAP) return 0;
+				break;
+		}
+	}
+
+	/* Loop over cards we may play or use */
+	for (i = 0; i < num; i++)
+	{
+		/* Get card pointer */
+		c = list[i];
+
+		/* Get icons the card may have */
+		icons = c->icons | c->d_ptr->icons;
+
+		/* Get increases that may apply to card */
+		mask = boost_mask(c->d_ptr->type);
+
+		/* Get value in other element */
+		other = c->d_ptr->value[!e];
+
+		/* Check for active card */
+		if (c->active &&
+		    (c->where == LOC_COMBAT || c->where == LOC_SUPPORT))
+		{
+			/* Check for shield in fight element */
+			if (c->where == LOC_COMBAT && (icons & (1 << e)))
+				return 0;
+
+			/* Assume best of current and printed values */
+			v = c->value[e] > c->printed[e] ? c->value[e] :
+			                                  c->printed[e];
+			if (c->d_ptr->value[e] > v) v = c->d_ptr->value[e];
+
+			/* Apply increases */
+			if (v < 0) v = 0;
+			v = boost_bound(inc, amount, num_inc,
+			                boost_mask(c->type), e, v, other);
+
+			/* Add value to combat or support total */
+			if (c->where == LOC_COMBAT) combat_sum += v;
+			if (c->where == LOC_SUPPORT) support_sum += v;
+
+			/* Check for card that cannot be played again */
+			if (!anywhere && !(icons & ICON_RETRIEVE)) continue;
+		}
+
+		/* Skip other active cards */
+		else if (c->active) continue;
+
+		/* Get printed value */
+		v = c->d_ptr->value[e];
+
+		/* Apply increases */
+		if (v < 0) v = 0;
+		v = boost_bound(inc, amount, num_inc, mask, e, v, other);
+
+		/* Check for combat card with shield in fight element */
+		if ((c->d_ptr->type == TYPE_CHARACTER ||
+		     c->d_ptr->type == TYPE_BOOSTER) &&
+		    (c->d_ptr->icons & (1 << e))) return 0;
+
+		/* Check for character */
+		if (c->d_ptr->type == TYPE_CHARACTER)
+		{
+			/* Track best character that replaces old cards */
+			if (v > best_char) best_char = v;
+
+			/* Track best character that may join a gang */
+			if ((icons & ICON_GANG_MASK) && v > best_gang)
+				best_gang = v;
+		}
+
+		/* Check for icons or text that allow play regardless of count */
+		if ((c->d_ptr->type == TYPE_CHARACTER ||
+		     c->d_ptr->type == TYPE_BOOSTER ||
+		     c->d_ptr->type == TYPE_SUPPORT) &&
+		    ((icons & (ICON_FREE | ICON_PAIR | ICON_GANG_MASK)) ||
+		     (c->d_ptr->special_cat == 5 &&
+		      (c->d_ptr->special_effect & S5_PLAY_FREE_IF))))
+		{
+			/* Always count */
+			free_sum += v;
+			continue;
+		}
+
+		/* Assume card cannot be played as an extra */
+		sup[n] = boost[n] = -1;
+
+		/* Cards with bluff icons may be played as a support of 2 */
+		if (c->d_ptr->icons & ICON_BLUFF_MASK)
+		{
+			/* Get increased bluff value */
+			sup[n] = boost_bound(inc, amount, num_inc,
+			                     boost_mask(TYPE_SUPPORT), e, 2, 2);
+		}
+
+		/* Check for support */
+		if (c->d_ptr->type == TYPE_SUPPORT && v > sup[n]) sup[n] = v;
+
+		/* Check for booster */
+		if (c->d_ptr->type == TYPE_BOOSTER) boost[n] = v;
+
+		/* Add card to list of extras if it can add power */
+		if (sup[n] > 0 || boost[n] > 0) n++;
+	}
+
+	/* Check for character still to be played (new turns reset flag) */
+	if (p->phase <= PHASE_START || !p->char_played)
+	{
+		/* Retreat is forced if no character can be played */
+		if (best_char < 0) return 1;
+
+		/* Old combat cards stay only for a gang member */
+		char_sum = best_char;
+		if (best_gang >= 0 && best_gang + combat_sum > char_sum)
+			char_sum = best_gang + combat_sum;
+	}
+	else
+	{
+		/* Old combat cards stay */
+		char_sum = combat_sum;
+	}
+
+	/* Compute most power from extra supports and boosters */
+	extra_sum = best_extras(sup, boost, n, max_support, max_booster,
+	                        either);
+
+	/* Compute most power we could possibly have */
+	max_power = support_sum + char_sum + free_sum + extra_sum;
+
+	/* Check for minimum power */
+	if (max_power < total) max_power = total;
+	if (max_power < p->min_power) max_power = p->min_power;
+
+	/* Check for no ignore or discard effects */
+	if (!ignore_value && !ignore_text && !removed)
+	{
+		/* Opponent's power is unchanged */
+		min_power = compute_power(g, !g->turn);
+	}
+	else
+	{
+		/* Start with no power */
+		min_power = 0;
+
+		/* Loop over opponent cards */
+		for (i = 1; i < DECK_SIZE; i++)
+		{
+			/* Get card pointer */
+			c = &opp->deck[i];
+
+			/* Skip non-combat and non-support cards */
+			if (c->where != LOC_COMBAT &&
+			    c->where != LOC_SUPPORT) continue;
+
+			/* Skip inactive cards */
+			if (!c->active) continue;
+
+			/* Skip cards with ignored values */
+			if (c->value_ignored) continue;
+
+			/* Skip cards we may discard */
+			if (c->type & removed) continue;
+
+			/* Check for card whose value we may ignore */
+			if (ignore_value &&
+			    ((ignore_mask & (S1_ALL_CARDS | S1_CATERPILLAR |
+			                     S1_WITH_ICONS | S1_BLUFF)) ||
+			     (c->type == TYPE_CHARACTER &&
+			      (ignore_mask & (S1_ONE_CHAR | S1_ALL_CHAR))) ||
+			     (c->type == TYPE_BOOSTER &&
+			      (ignore_mask & (S1_ONE_BOOSTER |
+			                      S1_ALL_BOOSTER))) ||
+			     (c->type == TYPE_SUPPORT &&
+			      (ignore_mask & (S1_ONE_SUPPORT |
+			                      S1_ALL_SUPPORT))))) continue;
+
+			/* Get current value */
+			v = c->value[e];
+
+			/* Boosts may go away if their text is ignored */
+			if (ignore_text && v > c->printed[e]) v = c->printed[e];
+
+			/* Add value */
+			if (v > 0) min_power += v;
+		}
+
+		/* Minimum power may go away if text is ignored */
+		if (!ignore_text && min_power < opp->min_power)
+		{
+			/* Use minimum power */
+			min_power = opp->min_power;
+		}
+	}
+
+	/* Retreat is forced if we cannot match opponent's power */
+	return max_power < min_power;
+}
+
+/*
+ * Return true if the current player can certainly reach the power needed
+ * to answer the opponent.
+ *
+ * We only try this when the opponent has no texts that force or forbid
+ * our plays in ways that are hard to follow, and none of our old combat
+ * cards ignore the opponent's cards.  Then the opponent's power cannot
+ * go up during our turn, and their ignore effects already show in the
+ * values and icons of our cards.  The best character in hand with a
+ * simple text, every such FREE card and one more support or booster can
+ * be played, and our supports stay, so these give a lower bound on our
+ * power.  A character with a shield in the fight element is enough.
+ *
+ * The answer must agree with the search in find_action, which plays any
+ * card it can rather than pass.  So we also give up when our hand holds
+ * leadership or influence cards, or extras with texts other than retreat
+ * effects and restrictions, since the search might be made to play them.
+ */
+static int retreat_match(game *g)
+{
+	player *p, *opp;
+	card *c;
+	int i, e, v, cat, effect, icons, no_extra = 0, shield = 0;
+	int support_sum = 0, free_sum = 0, best_extra = 0;
+	int best_char = -1, best_go = -1;
+	int power, opp_power;
+
+	/* Get player pointers */
+	p = &g->p[g->turn];
+	opp = &g->p[!g->turn];
+
+	/* Only check when a character is still to be played */
+	if (!g->fight_started || p->phase > PHASE_CHAR) return 0;
+	if (p->phase > PHASE_START && p->char_played) return 0;
+
+	/* Get fight element */
+	e = g->fight_element;
+
+	/* Loop over opponent cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &opp->deck[i];
+
+		/* Skip inactive cards */
+		if (!c->active) continue;
+
+		/* Get special text (even if ignored now) */
+		cat = c->d_ptr->special_cat;
+		effect = c->d_ptr->special_effect;
+
+		/* Forced plays and discards are too complicated */
+		if (cat == 7) return 0;
+
+		/* Check for boost of a card that may still be chosen */
+		if (cat == 1 && !(effect & S1_IGNORE) &&
+		    (effect & (S1_ONE_CHAR | S1_ONE_BOOSTER | S1_ONE_SUPPORT)) &&
+		    !c->target) return 0;
+
+		/* Check for restriction on our plays */
+		if (cat == 3 && (effect & S3_YOU_MAY_NOT))
+		{
+			/* Limits on characters or counts are too complicated */
+			if (effect & (S3_CHARACTER | S3_COMBAT | S3_MORE_THAN))
+				return 0;
+
+			/* Extra cards may not be allowed */
+			if (effect & (S3_SUPPORT | S3_BOOSTER)) no_extra = 1;
+		}
+	}
+
+	/* Get opponent's power */
+	opp_power = compute_power(g, !g->turn);
+
+	/* Loop over our cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Landed ships change which cards may be played */
+		if (c->landed) return 0;
+
+		/* Cards played this turn change the limits */
+		if (c->recent) return 0;
+
+		/* Our own bluffs may be revealed or called first */
+		if (c->active && c->bluff) return 0;
+
+		/* Ships and influence cards may have to be dealt with first */
+		if (c->where == LOC_INFLUENCE ||
+		    (c->active && c->d_ptr->capacity)) return 0;
+
+		/* Get special text category */
+		cat = c->d_ptr->special_cat;
+
+		/* Check for active card */
+		if (c->active)
+		{
+			/* Card movement before announcing is too complicated */
+			if (cat == 4 &&
+			    c->d_ptr->special_time == TIME_ENDSUPPORT) return 0;
+
+			/* Dragons are too complicated */
+			if (cat == 6) return 0;
+
+			/* Ignore effects of old combat cards go away */
+			if (cat == 1 && c->where == LOC_COMBAT &&
+			    !c->text_ignored) return 0;
+
+			/* Skip non-support cards and bluffs */
+			if (c->where != LOC_SUPPORT || c->bluff) continue;
+
+			/* Skip cards with ignored values */
+			if (c->value_ignored) continue;
+
+			/* Boosts from old characters may go away */
+			v = c->value[e] < c->d_ptr->value[e] ? c->value[e] :
+			                                      c->d_ptr->value[e];
+
+			/* Add value */
+			if (v > 0) support_sum += v;
+			continue;
+		}
+
+		/* Skip cards that cannot be played from the hand */
+		if (c->where != LOC_HAND || c->random_fake) continue;
+
+		/* The search must play leadership and influence cards */
+		if (c->d_ptr->type > TYPE_SUPPORT) return 0;
+
+		/* It must also play extras whose text we do not follow */
+		if (c->d_ptr->type != TYPE_CHARACTER && cat && cat != 2 &&
+		    cat != 3) return 0;
+
+		/* Skip characters with text we do not follow */
+		if (cat == 1 || cat >= 4) continue;
+
+		/* Get current value (after opponent's ignore effects) */
+		v = c->value_ignored ? 0 : c->value[e];
+
+		/* Get icons the card may have */
+		icons = c->icons | c->d_ptr->icons;
+
+		/* Check for character */
+		if (c->d_ptr->type == TYPE_CHARACTER)
+		{
+			/* Check for shield in fight element */
+			if (c->icons & (1 << e)) shield = 1;
+
+			/* Track best character */
+			if (v > best_char) best_char = v;
+
+			/* Track best character that allows more cards */
+			if (!(icons & ICON_STOP) && v > best_go) best_go = v;
+			continue;
+		}
+
+		/* Skip cards that are not supports or boosters */
+		if (c->d_ptr->type != TYPE_SUPPORT &&
+		    c->d_ptr->type != TYPE_BOOSTER) continue;
+
+		/* Skip cards that add no power or may not be played */
+		if (v <= 0 || no_extra) continue;
+
+		/* Check for FREE card that allows more cards */
+		if ((c->icons & ICON_FREE) && !(icons & ICON_STOP))
+		{
+			/* Play all of these */
+			free_sum += v;
+			continue;
+		}
+
+		/* Track best extra card */
+		if (v > best_extra) best_extra = v;
+	}
+
+	/* Check for no character to play */
+	if (best_char < 0) return 0;
+
+	/* A shield leaves the opponent with no power */
+	if (shield) return 1;
+
+	/* Start with power of character alone */
+	power = best_char;
+
+	/* Check for more cards after a character without STOP */
+	if (best_go >= 0 && best_go + free_sum + best_extra > power)
+		power = best_go + free_sum + best_extra;
+
+	/* Power matches if our worst case is at least the opponent's best */
+	return support_sum + power >= opp_power;
+}
+
+/*
+ * Add an integer to a running game state hash (FNV-1a).
+ */
+#define HASH_INT(h, x) ((h) = ((h) ^ (unsigned int)(x)) * 1099511628211ULL)
+
+/*
+ * Add a card design pointer to a running game state hash.
+ *
+ * We hash the design's offset in the people table rather than its address,
+ * so that keys (and which cache entries collide) do not change between
+ * builds or runs.
+ */
+#define HASH_DESIGN(h, x) \
+	HASH_INT(h, (x) ? (char *)(x) - (char *)peoples + 1 : 0)
+
+/*
+ * Initial hash value.
+ */
+#define HASH_START 14695981039346656037ULL
+
+/*
+ * Add everything about a card to a running hash.
+ */
+static unsigned long long hash_card(unsigned long long h, card *c)
+{
+	/* Add card design and location */
+	HASH_DESIGN(h, c->d_ptr);
+	HASH_INT(h, c->where);
+
+	/* Add targets */
+	HASH_DESIGN(h, c->target);
+	HASH_DESIGN(h, c->ship);
+
+	/* Add type and values */
+	HASH_INT(h, c->type);
+	HASH_INT(h, c->printed[0]);
+	HASH_INT(h, c->printed[1]);
+	HASH_INT(h, c->value[0]);
+	HASH_INT(h, c->value[1]);
+	HASH_INT(h, c->icons);
+
+	/* Add flags */
+	HASH_INT(h, c->on_bottom | c->recent << 1 | c->active << 2 |
+	            c->playing_free << 3 | c->was_played_free << 4 |
+	            c->bluff << 5 | c->landed << 6 | c->value_ignored << 7 |
+	            c->text_ignored << 8 | c->text_boosted << 9 |
+	            c->used << 10 | c->loc_known << 11 | c->disclosed << 12);
+
+	/* Add location of random pick (not just a flag) */
+	HASH_INT(h, c->random_fake);
+
+	/* Return new hash */
+	return h;
+}
+
+/*
+ * Add everything about a player except their cards to a running hash.
+ */
+static unsigned long long hash_player(unsigned long long h, player *p)
+{
+	int i;
+
+	/* Add counters */
+	HASH_INT(h, p->dragons);
+	HASH_INT(h, p->instant_win);
+	HASH_INT(h, p->crystals);
+	HASH_INT(h, p->no_cards);
+	HASH_INT(h, p->phase);
+	HASH_INT(h, p->char_played);
+	HASH_INT(h, p->min_power);
+	HASH_INT(h, p->cards_drawn);
+	HASH_INT(h, p->last_played);
+
+	/* Add last cards played */
+	HASH_DESIGN(h, p->last_leader);
+	HASH_DESIGN(h, p->last_discard);
+
+	/* Add stack sizes */
+	for (i = 0; i < LOC_MAX; i++) HASH_INT(h, p->stack[i]);
+
+	/* Return new hash */
+	return h;
+}
+
+/*
+ * Check whether an active card has text or icons that may change what
+ * the other player can do in a fight.
+ */
+static int card_has_effect(card *c)
+{
+	/* Check for special text */
+	if (c->d_ptr->special_cat && !c->text_ignored) return 1;
+
+	/* Check for icons that protect or stop */
+	return ((c->icons | c->d_ptr->icons) &
+	        (ICON_SHIELD_F | ICON_SHIELD_E | ICON_STOP |
+	         ICON_PROTECTED)) != 0;
+}
+
+/*
+ * Compute the key used to look up a forced retreat check.
+ *
+ * Whether the responder (the current player) can answer depends on their
+ * hand (and which of those cards the announcer knows about), the fight
+ * element, the announcer's power and the active cards with effects.  All
+ * of the responder's active cards are included, since a new character
+ * replaces the power of the old.
+ *
+ * If the responder has effects that may ignore, move or otherwise depend
+ * on the announcer's cards, all of the announcer's active cards are
+ * included as well, and their hand if the effects may look at it.
+ *
+ * The draw and discard piles are included when the responder has an
+ * effect that may draw, search, retrieve or discard cards, since what it
+ * may take depends on them.  The random seed is left out: in a simulated
+ * game a card picked at random is marked and cannot be played, so which
+ * card it was does not change the result.
+ */
+static unsigned long long retreat_key(game *g)
+{
+	player *p, *opp;
+	card *c;
+	unsigned long long h = HASH_START;
+	int i, n, cat, effect, reach = 0, hand = 0, piles = 0;
+
+	/* Get player pointers */
+	p = &g->p[g->turn];
+	opp = &g->p[!g->turn];
+
+	/* Add game and search state */
+	HASH_INT(h, g->turn);
+	HASH_INT(h, g->fight_element);
+	HASH_INT(h, inside_choose);
+	HASH_INT(h, checking_decline);
+
+	/* Add responder's counters that limit what may be played */
+	HASH_INT(h, p->phase);
+	HASH_INT(h, p->char_played);
+	HASH_INT(h, p->min_power);
+
+	/* Add announcer's power */
+	HASH_INT(h, compute_power(g, !g->turn));
+
+	/* Loop over responder's cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards that are neither active nor in hand */
+		if (!c->active && c->where != LOC_HAND) continue;
+
+		/* Add card index and card (including whether it is known) */
+		HASH_INT(h, i);
+		h = hash_card(h, c);
+
+		/* Skip cards with ignored text */
+		if (c->active && c->text_ignored) continue;
+
+		/* Get special text category and effect */
+		cat = c->d_ptr->special_cat;
+		effect = c->d_ptr->special_effect;
+
+		/* Check for effects beyond restrictions on play */
+		if ((cat && cat != 3) || c->d_ptr->capacity) reach = 1;
+
+		/* Check for effects on the announcer's hand */
+		if (cat == 7 || cat == 8 ||
+		    (cat == 4 && (effect & S4_YOUR_HAND)) ||
+		    (cat == 5 && (effect & S5_YOU_HANDSIZE))) hand = 1;
+
+		/* Check for effects that take cards from the piles */
+		if (cat == 4 || cat == 8) piles = 1;
+	}
+
+	/* Add announcer's dragons if they may matter */
+	if (reach) HASH_INT(h, opp->dragons);
+
+	/* Check for piles that may matter */
+	if (piles)
+	{
+		/* Loop over players */
+		for (n = 0; n < 2; n++)
+		{
+			/* Loop over cards */
+			for (i = 1; i < DECK_SIZE; i++)
+			{
+				/* Get card pointer */
+				c = &g->p[n].deck[i];
+
+				/* Skip cards not in draw or discard pile */
+				if (c->where != LOC_DRAW &&
+				    c->where != LOC_DISCARD) continue;
+
+				/* Add player, card index and card */
+				HASH_INT(h, n);
+				HASH_INT(h, i);
+				h = hash_card(h, c);
 			}
 		}
+	}
+
+	/* Loop over announcer's cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &opp->deck[i];
+
+		/* Check for card in hand */
+		if (c->where == LOC_HAND)
+		{
+			/* Skip cards in hand unless they may matter */
+			if (!hand) continue;
+		}
+
+		/* Skip other inactive cards */
+		else if (!c->active) continue;
+
+		/* Skip cards without effects unless they may matter */
+		else if (!reach && !card_has_effect(c)) continue;
+
+		/* Add card index and card */
+		HASH_INT(h, i);
+		h = hash_card(h, c);
+	}
+
+	/* Return key */
+	return h;
+}
+
+/*
+ * Compute a key for the game state as seen by the given player.
+ *
+ * Opponent cards whose locations are unknown to the player are left out,
+ * as are the random seed and simulation information, so that states
+ * reached in a simulation and in the real game may match.
+ */
+static unsigned long long view_key(game *g, int who)
+{
+	card *c;
+	unsigned long long h = HASH_START;
+	int i;
+
+	/* Add game state */
+	HASH_INT(h, who);
+	HASH_INT(h, g->turn);
+	HASH_INT(h, g->fight_element);
+	HASH_INT(h, g->fight_started);
+	HASH_INT(h, g->game_over);
+
+	/* Add player state */
+	h = hash_player(h, &g->p[0]);
+	h = hash_player(h, &g->p[1]);
+
+	/* Loop over our cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Add card */
+		h = hash_card(h, &g->p[who].deck[i]);
+	}
+
+	/* Loop over opponent's cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &g->p[!who].deck[i];
+
+		/* Skip cards with unknown location */
+		if (!c->loc_known) continue;
+
+		/* Add card index and card */
+		HASH_INT(h, i);
+		h = hash_card(h, c);
+	}
+
+	/* Return key */
+	return h;
+}
+
+/*
+ * Compute the key used to look up the score of a turn-ending leaf.
+ *
+ * The key covers the whole game state, including the random seed of the
+ * simulation, since the forced retreat check may draw cards.
+ */
+static unsigned long long leaf_key(game *g)
+{
+	unsigned long long h = HASH_START;
+	int i;
+
+	/* Add game state */
+	HASH_INT(h, g->turn);
+	HASH_INT(h, g->sim_turn);
+	HASH_INT(h, g->fight_element);
+	HASH_INT(h, g->fight_started);
+	HASH_INT(h, g->game_over);
+	HASH_INT(h, g->random_seed);
+
+	/* Add search state */
+	HASH_INT(h, inside_choose);
+	HASH_INT(h, checking_decline);
+
+	/* Add player state */
+	h = hash_player(h, &g->p[0]);
+	h = hash_player(h, &g->p[1]);
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Add both players' cards */
+		h = hash_card(h, &g->p[0].deck[i]);
+		h = hash_card(h, &g->p[1].deck[i]);
+	}
+
+	/* Return key */
+	return h;
+}
+
+/*
+ * Look for a decision made while pondering.
+ */
+static ponder_entry *ponder_lookup(int kind, unsigned long long key)
+{
+	int i;
+
+	/* Loop over pondered decisions */
+	for (i = 0; i < num_ponder; i++)
+	{
+		/* Check for match */
+		if (ponder_result[i].kind == kind &&
+		    ponder_result[i].key == key)
+		{
+			/* Return decision */
+			return &ponder_result[i];
+		}
+	}
+
+	/* No decision found */
+	return NULL;
+}
+
+/*
+ * Return true if the current player of a simulated game is certain to be
+ * forced to retreat.
+ */
+static int retreat_forced(game *sim)
+{
+	retreat_entry *r_ptr = NULL;
+	unsigned long long key = 0;
+
+	/* Check for retreat proven to be forced */
+	if (retreat_bound(sim))
+	{
+		/* Count checks answered by bounds */
+		STAT_ADD(retreat_bound);
+
+		/* Retreat is forced */
+		return 1;
+	}
+
+	/* Check for power proven to be reachable */
+	if (retreat_match(sim))
+	{
+		/* Count checks answered by bounds */
+		STAT_ADD(retreat_bound);
+
+		/* Retreat is not forced */
+		return 0;
+	}
+
+	/* Only use cache when no choices are waiting to be made */
+	if (node_pos == node_len)
+	{
+		/* Compute cache key */
+		key = retreat_key(sim);
+
+		/* Get cache entry */
+		r_ptr = &retreat_cache[key % RETREAT_CACHE_SIZE];
+
+		/* Check for previous result */
+		if (r_ptr->age == cache_age && r_ptr->key == key)
+		{
+			/* Count checks answered by cache */
+			STAT_ADD(retreat_cached);
+
+			/* Return saved result */
+			return r_ptr->forced;
+		}
+	}
+
+	/* Set retreat flag */
+	must_retreat = 1;
+	checking_retreat = 1;
+
+	/* Simulate possible actions */
+	find_action(sim);
+
+	/* Clear retreat check flag */
+	checking_retreat = 0;
+
+	/* Check for search stopped before result was known */
+	if (SEARCH_STOPPED())
+	{
+		/* Assume no retreat */
+		return 0;
+	}
+
+	/* Check for entry to store result in */
+	if (r_ptr)
+	{
+		/* Store result */
+		r_ptr->key = key;
+		r_ptr->age = cache_age;
+		r_ptr->forced = must_retreat;
+	}
+
+	/* Return whether retreat flag is still set */
+	return must_retreat;
+}
+
+/*
+ * Guess where a player's unknown cards are, using the opponent's belief.
+ *
+ * As many unknown cards as the player has in hand are picked for the hand,
+ * each with weight equal to its chance of being there.  The rest are put
+ * in the draw pile.  Return the chance of the guess under the belief.
+ */
+static double guess_hand(game *sim, int who, unsigned int *seed)
+{
+	player *p;
+	card *c, *unknown[DECK_SIZE];
+	double total, pick, chance = 1;
+	int i, j, n = 0, hand = 0;
+
+	/* Get player pointer */
+	p = &sim->p[who];
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards with known locations */
+		if (c->loc_known && !c->random_fake) continue;
+
+		/* Skip cards not in hand or draw pile */
+		if (c->where != LOC_HAND && c->where != LOC_DRAW) continue;
+
+		/* Count unknown cards in hand */
+		if (c->where == LOC_HAND) hand++;
+
+		/* Clear "random" flag */
+		c->random_fake = 0;
+
+		/* Assume card is in draw pile */
+		c->where = LOC_DRAW;
+
+		/* Add to list */
+		unknown[n++] = c;
+	}
+
+	/* Pick cards for hand */
+	for (i = 0; i < hand; i++)
+	{
+		/* Add up weights of cards left */
+		total = 0;
+		for (j = i; j < n; j++) total += unknown[j]->hand_prob;
+
+		/* Pick a point among the weights */
+		pick = total * myrand(seed) / 32768.0;
+
+		/* Find card at that point */
+		for (j = i; j < n - 1; j++)
+		{
+			/* Check for point within this card's weight */
+			if (pick < unknown[j]->hand_prob) break;
+
+			/* Move past this card */
+			pick -= unknown[j]->hand_prob;
+		}
+
+		/* Move picked card to front */
+		c = unknown[j];
+		unknown[j] = unknown[i];
+		unknown[i] = c;
+
+		/* Put card in hand */
+		c->where = LOC_HAND;
+	}
+
+	/* Compute chance of guess */
+	for (i = 0; i < n; i++)
+	{
+		/* Multiply by chance of card being where it was put */
+		if (i < hand) chance *= unknown[i]->hand_prob;
+		else chance *= 1 - unknown[i]->hand_prob;
+	}
+
+	/* Card legality may have changed */
+	clear_legal(sim);
+
+	/* Return chance */
+	return chance;
+}
+
+/*
+ * Check if current player must retreat.
+ *
+ * We run this check from the point of view of the opponent.
+ *
+ * If current player must retreat, simulate the results.
+ */
+static void check_retreat(game *g)
+{
+	search_frame *frame;
+	player *p, *opp;
+	card *c;
+	unsigned long long guesses[MAX_SAMPLES];
+	unsigned long long key;
+	unsigned int seed;
+	double chance, forced = 0, total = 0;
+	int i, k;
+	int all_known = 1, bluff = 0;
+
+	/* Count checks */
+	STAT_ADD(retreat);
+
+	/* Do nothing if no fight to retreat from */
+	if (!g->fight_started) return;
+
+	/* Get opponent pointer */
+	opp = &g->p[!g->turn];
+
+	/* Loop over opponent cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &opp->deck[i];
+
+		/* Skip inactive cards */
+		if (!c->active) continue;
+
+		/* Check for bluff card */
+		if (c->bluff) bluff = 1;
+
+		/* Skip cards with text ignored */
+		if (c->text_ignored) continue;
+
+		/* Skip cards without category 3 special text */
+		if (c->d_ptr->special_cat != 3) continue;
+
+		/* Skip cards that don't disallow calling bluff */
+		if (c->d_ptr->special_effect !=(S3_YOU_MAY_NOT | S3_CALL_BLUFF))
+			continue;
+
+		/* Assume no bluff cards are in play */
+		bluff = 0;
+		break;
+	}
+
+	/* Do not check for forced retreat if bluff may be called */
+	if (bluff) return;
+
+	/* Get player pointer */
+	p = &g->p[g->turn];
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip cards not in hand */
+		if (c->where != LOC_HAND) continue;
+
+		/* Check for unknown card */
+		if (!c->loc_known) all_known = 0;
+	}
+
+	/* Get frame for simulated opponent */
+	frame = push_frame();
+
+	/* Do not check if no frames are left */
+	if (!frame) return;
+
+	/* Check for guesses of unknown cards to be made */
+	if (!all_known && ai_samples > 0)
+	{
+		/* Start guesses from current state */
+		seed = g->random_seed;
+
+		/* Try several guesses */
+		for (k = 0; k < ai_samples && k < MAX_SAMPLES; k++)
+		{
+			/* Simulate game */
+			simulate_game(&frame->sim, g);
+
+			/* Guess where unknown cards are */
+			chance = guess_hand(&frame->sim, frame->sim.turn, &seed);
+
+			/* Identify guess */
+			key = retreat_key(&frame->sim);
+
+			/* Skip guesses already tried */
+			for (i = 0; i < k; i++) if (guesses[i] == key) break;
+
+			/* Remember guess */
+			guesses[k] = key;
+
+			/* Check for repeated guess */
+			if (i < k) continue;
+
+			/* Count guesses checked */
+			STAT_ADD(retreat_guess);
+
+			/* Add weight of forced retreats */
+			if (retreat_forced(&frame->sim)) forced += chance;
+
+			/* Add weight of guess */
+			total += chance;
+
+			/* Stop if search has been stopped */
+			if (SEARCH_STOPPED()) break;
+		}
+
+		/* Release frame */
+		pop_frame();
+
+		/* Do nothing if search has been stopped */
+		if (SEARCH_STOPPED()) return;
+
+		/* Retreat if forced in most likely guesses */
+		if (forced * 2 > total) retreat(g);
+
+		/* Done */
+		return;
+	}
+
+	/* Simulate game */
+	simulate_game(&frame->sim, g);
+
+	/* Get player pointer */
+	p = &frame->sim.p[frame->sim.turn];
+
+	/* Check for not all cards in hand known */
+	if (!all_known)
+	{
+		/* Pretend all unknown cards are in hand */
+		for (i = 1; i < DECK_SIZE; i++)
+		{
+			/* Get card pointer */
+			c = &p->deck[i];
+
+			/* Skip cards with known locations */
+			if (c->loc_known && !c->random_fake) continue;
+
+			/* Clear "random" flag */
+			c->random_fake = 0;
+
+			/* Move card to hand */
+			c->where = LOC_HAND;
+		}
+
+		/* Card legality may have changed */
+		clear_legal(&frame->sim);
+	}
+
+	/* Check whether anything else is possible */
+	forced = retreat_forced(&frame->sim);
+
+	/* Release frame */
+	pop_frame();
+
+	/* Force current player to retreat if nothing else is possible */
+	if (forced) retreat(g);
+}
+
+/*
+ * Simulate the results of declining a fight.
+ *
+ * Here we assume that the opponent will start a fight.  We check both
+ * elements, and assume the worst will be chosen.
+ */
+static double check_decline(game *g, int who)
+{
+	search_frame *frame;
+	player *opp = &g->p[who];
+	double score, b_s;
+
+	/* Count checks */
+	STAT_ADD(decline);
+
+	/* Get score of current situation */
+	b_s = eval_game(g, who);
+
+	/* Check for no response possible from opponent */
+	if (opp->stack[LOC_HAND] == 0) return b_s;
+
+	/* Get frame for simulated responses */
+	frame = push_frame();
+
+	/* Use current score if no frames are left */
+	if (!frame) return b_s;
+
+	/* Set checking flag */
+	checking_decline = 1;
+
+	/* Simulate game */
+	simulate_game(&frame->sim, g);
+
+	/* Simulate fight started in fire */
+	frame->sim.fight_started = 1;
+	frame->sim.fight_element = 0;
+	frame->sim.turn = who;
 
-		/* Loop over stack sizes */
-		for (j = 0; j < 8; j++)
-		{
-			/* Set input if player has this many cards played */
-			SET_INPUT(l, n++, stack > j);
-		}
+	/* Get score */
+	score = eval_game(&frame->sim, who);
 
-		/* Loop over bluff counts */
-		for (j = 0; j < 4; j++)
-		{
-			/* Set input if player has this many bluffs */
-			SET_INPUT(l, n++, bluff > j);
-		}
+	/* Check for worse */
+	if (score < b_s) b_s = score;
 
-		/* Count cards in hand */
-		stack = p->stack[LOC_HAND];
+	/* Simulate game */
+	simulate_game(&frame->sim, g);
 
-		/* Loop over hand sizes */
-		for (j = 0; j < 10; j++)
-		{
-			/* Set input if player has this many cards */
-			SET_INPUT(l, n++, stack > j);
-		}
+	/* Simulate fight started in earth */
+	frame->sim.fight_started = 1;
+	frame->sim.fight_element = 1;
+	frame->sim.turn = who;
 
-		/* Count cards in draw deck and hand */
-		stack = p->stack[LOC_DRAW] + p->stack[LOC_HAND];
+	/* Get score */
+	score = eval_game(&frame->sim, who);
 
-		/* Loop over deck sizes */
-		for (j = 0; j < 30; j++)
-		{
-			/* Set input if player has this many cards */
-			SET_INPUT(l, n++, stack > j);
-		}
+	/* Check for worse */
+	if (score < b_s) b_s = score;
 
-		/* Assume no characters */
-		stack = 0;
+	/* Clear checking flag */
+	checking_decline = 0;
 
-		/* Loop over deck */
+	/* Release frame */
+	pop_frame();
+
+	/* Return worst case */
+	return b_s;
+}
+
+/*
+ * Return true if neither player has any hidden cards left.
+ *
+ * Once both draw piles are empty and every card in hand (or played as a
+ * bluff) is known, the rest of the game can be searched exactly.
+ */
+static int endgame_known(game *g)
+{
+	player *p;
+	card *c;
+	int i, j;
+
+	/* Loop over players */
+	for (i = 0; i < 2; i++)
+	{
+		/* Get player pointer */
+		p = &g->p[i];
+
+		/* Cards left to draw are unknown */
+		if (p->stack[LOC_DRAW]) return 0;
+
+		/* Loop over cards */
 		for (j = 1; j < DECK_SIZE; j++)
 		{
 			/* Get card pointer */
 			c = &p->deck[j];
 
-			/* Skip non-characters */
-			if (c->d_ptr->type != TYPE_CHARACTER) continue;
+			/* Skip cards not hidden from the opponent */
+			if (c->where != LOC_HAND && !c->bluff) continue;
 
-			/* Skip cards not in hand */
-			if (c->where == LOC_HAND &&
-			    (who == i || c->loc_known) &&
-			    !c->random_fake)
-			{
-				/* Add more character */
-				stack++;
-			}
+			/* Check for unknown card */
+			if (!c->loc_known || c->random_fake) return 0;
 		}
+	}
 
-		/* Loop over character counts */
-		for (j = 0; j < 5; j++)
-		{
-			/* Set input if player has this many characters */
-			SET_INPUT(l, n++, stack > j);
-		}
+	/* Everything is known */
+	return 1;
+}
 
-		/* Assume no undisclosed cards */
-		stack = 0;
+/*
+ * Return the result of a finished game for the given player.
+ */
+static double game_result(game *g, int who)
+{
+	int winner;
 
-		/* Loop over deck */
-		for (j = 1; j < DECK_SIZE; j++)
-		{
-			/* Get card pointer */
-			c = &p->deck[j];
+	/* Determine winner the same way as game_over() */
+	if (g->p[0].dragons) winner = 0;
+	else if (g->p[1].dragons) winner = 1;
+	else if (g->p[0].no_cards) winner = 1;
+	else winner = 0;
 
-			/* Skip cards not in hand */
-			if (c->where != LOC_HAND) continue;
+	/* Return result */
+	return winner == who ? 1.0 : 0.0;
+}
 
-			/* Skip disclosed cards */
-			if (c->disclosed) continue;
+/*
+ * Score a position at the start of a turn by searching that turn (and
+ * possibly later turns) exactly.
+ *
+ * The position is searched from the point of view of the player to move,
+ * and stops as soon as that player finds a path the previous turn would
+ * never allow, in which case the score is only an upper bound.
+ */
+static double solve_leaf(game *g)
+{
+	search_frame *frame;
+	solve_entry *s_ptr;
+	unsigned long long key;
+	int old_pos, flip, cut;
+	double old_score, old_cutoff, old_prune_score, old_prune_est;
+	double score;
 
-			/* Count undisclosed cards */
-			stack++;
-		}
+	/* Compute cache key */
+	key = leaf_key(g);
 
-		/* Loop over disclose counts */
-		for (j = 0; j < 6; j++)
-		{
-			/* Set input if player has this cards disclosed */
-			SET_INPUT(l, n++, stack > j);
-		}
+	/* Get cache entry */
+	s_ptr = &solve_cache[key % SOLVE_CACHE_SIZE];
 
-		/* Set input if player is first to run out of cards */
-		SET_INPUT(l, n++, p->no_cards);
+	/* Check for previous result searched at least as far */
+	if (s_ptr->age == cache_age && s_ptr->key == key &&
+	    s_ptr->turns >= solve_turns &&
+	    (!s_ptr->upper || s_ptr->score < best_path_score))
+	{
+		/* Count scores answered by cache */
+		STAT_ADD(solve_cached);
 
-		/* Loop over dragon counts */
-		for (j = 0; j < 3; j++)
-		{
-			/* Set input if player has this many dragons */
-			SET_INPUT(l, n++, p->dragons > j);
-		}
+		/* Return saved score */
+		return s_ptr->score;
+	}
 
-		/* Set input if player has instant victory */
-		SET_INPUT(l, n++, p->instant_win);
+	/* Get frame for searching turn */
+	frame = push_frame();
+
+	/* Evaluate normally if no frames are left */
+	if (!frame) return eval_game(g, g->sim_turn);
+
+	/* Count turns searched */
+	STAT_ADD(solved);
+
+	/* Save current search */
+	memcpy(frame->u.path, best_path, sizeof(action) * MAX_ACTION);
+	old_pos = best_path_pos;
+	old_score = best_path_score;
+	old_cutoff = solve_cutoff;
+	old_prune_score = prune_score;
+	old_prune_est = prune_est;
+
+	/* Simulate game */
+	simulate_game(&frame->sim, g);
+
+	/* Search from point of view of player to move */
+	frame->sim.sim_turn = frame->sim.turn;
+
+	/* Check for score that must be reversed */
+	flip = frame->sim.sim_turn != g->sim_turn;
+
+	/* Start new search */
+	best_path_pos = 0;
+	best_path_score = -1;
+	prune_score = -1;
+
+	/* Opponent's paths better than our best leaf so far do not matter */
+	solve_cutoff = flip ? 1 - old_score : 2;
+
+	/* Search one fewer turn exactly */
+	solve_turns--;
+
+	/* Find best path of this turn */
+	score = find_action(&frame->sim);
+
+	/* Restore turns left */
+	solve_turns++;
+
+	/* Check for search stopped early */
+	cut = SOLVE_CUTOFF();
+
+	/* Restore current search */
+	memcpy(best_path, frame->u.path, sizeof(action) * MAX_ACTION);
+	best_path_pos = old_pos;
+	best_path_score = old_score;
+	solve_cutoff = old_cutoff;
+	prune_score = old_prune_score;
+	prune_est = old_prune_est;
+
+	/* Release frame */
+	pop_frame();
+
+	/* Check for no legal actions or search stopped */
+	if (score < 0) return eval_game(g, g->sim_turn);
+
+	/* Convert to our point of view */
+	if (flip) score = 1 - score;
+
+	/* Check for complete result */
+	if (!SEARCH_STOPPED())
+	{
+		/* Store result */
+		s_ptr->key = key;
+		s_ptr->age = cache_age;
+		s_ptr->turns = solve_turns;
+		s_ptr->upper = cut && flip;
+		s_ptr->score = score;
 	}
 
-	/* Compute network value */
-	compute_net(l);
+	/* Return score */
+	return score;
+}
 
-#ifdef DEBUG
-	/* Print score and path to get here */
-	if (verbose && !checking_retreat && best_path_pos > 0)
+/*
+ * Handle a choice to be made.
+ */
+static double choose_action(game *g)
+{
+	search_frame *frame;
+	design *list[DECK_SIZE], **choices;
+	node *n_ptr;
+	void *data;
+	double score, b_s = -1;
+	int old_turn;
+	int best_combo = 0;
+	int i, j, num_chosen;
+
+	/* Get current player's turn */
+	old_turn = g->turn;
+
+	/* Get frame for this level of search */
+	frame = push_frame();
+
+	/* Check for no frames left */
+	if (!frame)
 	{
-		printf("%.12lf: ", l->win_prob[who]);
+		/* Drop choices that cannot be examined */
+		node_len = node_pos;
 
-		for (i = 0; i <= best_path_pos; i++)
-		{
-			action a;
+		/* Score current state */
+		return eval_game(g, g->sim_turn);
+	}
 
-			a = cur_path[i];
+	/* Get pointer to choice node */
+	n_ptr = &nodes[node_pos];
 
-			switch (a.act)
+	/* Track current choice node */
+	node_pos++;
+	best_path_pos++;
+
+	/* Loop over choices */
+	for (i = 0; i < n_ptr->num_legal; i++)
+	{
+		/* Avoid unnecessary work when checking for forced retreat */
+		if (checking_retreat && !must_retreat) break;
+
+		/* Stop searching when asked */
+		if (SEARCH_STOPPED()) break;
+
+		/* Stop once previous turn would not allow this one */
+		if (SOLVE_CUTOFF()) break;
+
+		/* Clear number chosen */
+		num_chosen = 0;
+
+		/* Get choice list */
+		choices = n_ptr->choices;
+
+		/* Get callback data */
+		data = n_ptr->data;
+
+		/* Loop over combination */
+		for (j = 0; (1 << j) <= n_ptr->legal[i]; j++)
+		{
+			/* Check for bit set */
+			if (n_ptr->legal[i] & (1 << j))
 			{
-				case ACT_NONE: break;
-				case ACT_RETREAT: printf("Retreat "); break;
-				case ACT_RETRIEVE: printf("Retrieve %s ", a.arg->name); break;
-				case ACT_PLAY: printf("Play %s ", a.arg->name); break;
-				case ACT_PLAY_NO: printf("Play (no) %s ", a.arg->name); break;
-				case ACT_ANN_FIRE: printf("Announce fire "); break;
-				case ACT_ANN_EARTH: printf("Announce earth "); break;
-				case ACT_USE: printf("Use %s ", a.arg->name); break;
-				case ACT_SATISFY: printf("Satsify %s ", a.arg->name); break;
-				case ACT_CHOOSE: printf("Choose %d ", a.chosen); break;
-				case ACT_LAND: printf("Land %s ", a.arg->name); break;
-				case ACT_LOAD: printf("Load %s on %s ", a.arg->name, a.target->name); break;
-				case ACT_BLUFF: printf("Bluff %s ", a.arg->name); break;
-				case ACT_REVEAL: printf("Reveal %s ", a.arg->name); break;
+				/* Add choice to list */
+				list[num_chosen++] = choices[j];
 			}
 		}
 
-		if (must_retreat) printf("Force retreat");
+#ifdef DEBUG
+		/* Remember current path */
+		cur_path[best_path_pos].act = ACT_CHOOSE;
+		cur_path[best_path_pos].chosen = n_ptr->legal[i];
+#endif
 
-		if (checking_decline)
+		/* Simulate game */
+		simulate_game(&frame->sim, g);
+
+		/* Make choice */
+		if (!n_ptr->callback(&frame->sim, n_ptr->who, list, num_chosen,
+		                     data))
 		{
-			printf("Responding %s", g->fight_element ? "earth" : "fire");
+			printf("Callback failed!\n");
+		}
+
+		/* Check for turn change */
+		if (frame->sim.turn != old_turn)
+		{
+			/* Are we checking forced retreat */
+			if (checking_retreat)
+			{
+				/* Score is unimportant */
+				score = 0;
+			}
+			else if (solve_turns && node_pos == node_len &&
+			         endgame_known(&frame->sim))
+			{
+				/* Search opponent's response exactly */
+				score = solve_leaf(&frame->sim);
+			}
+			else
+			{
+				/* Assume worst-case response from opponent */
+				score = check_decline(&frame->sim,
+				                      frame->sim.sim_turn);
+			}
+		}
+		else
+		{
+			/* Continue searching */
+			score = find_action(&frame->sim);
+		}
+
+		/* Check for better score among actions */
+		if (score >= b_s)
+		{
+			/* Remember best */
+			b_s = score;
+			best_combo = n_ptr->legal[i];
 		}
-	
-		printf("\n");
 	}
-#endif
-
-	/* Return output */
-	return l->win_prob[who];
-}
-
-/*
- * Perform a training iteration.
- *
- * The "desired" array is passed only at the end of the game.  Otherwise
- * we train the network to give results (using past inputs) to be like our
- * results using current inputs.
- */
-static void perform_training(game *g, int who, double *desired)
-{
-	double target[2];
-	double lambda = 1.0;
-	int i;
-	net *l;
-
-	/* Get correct network to train */
-	l = &learner[who];
 
-	/* Check for uninitialized network */
-	if (!l->num_inputs) return;
+	/* Release frame */
+	pop_frame();
 
-	/* Get current state */
-	eval_game(g, who);
+	/* Remove node from list */
+	node_pos--;
+	node_len--;
 
-	/* Store current inputs */
-	store_net(l);
+	/* Return to current path position */
+	best_path_pos--;
 
-	/* Check for passed in results */
-	if (desired)
+	/* Check for better actions than previously discovered */
+	if (!checking_retreat && b_s >= best_path_score)
 	{
-		/* Copy results */
-		target[0] = desired[0];
-		target[1] = desired[1];
+		/* Store action in best path */
+		best_path[best_path_pos].act = ACT_CHOOSE;
+		best_path[best_path_pos].chosen = best_combo;
 
-		/* Train current inputs with desired outputs */
-		train_net(l, lambda, target);
-	}
-	else
-	{
-		/* Copy results */
-		target[0] = l->win_prob[0];
-		target[1] = l->win_prob[1];
+		/* Save best score seen */
+		best_path_score = b_s;
 	}
 
-	/* Loop over past inputs (starting with most recent) */
-	for (i = l->num_past - 2; i >= 0; i--)
-	{
-		/* Copy past inputs to network */
-		memcpy(l->input_value, l->past_input[i],
-		       sizeof(int) * (l->num_inputs + 1));
-
-		/* Compute net */
-		compute_net(l);
-
-		/* Train using this */
-		train_net(l, lambda, target);
-
-		/* Reduce training amount for less recent results */
-		lambda *= 0.9;
-	}
+	/* Return best score */
+	return b_s;
 }
 
 /*
- * Initialize AI.
+ * Cheaply estimate how good a leaf is for the player who initiated the
+ * simulation, from the difference in dragons and in cards left.
  */
-static void ai_initialize(game *g, int who)
+static double leaf_estimate(game *g)
 {
-	char fname[1024], buf[1024];
-
-	/* Create neural net */
-	make_learner(&learner[who], NET_INPUT, HIDDEN_NODES, 2);
-
-	/* Set learning rate */
-	learner[who].alpha = 0.0001;
-	/* learner[who].alpha = 0.0; printf("WARNING: alpha is 0\n"); */
-
-	/* Create network filename */
-	sprintf(fname, DATADIR "/networks/bluemoon.net.%s.%s",
-	                                     g->p[who].p_ptr->name,
-	                                     g->p[!who].p_ptr->name);
-
-	/* Attempt to load net weights from disk */
-	if (load_net(&learner[who], fname))
-	{
-		/* Create warning message */
-		sprintf(buf,
-		        _("WARNING: Couldn't open %s, expect random play!\n"),
-		        fname);
+	player *p, *opp;
+	int cards;
 
-		/* Send message */
-		message_add(buf);
-	}
+	/* Get player pointers */
+	p = &g->p[g->sim_turn];
+	opp = &g->p[!g->sim_turn];
 
-	/* Evaluate starting position */
-	eval_game(g, who);
+	/* Count difference in cards left */
+	cards = p->stack[LOC_HAND] + p->stack[LOC_DRAW] -
+	        opp->stack[LOC_HAND] - opp->stack[LOC_DRAW];
 
-	/* Message */
-	if (verbose >= 1)
-	{
-		/* Print win probabilities of starting state */
-		printf("%s Start prob: %f %f\n", g->p[who].p_ptr->name,
-						 learner[who].win_prob[0],
-						 learner[who].win_prob[1]);
-	}
+	/* Return estimate */
+	return PRUNE_DRAGON * (p->dragons - opp->dragons) + PRUNE_CARD * cards;
 }
 
 /*
- * Return how many more bluff cards we can play before it is obvious that
- * it is bad.
+ * Check whether a leaf is clearly worse than the best leaf so far.
  *
- * Return a negative number if we are already at or past that point.
+ * If so, an estimated score below the best is stored and we return
+ * true.  Otherwise the leaf's estimate is saved in "est".
  */
-static int check_auto_bluff(game *g, int future)
+static int prune_leaf(game *g, double *score, double *est)
 {
-	player *p;
-	card *c;
-	int i;
-	int bluff = 0, unknown_f = 0, unknown_e = 0;
-
-	/* Get player pointer */
-	p = &g->p[g->turn];
-
-	/* Check for uncallable bluff */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+	/* Check for pruning disabled */
+	if (!prune_margin || inside_choose || checking_decline) return 0;
 
-		/* Skip cards without category 3 special text */
-		if (c->d_ptr->special_cat != 3) continue;
-
-		/* Check for "you may not call bluff" text */
-		if (c->d_ptr->special_effect !=(S3_YOU_MAY_NOT | S3_CALL_BLUFF))
-		{
-			continue;
-		}
+	/* Estimate leaf */
+	*est = leaf_estimate(g);
 
-		if (c->active && !c->text_ignored) return 99;
+	/* Check for no leaf evaluated yet */
+	if (prune_score < 0) return 0;
 
-		if (c->where == LOC_HAND && future) return 99;
-	}
+	/* Check for leaf that may still matter */
+	if (*est + prune_margin >= prune_est) return 0;
 
-	/* Loop over cards */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+	/* Count pruned leaves */
+	STAT_ADD(pruned);
 
-		/* Check for fire bluff icon */
-		if (c->d_ptr->icons & ICON_BLUFF_F)
-		{
-			/* Count cards with unknown locations */
-			if (!c->loc_known) unknown_f++;
-		}
+	/* Guess score from difference in estimates */
+	*score = prune_score + *est - prune_est;
 
-		/* Check for earth bluff icon */
-		if (c->d_ptr->icons & ICON_BLUFF_E)
-		{
-			/* Count cards with unknown locations */
-			if (!c->loc_known) unknown_e++;
-		}
+	/* Leaf pruned */
+	return 1;
+}
 
-		/* Count bluff cards */
-		if (c->bluff) bluff++;
-	}
+/*
+ * Remember the score of an evaluated leaf for pruning later leaves.
+ */
+static void prune_track(double score, double est)
+{
+	/* Check for pruning disabled */
+	if (!prune_margin || inside_choose || checking_decline) return;
 
-	/* Check for fight started */
-	if (g->fight_started)
+	/* Check for new best leaf */
+	if (score > prune_score)
 	{
-		/* Return number of excess unknown bluff cards */
-		return g->fight_element ? unknown_e - bluff : unknown_f - bluff;
+		/* Save score and estimate */
+		prune_score = score;
+		prune_est = est;
 	}
-
-	/* Return number of excess unknown bluff cards in lesser element */
-	return unknown_e < unknown_f ? unknown_e - bluff : unknown_f - bluff;
 }
 
 /*
- * Add a list of legal support phase actions to the given list.
+ * Score a leaf at the end of the current player's turn.
  *
- * This includes loading ships and playing bluff cards.
+ * Scores are remembered for the rest of the turn.
  */
-static int legal_support(game *g, action *legal, int n)
+static double eval_leaf(game *g)
 {
-	player *p;
-	card *c, *d;
-	int i, j;
+	leaf_entry *l_ptr = NULL;
+	unsigned long long key = 0;
+	double score, est = 0;
 
-	/* Get player pointer */
-	p = &g->p[g->turn];
-
-	/* Check for no support actions allowed */
-	if (!support_allowed(g)) return n;
-
-	/* Look for played ships */
-	for (i = 1; i < DECK_SIZE; i++)
+	/* Check for endgame that can be searched exactly */
+	if (solve_turns && node_pos == node_len && endgame_known(g))
 	{
-		/* Get card pointer */
-		c = &p->deck[i];
-
-		/* Don't load ships when checking forced retreat */
-		if (checking_retreat) break;
+		/* Search following turns instead of evaluating */
+		return solve_leaf(g);
+	}
 
-		/* Skip inactive cards */
-		if (!c->active) continue;
+	/* Only use cache when no choices are waiting to be made */
+	if (node_pos == node_len)
+	{
+		/* Compute cache key */
+		key = leaf_key(g);
 
-		/* Skip non-ship cards */
-		if (!c->d_ptr->capacity) continue;
+		/* Get cache entry */
+		l_ptr = &leaf_cache[key % LEAF_CACHE_SIZE];
 
-		/* Loop over other cards */
-		for (j = p->last_played + 1; j < DECK_SIZE; j++)
+		/* Check for previous result */
+		if (l_ptr->age == cache_age && l_ptr->key == key)
 		{
-			/* Get card pointer */
-			d = &p->deck[j];
-
-			/* Skip ineligible cards */
-			if (!card_eligible(g, d->d_ptr)) continue;
-
-			/* Skip cards that aren't character/support/booster */
-			if (d->d_ptr->type != TYPE_CHARACTER &&
-			    d->d_ptr->type != TYPE_BOOSTER &&
-			    d->d_ptr->type != TYPE_SUPPORT) continue;
+			/* Count leaves answered by cache */
+			STAT_ADD(leaf_cached);
 
-			/* Check for legal loading */
-			if (load_allowed(g, c->d_ptr))
-			{
-				/* Add load action */
-				legal[n].act = ACT_LOAD;
-				legal[n].index = j;
-				legal[n].arg = d->d_ptr;
-				legal[n++].target = c->d_ptr;
-			}
+			/* Return saved score */
+			return l_ptr->score;
 		}
-
-		/* XXX Stop after first ship with space */
-		break;
 	}
 
-	/* Check for bluffs illegal */
-	if (!bluff_legal(g, g->turn)) return n;
-
-	/* Check for no more unknown bluff cards available */
-	if (check_auto_bluff(g, 1) < 1) return n;
-
-	/* Look for bluff cards */
-	for (i = p->last_played + 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+	/* Skip leaves that cannot matter */
+	if (prune_leaf(g, &score, &est)) return score;
 
-		/* Skip ineligible cards */
-		if (!card_eligible(g, c->d_ptr)) continue;
+	/* Check for inevitable retreat from opponent */
+	check_retreat(g);
 
-		/* Skip cards without bluff icons */
-		if (!(c->icons & ICON_BLUFF_MASK)) continue;
+	/* Get score */
+	score = eval_game(g, g->sim_turn);
 
-		/* Add bluff action */
-		legal[n].act = ACT_BLUFF;
-		legal[n].index = i;
-		legal[n++].arg = c->d_ptr;
+	/* Clear must retreat flag */
+	must_retreat = 0;
 
-		/* Any bluff is as good as another when checking retreat */
-		if (checking_retreat) break;
+	/* Check for entry to store result in */
+	if (l_ptr && !SEARCH_STOPPED())
+	{
+		/* Store result */
+		l_ptr->key = key;
+		l_ptr->age = cache_age;
+		l_ptr->score = score;
 	}
 
-	/* Return length of list */
-	return n;
+	/* Track best leaf */
+	prune_track(score, est);
+
+	/* Return score */
+	return score;
 }
 
 /*
- * Return a list of legal actions from the given game state.
+ * Find the best "action path" available from the given state.
  *
- * "ACT_NONE" means to take no action and advance the phase counter.
+ * We also return the score of the endstate that will result.
+ *
+ * We return -1 if no legal actions are available.
+ *
+ * This function is recursive.
  */
-static int legal_act(game *g, action *legal)
+static double find_action(game *g)
 {
-	player *p, *opp;
-	card *c;
-	int power;
-	int i, n = 0;
-	
+	search_frame *frame;
+	player *p;
+	int old_turn;
+	action act, next, best_act;
+	int more;
+	double score, est = 0, b_s = -1;
+
 	/* Get player pointer */
 	p = &g->p[g->turn];
 
-	/* Get opponent pointer */
-	opp = &g->p[!g->turn];
+	/* Get current player's turn */
+	old_turn = g->turn;
 
-	/* Switch on phase */
-	switch (p->phase)
+	/* Check for game over */
+	if (g->game_over)
 	{
-		/* Beginning of turn */
-		case PHASE_BEGIN:
-		{
-			/* Loop over cards */
-			for (i = p->last_played + 1; i < DECK_SIZE; i++)
-			{
-				/* Get card pointer */
-				c = &p->deck[i];
+		/* Clear any choice nodes that haven't been examined */
+		node_len = node_pos;
 
-				/* Skip inactive cards */
-				if (!c->active) continue;
+		/* Use exact result when solving endgames */
+		if (solving) return game_result(g, g->sim_turn);
 
-				/* Skip cards that aren't ships */
-				if (!c->d_ptr->capacity) continue;
+		/* Return end of game score */
+		return eval_game(g, g->sim_turn);
+	}
 
-				/* Skip cards that are already landed */
-				if (c->landed) continue;
+	/* Check for choice to make */
+	if (node_pos < node_len)
+	{
+		/* Handle choice node instead of normal */
+		return choose_action(g);
+	}
 
-				/* Add "land" action */
-				legal[n].act = ACT_LAND;
-				legal[n].index = i;
-				legal[n++].arg = c->d_ptr;
-			}
+	/* Avoid needlees work when checking for forced retreat */
+	if (checking_retreat && !must_retreat) return 0;
 
-			/* Loop over cards */
-			for (i = p->last_played + 1; i < DECK_SIZE; i++)
-			{
-				/* Get card pointer */
-				c = &p->deck[i];
+	/* Stop searching when asked */
+	if (SEARCH_STOPPED()) return -2;
 
-				/* Skip non-bluff cards */
-				if (!c->bluff) continue;
+	/* Stop once previous turn would not allow this one */
+	if (SOLVE_CUTOFF()) return -1;
 
-				/* Don't reveal when checking retreat */
-				if (!checking_retreat)
-				{
-					/* Add "reveal" action */
-					legal[n].act = ACT_REVEAL;
-					legal[n].index = i;
-					legal[n++].arg = c->d_ptr;
-				}
-			}
+	/* Count nodes expanded in this phase */
+	STAT_ADD(nodes[p->phase]);
 
-			/* Check for active cards that can be retrieved */
-			for (i = p->last_played + 1; i < DECK_SIZE; i++)
-			{
-				/* Get card pointer */
-				c = &p->deck[i];
+	/* Report progress */
+	if (progress) (*progress)++;
 
-				/* Skip unretrieveable */
-				if (!retrieve_legal(g, c)) continue;
+	/* Track deepest path */
+	STAT_DEPTH(best_path_pos);
 
-				/* Add retrieve action */
-				legal[n].act = ACT_RETRIEVE;
-				legal[n].index = i;
-				legal[n++].arg = c->d_ptr;
-			}
+	/* Check for path too long to store */
+	if (best_path_pos >= MAX_ACTION - 1) return eval_game(g, g->sim_turn);
 
-			/* No action is always allowed */
-			legal[n++].act = ACT_NONE;
+	/* Get frame for this level of search */
+	frame = push_frame();
 
-			/* Done */
-			return n;
-		}
+	/* Stop searching deeper if no frames are left */
+	if (!frame) return eval_game(g, g->sim_turn);
 
-		/* Play a card */
-		case PHASE_LEADER:
-		case PHASE_CHAR:
-		case PHASE_SUPPORT:
-		{
-			if (check_auto_bluff(g, 1) < 0) return 0;
+	/* Start generating legal actions */
+	start_legal(&frame->u.gen, g);
 
-			/* Loop over active cards */
-			for (i = 1; i < DECK_SIZE; i++)
-			{
-				/* Get card pointer */
-				c = &p->deck[i];
+	/* Check for no legal actions */
+	if (!next_legal(&frame->u.gen, &act))
+	{
+		/* Release frame */
+		pop_frame();
 
-				/* Skip inactive cards */
-				if (!c->active) continue;
+		/* No actions */
+		return -1;
+	}
 
-				/* Skip cards with no special effect */
-				if (!c->d_ptr->special_cat) continue;
+	/* Look for a second action */
+	more = next_legal(&frame->u.gen, &next);
 
-				/* Skip cards with ignored text */
-				if (c->text_ignored) continue;
+	/* Check for only one possible action */
+	if (!more)
+	{
+		/* Frame is not needed to follow only action */
+		pop_frame();
 
-				/* Skip cards already used */
-				if (c->used) continue;
+		/* Increase path position for future searching */
+		best_path_pos++;
 
-				/* Skip cards that can't be used anytime */
-				if (c->d_ptr->special_time != TIME_MYTURN)
-					continue;
+#ifdef DEBUG
+		/* Remember current path */
+		cur_path[best_path_pos] = act;
+#endif
 
-				/* Skip cards with no useful effect */
-				if (!special_possible(g, c->d_ptr)) continue;
+		/* Perform that action */
+		perform_act(g, act);
 
-				/* Add action to use card power */
-				legal[n].act = ACT_USE;
-				legal[n++].arg = c->d_ptr;
+		/* Check for turn change */
+		if (g->turn != old_turn)
+		{
+			/* Are we checking opponent's response */
+			if (checking_retreat)
+			{
+				/* Score is unimportant */
+				score = 0.0;
+
+				/* We must not be forced to retreat */
+				must_retreat = 0;
+			}
+			else
+			{
+				/* Score leaf */
+				score = eval_leaf(g);
 			}
+		}
 
-			/* Always use special text first if possible */
-			if (n) return n;
+		/* Continue searching */
+		else score = find_action(g);
 
-			/* Look for cards to play */
-			for (i = p->last_played + 1; i < DECK_SIZE; i++)
-			{
-				/* Get card pointer */
-				c = &p->deck[i];
+		/* Return to current path position */
+		best_path_pos--;
 
-				/* Skip randomly chosen cards */
-				if (c->random_fake) continue;
+		/* Check for better actions than previously discovered */
+		if (!checking_retreat && score >= best_path_score)
+		{
+			/* Store action in best path */
+			best_path[best_path_pos] = act;
 
-				/* Skip ineligible cards */
-				if (!card_eligible(g, c->d_ptr)) continue;
+			/* Save best score seen */
+			best_path_score = score;
+		}
 
-				/* Check for illegal leadership card */
-				if (c->d_ptr->type == TYPE_LEADERSHIP &&
-				    p->phase != PHASE_LEADER) continue;
+		/* Return score */
+		return score;
+	}
 
-				/* Check for illegal character card */
-				if (c->d_ptr->type == TYPE_CHARACTER &&
-				    p->phase != PHASE_CHAR) continue;
+	/* Increase path position for future searching */
+	best_path_pos++;
 
-				/* Check for illegal booster card */
-				if (c->d_ptr->type == TYPE_BOOSTER &&
-				    p->phase != PHASE_SUPPORT) continue;
+	/* Loop over available actions */
+	while (1)
+	{
+#ifdef DEBUG
+		/* Remember current path */
+		cur_path[best_path_pos] = act;
+#endif
 
-				/* Check for illegal support card */
-				if (c->d_ptr->type == TYPE_SUPPORT &&
-				    p->phase != PHASE_SUPPORT) continue;
+		/* Avoid unnecessary work when checking for forced retreat */
+		if (checking_retreat && !must_retreat) break;
 
-				/* Check card legality */
-				if (!card_allowed(g, c->d_ptr)) continue;
+		/* Stop searching when asked */
+		if (SEARCH_STOPPED()) break;
 
-				/* Check for optional special effect */
-				if (((c->d_ptr->special_cat == 4 &&
-				      c->d_ptr->special_effect & S4_OPTIONAL) ||
-				     (c->d_ptr->special_cat == 8 &&
-				      c->d_ptr->special_effect & S8_OPTIONAL))&&
-				    !checking_retreat)
-				{
-					/* Playing card without effect */
-					legal[n].act = ACT_PLAY_NO;
-					legal[n].index = i;
-					legal[n++].arg = c->d_ptr;
-				}
+		/* Stop once previous turn would not allow this one */
+		if (SOLVE_CUTOFF()) break;
 
-				/* Playing card is allowed */
-				legal[n].act = ACT_PLAY;
-				legal[n].index = i;
-				legal[n++].arg = c->d_ptr;
+		/* Copy game */
+		simulate_game(&frame->sim, g);
 
-				/* XXX Always play characters on ship */
-				if (p->phase == PHASE_CHAR && c->ship) return n;
-			}
+		/* Perform action */
+		perform_act(&frame->sim, act);
 
-			/* Check for support phase */
-			if (p->phase == PHASE_SUPPORT)
+		/* Check for retreat */
+		if (act.act == ACT_RETREAT && node_pos == node_len)
+		{
+			/* Are we checking for forced retreat */
+			if (checking_retreat)
 			{
-				/* Add support actions */
-				n = legal_support(g, legal, n);
+				/* Score is unimportant */
+				score = 0;
 			}
-
-			/* Check every action when checking retreat */
-			if (checking_retreat && n > 0) break;
-
-			/* Advance phase allowed unless character is unplayed */
-			if (p->phase != PHASE_CHAR || p->char_played)
+			else if (solve_turns && endgame_known(&frame->sim))
 			{
-				/* Add no action */
-				legal[n++].act = ACT_NONE;
+				/* Keep searching the rest of the turn exactly */
+				score = find_action(&frame->sim);
 			}
+			else if (!prune_leaf(&frame->sim, &score, &est))
+			{
+				/* Get score */
+				score = eval_game(&frame->sim, frame->sim.sim_turn);
 
-			/* Done, add special actions */
-			break;
+				/* Track best leaf */
+				prune_track(score, est);
+			}
 		}
 
-		/* Retreat phase */
-		case PHASE_RETREAT:
+		/* Normal action */
+		else
 		{
-			/* Retreat is always allowed */
-			legal[n++].act = ACT_RETREAT;
-
-			/* Not retreating is allowed as well */
-			legal[n++].act = ACT_NONE;
+			/* Continue searching */
+			score = find_action(&frame->sim);
+		}
 
-			/* Done */
-			return n;
+		/* Check for better score among actions */
+		if (score >= b_s)
+		{
+			/* Remember best */
+			b_s = score;
+			best_act = act;
 		}
 
-		/* Announce power */
-		case PHASE_ANNOUNCE:
+		/* Check for action already generated */
+		if (more)
 		{
-			/* Check for no fight */
-			if (!g->fight_started)
-			{
-				/* Both elements are allowed */
-				legal[n++].act = ACT_ANN_FIRE;
-				legal[n++].act = ACT_ANN_EARTH;
-			}
-			else
-			{
-				/* Get opponent's power */
-				power = compute_power(g, !g->turn);
+			/* Advance to that action */
+			act = next;
+			more = 0;
+		}
 
-				/* Loop over our combat cards */
-				for (i = 1; i < DECK_SIZE; i++)
-				{
-					/* Get card pointer */
-					c = &p->deck[i];
+		/* Generate next action only once it is needed */
+		else if (!next_legal(&frame->u.gen, &act)) break;
+	}
 
-					/* Skip non-combat cards */
-					if (c->where != LOC_COMBAT) continue;
+	/* Release frame */
+	pop_frame();
 
-					/* Skip inactive cards */
-					if (!c->active) continue;
+	/* Return to current path position */
+	best_path_pos--;
 
-					/* Look for shield in fight element */
-					if (c->icons & (1 << g->fight_element))
-					{
-						/* Opponent has no power */
-						power = 0;
-					}
-				}
+	/* Check for better actions than previously discovered */
+	if (!checking_retreat && b_s >= best_path_score)
+	{
+		/* Store action in best path */
+		best_path[best_path_pos] = best_act;
 
-				/* Check for enough power */
-				if (power <= compute_power(g, g->turn))
-				{
-					/* We can announce power */
-					legal[n++].act = ACT_ANN_FIRE +
-					                 g->fight_element;
-				}
-			}
+		/* Save best score seen */
+		best_path_score = b_s;
+	}
 
-			/* Done */
-			return n;
-		}
+	/* Return best score */
+	return b_s;
+}
 
-		/* Ensure opponent cards are satisfied */
-		case PHASE_AFTER_SB:
-		{
-			/* Check for automatic bluff call */
-			if (check_auto_bluff(g, 0) < 0) return n;
+/*
+ * Have the AI player take an action.
+ */
+static void ai_take_action(game *g)
+{
+	game sim;
+	player *p;
+	action current;
+	ponder_entry *e_ptr;
+	int old_turn;
+#ifdef STATS
+	struct timeval start;
+#endif
 
-			/* Check for legal end of support phase */
-			if (check_end_support(g))
-			{
-				/* Add advance phase action */
-				legal[n++].act = ACT_NONE;
-			}
+	/* Stop thinking ahead */
+	ai_ponder_stop();
+
+	/* Get player pointer */
+	p = &g->p[g->turn];
+
+	/* Save current turn */
+	old_turn = g->turn;
+
+	/* Clear best path */
+	best_path_pos = 0;
+	best_path_score = -1;
 
-			/* Done */
-			return n;
-		}
+	/* Check for beginning of turn */
+	if (p->phase == PHASE_START)
+	{
+		/* Train networks with past inputs */
+		perform_training(g, g->turn, NULL);
+		perform_training(g, !g->turn, NULL);
+	}
 
-		/* Phases where we can do nothing */
-		case PHASE_START:
-		case PHASE_REFRESH:
-		case PHASE_END:
-		case PHASE_OVER:
-		{
-			/* Only legal action is to do nothing */
-			legal[n++].act = ACT_NONE;
+	/* Clear random event flag */
+	g->random_event = 0;
 
-			/* Done */
-			return n;
-		}
+	/* Check for error in handling choice nodes */
+	if (node_len > 0 || node_pos > 0)
+	{
+		printf("Choice nodes around\n");
 	}
 
-	/* Do not allow further actions if none are available so far */
-	if (!n) return n;
+#ifdef STATS
+	/* Start counting */
+	start_stats(&start);
+#endif
 
-	/* No need to satisfy "discard or..." cards in character phase */
-	if (p->phase == PHASE_CHAR) return n;
+	/* Look for path found while opponent was thinking */
+	e_ptr = ponder_lookup(PONDER_TURN, view_key(g, g->turn));
 
-	/* Check for active opponent "discard or..." cards */
-	for (i = 1; i < DECK_SIZE; i++)
+	/* Check for pondered path */
+	if (e_ptr)
 	{
-		/* Get card pointer */
-		c = &opp->deck[i];
+		/* Use pondered path */
+		memcpy(best_path, e_ptr->path, sizeof(action) * MAX_ACTION);
+	}
+	else
+	{
+		/* Simulate game */
+		simulate_game(&sim, g);
 
-		/* Skip non-active cards */
-		if (!c->active) continue;
+		/* Use pruning margin for this search */
+		prune_margin = ai_prune;
 
-		/* Skip cards with text ignored */
-		if (c->text_ignored) continue;
+		/* Search endgames exactly if asked */
+		solving = ai_endgame > 0;
+		solve_turns = ai_endgame;
 
-		/* Skip non-category 7 cards */
-		if (c->d_ptr->special_cat != 7) continue;
+		/* No leaf evaluated yet */
+		prune_score = -1;
 
-		/* Skip non-discard cards */
-		if (!(c->d_ptr->special_effect & S7_DISCARD_MASK)) continue;
+#ifdef DEBUG
+		printf("START\n");
+#endif
 
-		/* Skip satisfied cards */
-		if (c->used) continue;
+		/* Find best action path */
+		find_action(&sim);
 
-		/* Check for satisfaction impossible */
-		if (!satisfy_possible(g, c->d_ptr)) continue;
+		/* Stop pruning */
+		prune_margin = 0;
 
-		/* Add action to satisfy card */
-		legal[n].act = ACT_SATISFY;
-		legal[n++].arg = c->d_ptr;
+		/* Stop solving */
+		solving = 0;
+		solve_turns = 0;
 
-		/* Stop looking for further cards to satisfy */
-		return n;
+#ifdef DEBUG
+		printf("END\n");
+#endif
 	}
 
-	/* Return number of legal actions */
-	return n;
-}
-
-/*
- * Perform the given action.
- */
-static void perform_act(game *g, action a)
-{
-	player *p, *opp;
-	int old_phase;
-
-	/* Get player pointers */
-	p = &g->p[g->turn];
-	opp = &g->p[!g->turn];
+#ifdef STATS
+	/* Report statistics */
+	report_stats(e_ptr ? "take_action_pondered" : "take_action", &start);
+#endif
 
-	/* Remember current phase */
-	old_phase = p->phase;
+	/* Start at beginning of path */
+	best_path_pos = 0;
 
-	/* Switch on action */
-	switch (a.act)
+	/* Loop until end */
+	while (1)
 	{
-		/* No action, advance phase counter */
-		case ACT_NONE:
-		{
-			/* Advance phase counter */
-			p->phase++;
+		/* Get current action */
+		current = best_path[best_path_pos];
 
-			/* Take care of bookkeeping */
-			switch (old_phase)
-			{
-				/* Start of turn */
-				case PHASE_START:
+		/* Check for error */
+		if (current.act == ACT_CHOOSE)
+		{
+			printf("Trying to perform choose action!\n");
+			break;
+		}
 
-					/* Start turn */
-					start_turn(g);
+		/* Advance to next */
+		best_path_pos++;
 
-					/* Done */
-					break;
+		/* Perform current action */
+		perform_act(g, current);
 
-				/* After support/booster */
-				case PHASE_AFTER_SB:
+		/* Check for random event */
+		if (g->random_event) break;
 
-					/* End support phase */
-					end_support(g);
-					
-					/* Done */
-					break;
+		/* Check for retreat */
+		if (current.act == ACT_RETREAT) break;
 
-				/* Refresh hand */
-				case PHASE_REFRESH:
+		/* Check for turn change */
+		if (g->turn != old_turn) break;
 
-					/* Refresh */
-					refresh_phase(g);
+		/* Check for game over */
+		if (g->game_over) break;
+	}
+}
 
-					/* Done */
-					break;
+/*
+ * Return a string containing the AI's assumption about the best possible
+ * move.
+ */
+void ai_assist(game *g, char *buf)
+{
+	game sim;
+	action current;
+	char tmp[1024];
 
-				/* End of turn */
-				case PHASE_END:
+	/* Clear best path */
+	best_path_pos = 0;
+	best_path_score = -1;
 
-					/* End current turn */
-					end_turn(g);
+	/* Simulate game */
+	simulate_game(&sim, g);
 
-					/* Done */
-					break;
+	/* Find best action path */
+	find_action(&sim);
 
-				/* Move to next player */
-				case PHASE_OVER:
+	/* Check for no legal moves */
+	if (best_path_score == -1)
+	{
+		/* Add message */
+		strcpy(buf, "No legal moves!\n");
+		return;
+	}
 
-					/* Player is done */
-					p->phase = PHASE_NONE;
+	/* Start back at beginning */
+	simulate_game(&sim, g);
 
-					/* Next player */
-					g->turn = !g->turn;
+	/* Clear buffer */
+	strcpy(buf, "");
 
-					/* Start opponent's turn */
-					opp->phase = PHASE_START;
+	/* Use buffer for assist messages */
+	assist_str = buf;
 
-					/* Done (completely) */
-					return;
-			}
+	/* Start at beginning of path */
+	best_path_pos = 0;
 
-			/* Clear last played card */
-			p->last_played = 0;
+	/* Loop until done */
+	while (sim.p[g->turn].phase <= PHASE_ANNOUNCE)
+	{
+		/* Get current action */
+		current = best_path[best_path_pos];
 
-			/* Done */
-			break;
-		}
+		/* Advance position */
+		best_path_pos++;
 
-		/* Retreat */
-		case ACT_RETREAT:
+		/* Check current action */
+		switch (current.act)
 		{
-			/* Retreat */
-			retreat(g);
-
-			/* Done */
-			break;
-		}
+			/* None */
+			case ACT_NONE:
 
-		/* Retrieve a card */
-		case ACT_RETRIEVE:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+				/* No message */
+				strcpy(tmp, "");
+				break;
 
-			/* Retrieve card */
-			retrieve_card(g, a.arg);
+			/* Retreat */
+			case ACT_RETREAT:
 
-			/* Done */
-			break;
-		}
+				/* Add message */
+				sprintf(tmp, "Retreat\n");
+				break;
 
-		/* Play a card */
-		case ACT_PLAY:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+			/* Retrieve */
+			case ACT_RETRIEVE:
 
-			/* Play card */
-			play_card(g, a.arg, 0, 0);
+				/* Add message */
+				sprintf(tmp, "Retrieve %s\n",
+				             current.arg->name);
+				break;
 
-			/* Done */
-			break;
-		}
+			/* Play */
+			case ACT_PLAY:
 
-		/* Play a card without special effect */
-		case ACT_PLAY_NO:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+				/* Add message */
+				sprintf(tmp, "Play %s\n",
+				              current.arg->name);
+				break;
 
-			/* Play card */
-			play_card(g, a.arg, 1, 0);
+			/* Play with no effect */
+			case ACT_PLAY_NO:
 
-			/* Done */
-			break;
-		}
+				/* Add message */
+				sprintf(tmp, "Play %s with no effect\n",
+				              current.arg->name);
+				break;
 
-		/* Announce power */
-		case ACT_ANN_FIRE:
-		case ACT_ANN_EARTH:
-		{
-			/* Increment phase counter */
-			p->phase++;
+			/* Announce fire */
+			case ACT_ANN_FIRE:
 
-			/* Announce power */
-			announce_power(g, a.act - ACT_ANN_FIRE);
+				/* Add message */
+				sprintf(tmp, "Announce fire\n");
+				break;
 
-			/* Done */
-			break;
-		}
+			/* Announce earth */
+			case ACT_ANN_EARTH:
 
-		/* Use card special power */
-		case ACT_USE:
-		{
-			/* Use card */
-			use_special(g, a.arg);
+				/* Add message */
+				sprintf(tmp, "Announce earth\n");
+				break;
 
-			/* Done */
-			break;
-		}
+			/* Use special */
+			case ACT_USE:
 
-		/* Satisfy opponent's "discard" card */
-		case ACT_SATISFY:
-		{
-			/* Satisfy requirement */
-			satisfy_discard(g, a.arg);
+				/* Add message */
+				sprintf(tmp, "Use %s special text\n",
+				              current.arg->name);
+				break;
 
-			/* Done */
-			break;
-		}
+			/* Satisfy */
+			case ACT_SATISFY:
 
-		/* Land a ship */
-		case ACT_LAND:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+				/* Add message */
+				sprintf(tmp, "Satisfy %s\n",
+				              current.arg->name);
+				break;
 
 			/* Land ship */
-			land_ship(g, a.arg);
+			case ACT_LAND:
 
-			/* Done */
-			break;
-		}
+				/* Add message */
+				sprintf(tmp, "Land %s\n",
+				              current.arg->name);
+				break;
 
-		/* Load a card onto a ship */
-		case ACT_LOAD:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+			/* Load ship */
+			case ACT_LOAD:
 
-			/* Load card */
-			load_card(g, a.arg, a.target);
+				/* Add message */
+				sprintf(tmp, "Load %s onto %s\n",
+				              current.arg->name,
+				              current.target->name);
+				break;
 
-			/* Done */
-			break;
-		}
+			/* Play bluff */
+			case ACT_BLUFF:
 
-		/* Play a bluff card */
-		case ACT_BLUFF:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+				/* Add message */
+				sprintf(tmp, "Bluff %s\n",
+				              current.arg->name);
+				break;
 
-			/* Play bluff */
-			play_bluff(g, a.arg);
+			/* Reveal bluff */
+			case ACT_REVEAL:
 
-			/* Done */
-			break;
+				/* Add message */
+				sprintf(tmp, "Reveal %s\n",
+				              current.arg->name);
+				break;
 		}
 
-		/* Reveal a bluff card */
-		case ACT_REVEAL:
-		{
-			/* Set last played */
-			p->last_played = a.index;
+		/* Add message to buffer */
+		strcat(buf, tmp);
 
-			/* Reveal bluff */
-			reveal_bluff(g, g->turn, a.arg);
+		/* Perform action */
+		perform_act(&sim, current);
 
-			/* Done */
-			break;
-		}
+		/* Check for retreat */
+		if (current.act == ACT_RETREAT) break;
+
+		/* Check for game over */
+		if (sim.game_over) break;
 	}
-}
 
-/* Foward declaration */
-static double find_action(game *g);
+	/* Clear assist string */
+	assist_str = NULL;
+}
 
 /*
- * Check if current player must retreat.
- *
- * We run this check from the point of view of the opponent.
- *
- * If current player must retreat, simulate the results.
+ * Add message to assist string from chooser.
  */
-static void check_retreat(game *g)
+static void choose_assist(design *chosen[DECK_SIZE], int num_chosen)
 {
-	game sim;
-	player *p, *opp;
-	card *c;
+	char tmp[1024];
 	int i;
-	int all_known = 1, moved = 0, bluff = 0;
-
-	/* Do nothing if no fight to retreat from */
-	if (!g->fight_started) return;
 
-	/* Get opponent pointer */
-	opp = &g->p[!g->turn];
+	/* Start message */
+	if (num_chosen)
+	{
+		/* Format message */
+		sprintf(tmp, "Choose %d: ", num_chosen);
+	}
+	else
+	{
+		/* Add message */
+		strcat(assist_str, "Choose none\n");
+		return;
+	}
 
-	/* Loop over opponent cards */
-	for (i = 1; i < DECK_SIZE; i++)
+	/* Loop over chosen */
+	for (i = 0; i < num_chosen; i++)
 	{
-		/* Get card pointer */
-		c = &opp->deck[i];
+		/* Add choice */
+		strcat(tmp, chosen[i]->name);
 
-		/* Skip inactive cards */
-		if (!c->active) continue;
+		/* Add spaces */
+		if (i + 1 < num_chosen) strcat(tmp, ", ");
+	}
 
-		/* Check for bluff card */
-		if (c->bluff) bluff = 1;
+	/* Add newline */
+	strcat(tmp, "\n");
 
-		/* Skip cards with text ignored */
-		if (c->text_ignored) continue;
+	/* Add to string */
+	strcat(assist_str, tmp);
+}
 
-		/* Skip cards without category 3 special text */
-		if (c->d_ptr->special_cat != 3) continue;
+/*
+ * Flag to stop searching for legal combinations.
+ *
+ * Sometimes when checking for opponent forced retreat, we don't care to
+ * search for the best combination, just one that works.
+ */
+static THREAD_LOCAL int stop_choose;
 
-		/* Skip cards that don't disallow calling bluff */
-		if (c->d_ptr->special_effect !=(S3_YOU_MAY_NOT | S3_CALL_BLUFF))
-			continue;
 
-		/* Assume no bluff cards are in play */
-		bluff = 0;
-		break;
-	}
+/*
+ * Add a legal combination to the choice node being created.
+ *
+ * Return -1 if there is no room for more combinations.
+ */
+static int add_legal(node *n_ptr, int chosen)
+{
+	int *new_legal;
+	int new_max;
 
-	/* Do not check for forced retreat if bluff may be called */
-	if (bluff) return;
+	/* Check for full storage */
+	if (n_ptr->num_legal == n_ptr->max_legal)
+	{
+		/* Check for too many combinations */
+		if (n_ptr->max_legal >= MAX_LEGAL) return -1;
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+		/* Double storage (starting with a reasonable amount) */
+		new_max = n_ptr->max_legal ? n_ptr->max_legal * 2 : 64;
 
-	/* Get player pointer */
-	p = &sim.p[sim.turn];
+		/* Do not exceed maximum */
+		if (new_max > MAX_LEGAL) new_max = MAX_LEGAL;
 
-	/* Loop over cards */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &p->deck[i];
+		/* Grow storage */
+		new_legal = (int *)realloc(n_ptr->legal, sizeof(int) * new_max);
 
-		/* Skip cards not in hand */
-		if (c->where != LOC_HAND) continue;
+		/* Check for failure */
+		if (!new_legal)
+		{
+			/* Error */
+			printf("Could not allocate legal combinations!\n");
+			return -1;
+		}
 
-		/* Check for unknown card */
-		if (!c->loc_known) all_known = 0;
+		/* Use new storage */
+		n_ptr->legal = new_legal;
+		n_ptr->max_legal = new_max;
 	}
 
-	/* Check for not all cards in hand known */
-	if (!all_known)
-	{
-		/* Pretend all unknown cards are in hand */
-		for (i = 1; i < DECK_SIZE; i++)
-		{
-			/* Get card pointer */
-			c = &p->deck[i];
+	/* Add combination */
+	n_ptr->legal[n_ptr->num_legal++] = chosen;
 
-			/* Skip cards with known locations */
-			if (c->loc_known && !c->random_fake) continue;
+	/* Success */
+	return 0;
+}
 
-			/* Clear "random" flag */
-			c->random_fake = 0;
+/*
+ * Try one combination of cards.
+ *
+ * Return -1 if the combination is legal but there is no room to store it.
+ */
+static int ai_choose_combo(game *g, int chooser, int who, design **choices,
+                            int chosen, int *best, double *b_s,
+                            choose_result callback, void *data)
+{
+	search_frame *frame;
+	design *list[DECK_SIZE];
+	int i, num_chosen = 0;
+	int callback_value, full = 0;
+	double score;
 
-			/* Move card to hand */
-			c->where = LOC_HAND;
+	/* Count combinations */
+	STAT_ADD(combos);
 
-			/* Count cards moved */
-			moved++;
+	/* Loop over chosen cards */
+	for (i = 0; (1 << i) <= chosen; i++)
+	{
+		/* Check for bit set */
+		if (chosen & (1 << i))
+		{
+			/* Add card to list */
+			list[num_chosen++] = choices[i];
 		}
 	}
 
-	/* XXX Do nothing if most cards moved */
-	if (moved > 15) return;
+	/* Get frame for result */
+	frame = push_frame();
 
-	/* Set retreat flag */
-	must_retreat = 1;
-	checking_retreat = 1;
+	/* Check for no frames left */
+	if (!frame)
+	{
+		/* Error */
+		printf("No search frame left for choice!\n");
+		return 0;
+	}
 
-	/* Simulate possible actions */
-	find_action(&sim);
+	/* Copy game */
+	simulate_game(&frame->sim, g);
 
-	/* Check for retreat flag still set */
-	if (must_retreat)
+	/* Apply result */
+	callback_value = callback(&frame->sim, who, list, num_chosen, data);
+
+	/* Check for illegal combination */
+	if (!callback_value)
 	{
-		/* Force current player to retreat before evaluating score */
-		retreat(g);
+		/* Release frame */
+		pop_frame();
+
+		/* Combination was illegal */
+		return 0;
 	}
 
-	/* Clear retreat check flag */
-	checking_retreat = 0;
+	/* Check for ability to stop looking if desired */
+	if (callback_value > 1 && checking_retreat) stop_choose = 1;
+
+	/* Check for chooser's turn */
+	if (chooser == g->turn)
+	{
+		/* Add combination */
+		full = add_legal(&nodes[node_len], chosen);
+	}
+	else
+	{
+		/* Evaluate result */
+		score = eval_game(&frame->sim, chooser);
+
+		/* Check for better score */
+		if (score >= *b_s)
+		{
+			/* Save better */
+			*b_s = score;
+			*best = chosen;
+		}
+	}
+
+	/* Release frame */
+	pop_frame();
+
+	/* Return whether storage is full */
+	return full;
 }
 
 /*
- * Simulate the results of declining a fight.
+ * Add a combination to the batch waiting to be evaluated.
  *
- * Here we assume that the opponent will start a fight.  We check both
- * elements, and assume the worst will be chosen.
+ * Return -1 if there is no room for more combinations.
  */
-static double check_decline(game *g, int who)
+static int add_batch(choice_batch *b, int chosen)
 {
-	game sim;
-	player *opp = &g->p[who];
-	double score, b_s;
+	int *new_combo;
+	double *new_score;
+	unsigned char *new_input;
+	int new_max;
 
-	/* Get score of current situation */
-	b_s = eval_game(g, who);
+	/* Check for full storage */
+	if (b->num_combo == b->max_combo)
+	{
+		/* Check for too many combinations */
+		if (b->max_combo >= MAX_LEGAL) return -1;
 
-	/* Check for no response possible from opponent */
-	if (opp->stack[LOC_HAND] == 0) return b_s;
+		/* Double storage (starting with a reasonable amount) */
+		new_max = b->max_combo ? b->max_combo * 2 : 64;
 
-	/* Set checking flag */
-	checking_decline = 1;
+		/* Do not exceed maximum */
+		if (new_max > MAX_LEGAL) new_max = MAX_LEGAL;
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+		/* Grow storage of combinations */
+		new_combo = (int *)realloc(b->combo, sizeof(int) * new_max);
 
-	/* Simulate fight started in fire */
-	sim.fight_started = 1;
-	sim.fight_element = 0;
-	sim.turn = who;
+		/* Check for failure */
+		if (!new_combo)
+		{
+			/* Error */
+			printf("Could not allocate combinations!\n");
+			return -1;
+		}
 
-	/* Get score */
-	score = eval_game(&sim, who);
+		/* Use new storage (old is freed or grown) */
+		b->combo = new_combo;
 
-	/* Check for worse */
-	if (score < b_s) b_s = score;
+		/* Grow storage of scores */
+		new_score = (double *)realloc(b->score, sizeof(double) * new_max);
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+		/* Check for failure */
+		if (!new_score)
+		{
+			/* Error */
+			printf("Could not allocate combinations!\n");
+			return -1;
+		}
 
-	/* Simulate fight started in earth */
-	sim.fight_started = 1;
-	sim.fight_element = 1;
-	sim.turn = who;
+		/* Use new storage */
+		b->score = new_score;
 
-	/* Get score */
-	score = eval_game(&sim, who);
+		/* Grow storage of network inputs */
+		new_input = (unsigned char *)realloc(b->input,
+		                                     NET_INPUT * new_max);
 
-	/* Check for worse */
-	if (score < b_s) b_s = score;
+		/* Check for failure */
+		if (!new_input)
+		{
+			/* Error */
+			printf("Could not allocate combinations!\n");
+			return -1;
+		}
 
-	/* Clear checking flag */
-	checking_decline = 0;
+		/* Use new storage */
+		b->input = new_input;
+		b->max_combo = new_max;
+	}
 
-	/* Return worst case */
-	return b_s;
+	/* Add combination */
+	b->combo[b->num_combo++] = chosen;
+
+	/* Success */
+	return 0;
 }
 
+#ifdef HAVE_PTHREAD_H
 /*
- * Handle a choice to be made.
+ * Prepare every combination in a batch assigned to one thread.
+ *
+ * Each combination is applied to its own copy of the game, and the
+ * network inputs of the result are saved (in the thread's own network)
+ * to be scored later.
  */
-static double choose_action(game *g)
+static void *batch_worker(void *arg)
 {
 	game sim;
-	design *list[DECK_SIZE], **choices;
-	node *n_ptr;
-	void *data;
-	double score, b_s = -1;
-	int old_turn;
-	int best_combo = 0;
-	int i, j, num_chosen;
-
-	/* Get current player's turn */
-	old_turn = g->turn;
+	design *list[DECK_SIZE];
+	net *l;
+	unsigned char *input;
+	int id = (int)(long)arg;
+	int i, j, chosen, num_chosen;
 
-	/* Get pointer to choice node */
-	n_ptr = &nodes[node_pos];
+	/* Get this thread's network (used only to hold inputs) */
+	l = &evaluator[id];
 
-	/* Track current choice node */
-	node_pos++;
-	best_path_pos++;
+	/* Prevent nested choices, as in the thread that made this batch */
+	inside_choose = 1;
 
-	/* Loop over choices */
-	for (i = 0; i < n_ptr->num_legal; i++)
+	/* Loop over combinations for this thread */
+	for (i = id; i < batch.num_combo; i += num_helpers + 1)
 	{
-		/* Avoid unnecessary work when checking for forced retreat */
-		if (checking_retreat && !must_retreat) break;
+		/* Get combination */
+		chosen = batch.combo[i];
 
 		/* Clear number chosen */
 		num_chosen = 0;
 
-		/* Get choice list */
-		choices = n_ptr->choices;
-
-		/* Get callback data */
-		data = n_ptr->data;
-
-		/* Loop over combination */
-		for (j = 0; (1 << j) <= n_ptr->legal[i]; j++)
+		/* Loop over chosen cards */
+		for (j = 0; (1 << j) <= chosen; j++)
 		{
 			/* Check for bit set */
-			if (n_ptr->legal[i] & (1 << j))
+			if (chosen & (1 << j))
 			{
-				/* Add choice to list */
-				list[num_chosen++] = choices[j];
+				/* Add card to list */
+				list[num_chosen++] = batch.choices[j];
 			}
 		}
 
-#ifdef DEBUG
-		/* Remember current path */
-		cur_path[best_path_pos].act = ACT_CHOOSE;
-		cur_path[best_path_pos].chosen = n_ptr->legal[i];
-#endif
+		/* Count combinations */
+		STAT_ADD(combos);
 
-		/* Simulate game */
-		simulate_game(&sim, g);
+		/* Copy game */
+		simulate_game(&sim, batch.g);
 
-		/* Make choice */
-		if (!n_ptr->callback(&sim, n_ptr->who, list, num_chosen, data))
+		/* Apply result */
+		if (!batch.callback(&sim, batch.who, list, num_chosen,
+		                    batch.data))
 		{
-			printf("Callback failed!\n");
+			/* Combination was illegal */
+			batch.score[i] = -10;
+			continue;
 		}
 
-		/* Check for turn change */
-		if (sim.turn != old_turn)
-		{
-			/* Are we checking forced retreat */
-			if (checking_retreat)
-			{
-				/* Score is unimportant */
-				score = 0;
-			}
-			else
-			{
-				/* Assume worst-case response from opponent */
-				score = check_decline(&sim, sim.sim_turn);
-			}
-		}
-		else
-		{
-			/* Continue searching */
-			score = find_action(&sim);
-		}
+		/* Combination is legal */
+		batch.score[i] = 0;
 
-		/* Check for better score among actions */
-		if (score >= b_s)
-		{
-			/* Remember best */
-			b_s = score;
-			best_combo = n_ptr->legal[i];
-		}
+		/* Set inputs */
+		set_inputs(&sim, batch.chooser, l);
+
+		/* Get space for this combination's inputs */
+		input = batch.input + (long)i * NET_INPUT;
+
+		/* Save inputs */
+		for (j = 0; j < NET_INPUT; j++) input[j] = l->input_value[j];
 	}
 
-	/* Remove node from list */
-	node_pos--;
-	node_len--;
+#ifdef STATS
+	/* Save helper thread's statistics */
+	if (id) thread_stats[id] = stats;
+#endif
 
-	/* Return to current path position */
-	best_path_pos--;
+	/* Done */
+	return NULL;
+}
 
-	/* Check for better actions than previously discovered */
-	if (!checking_retreat && b_s >= best_path_score)
+/*
+ * Help prepare each batch handed out by run_batch().
+ */
+static void *batch_helper(void *arg)
+{
+	int round = 0;
+
+	/* Loop forever */
+	while (1)
 	{
-		/* Store action in best path */
-		best_path[best_path_pos].act = ACT_CHOOSE;
-		best_path[best_path_pos].chosen = best_combo;
+		/* Acquire lock */
+		pthread_mutex_lock(&batch_lock);
 
-		/* Save best score seen */
-		best_path_score = b_s;
+		/* Wait for next batch */
+		while (batch_round == round) pthread_cond_wait(&batch_ready,
+		                                               &batch_lock);
+
+		/* Remember batch */
+		round = batch_round;
+
+		/* Release lock */
+		pthread_mutex_unlock(&batch_lock);
+
+#ifdef STATS
+		/* Count only this batch's work */
+		memset(&stats, 0, sizeof(search_stats));
+#endif
+
+		/* Prepare our share */
+		batch_worker(arg);
+
+		/* Acquire lock */
+		pthread_mutex_lock(&batch_lock);
+
+		/* Wake caller once all helpers are done */
+		if (!--batch_left) pthread_cond_signal(&batch_done);
+
+		/* Release lock */
+		pthread_mutex_unlock(&batch_lock);
 	}
 
-	/* Return best score */
-	return b_s;
+	/* Never reached */
+	return NULL;
 }
 
 /*
- * Find the best "action path" available from the given state.
- *
- * We also return the score of the endstate that will result.
+ * Start the helper threads that prepare batched combinations.
  *
- * We return -1 if no legal actions are available.
- *
- * This function is recursive.
+ * This is done once, with one helper less than the threads allowed.
  */
-static double find_action(game *g)
+static void start_helpers(void)
 {
-	game sim;
-	player *p;
-	int old_turn;
-	int i, n;
-	action legal[MAX_ACTION], best_act;
-	double score, b_s = -1;
+	pthread_attr_t attr;
+	pthread_t thread;
 
-	/* Get player pointer */
-	p = &g->p[g->turn];
+	/* Check for helpers already started */
+	if (num_helpers) return;
 
-	/* Get current player's turn */
-	old_turn = g->turn;
+	/* Give helpers the usual search stack */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SEARCH_STACK);
 
-	/* Check for game over */
-	if (g->game_over)
+	/* Start helpers */
+	while (num_helpers + 1 < ai_threads)
 	{
-		/* Clear any choice nodes that haven't been examined */
-		node_len = node_pos;
+		/* Create thread (numbered from one) */
+		if (pthread_create(&thread, &attr, batch_helper,
+		                   (void *)(long)(num_helpers + 1))) break;
 
-		/* Return end of game score */
-		return eval_game(g, g->sim_turn);
+		/* Count helper */
+		num_helpers++;
 	}
 
-	/* Check for choice to make */
-	if (node_pos < node_len)
+	/* Destroy attributes */
+	pthread_attr_destroy(&attr);
+}
+#endif
+
+/*
+ * Evaluate a batch of combinations, and find the best one.
+ *
+ * Small batches are evaluated one at a time as usual.  Otherwise the
+ * positions are prepared in parallel, and then scored in order with the
+ * network eval_game() uses, so that the scores are exactly those found
+ * by one thread.  Ties are broken in favor of the last combination, as
+ * in ai_choose_combo().
+ */
+static void run_batch(int *best, double *b_s)
+{
+	int i;
+#ifdef HAVE_PTHREAD_H
+	net *l;
+	unsigned char *input;
+	double score;
+	int j;
+
+	/* Check for enough combinations to be worth splitting */
+	if (batch.num_combo >= PARALLEL_MIN && num_helpers)
 	{
-		/* Handle choice node instead of normal */
-		return choose_action(g);
-	}
+		/* Loop over threads */
+		for (i = 0; i <= num_helpers; i++)
+		{
+			/* Share chooser's network weights */
+			make_evaluator(&evaluator[i], &learner[batch.chooser]);
+		}
 
-	/* Avoid needlees work when checking for forced retreat */
-	if (checking_retreat && !must_retreat) return 0;
+		/* Acquire lock */
+		pthread_mutex_lock(&batch_lock);
 
-	/* Get legal actions to take */
-	n = legal_act(g, legal);
+		/* Hand out batch */
+		batch_left = num_helpers;
+		batch_round++;
 
-	/* Check for no legal actions */
-	if (!n) return -1;
+		/* Wake helpers */
+		pthread_cond_broadcast(&batch_ready);
 
-	/* Check for only one possible action */
-	if (n == 1)
-	{
-		/* Increase path position for future searching */
-		best_path_pos++;
+		/* Release lock */
+		pthread_mutex_unlock(&batch_lock);
 
-#ifdef DEBUG
-		/* Remember current path */
-		cur_path[best_path_pos] = legal[0];
+		/* Prepare our share */
+		batch_worker((void *)0);
+
+		/* Acquire lock */
+		pthread_mutex_lock(&batch_lock);
+
+		/* Wait for helpers */
+		while (batch_left) pthread_cond_wait(&batch_done, &batch_lock);
+
+		/* Release lock */
+		pthread_mutex_unlock(&batch_lock);
+
+#ifdef STATS
+		/* Add helper threads' statistics */
+		for (i = 1; i <= num_helpers; i++)
+			merge_stats(&thread_stats[i]);
 #endif
 
-		/* Perform that action */
-		perform_act(g, legal[0]);
+		/* Get network to score positions with */
+		l = eval_network(batch.chooser);
 
-		/* Check for turn change */
-		if (g->turn != old_turn)
+		/* Loop over results in order */
+		for (i = 0; i < batch.num_combo; i++)
 		{
-			/* Are we checking opponent's response */
-			if (checking_retreat)
-			{
-				/* Score is unimportant */
-				score = 0.0;
+			/* Skip illegal combinations */
+			if (batch.score[i] < 0) continue;
 
-				/* We must not be forced to retreat */
-				must_retreat = 0;
+			/* Count evaluations */
+			STAT_ADD(evals);
+
+			/* Check for no learner loaded */
+			if (!l->num_inputs)
+			{
+				/* Use neutral score */
+				score = 0.5;
 			}
 			else
 			{
-				/* Check for inevitable retreat from opponent */
-				check_retreat(g);
+				/* Get saved inputs */
+				input = batch.input + (long)i * NET_INPUT;
+
+				/* Set inputs */
+				for (j = 0; j < NET_INPUT; j++)
+					l->input_value[j] = input[j];
+
+				/* Compute network value */
+				compute_net(l);
 
 				/* Get score */
-				score = eval_game(g, g->sim_turn);
+				score = l->win_prob[batch.chooser];
+			}
 
-				/* Clear must retreat flag */
-				must_retreat = 0;
+			/* Check for better (or equal) score */
+			if (score >= *b_s)
+			{
+				/* Save better */
+				*b_s = score;
+				*best = batch.combo[i];
 			}
 		}
 
-		/* Continue searching */
-		else score = find_action(g);
-
-		/* Return to current path position */
-		best_path_pos--;
-
-		/* Check for better actions than previously discovered */
-		if (!checking_retreat && score >= best_path_score)
-		{
-			/* Store action in best path */
-			best_path[best_path_pos] = legal[0];
-
-			/* Save best score seen */
-			best_path_score = score;
-		}
+		/* Done */
+		return;
+	}
+#endif
 
-		/* Return score */
-		return score;
+	/* Evaluate each combination in order */
+	for (i = 0; i < batch.num_combo; i++)
+	{
+		/* Try combination */
+		ai_choose_combo(batch.g, batch.chooser, batch.who,
+		                batch.choices, batch.combo[i], best, b_s,
+		                batch.callback, batch.data);
 	}
+}
 
-	/* Increase path position for future searching */
-	best_path_pos++;
+/*
+ * Card chooser helper function.
+ *
+ * Try every combination of exactly c cards out of n, in increasing order
+ * of the combination's bitmask.  Combinations are stepped through with
+ * Gosper's hack instead of recursion.
+ *
+ * If a batch is given, combinations are added to it to be evaluated
+ * later instead of being tried immediately.
+ *
+ * Return -1 if enumeration stopped because no more combinations could be
+ * stored.
+ */
+static int ai_choose_aux(game *g, int chooser, int who, design **choices,
+                          int n, int c, int *best, double *b_s,
+                          choose_result callback, void *data,
+                          choice_batch *b)
+{
+	unsigned int chosen, low, ripple, limit;
 
-	/* Loop over available actions */
-	for (i = 0; i < n; i++)
+	/* Check for too few choices */
+	if (c > n) return 0;
+
+	/* Check for choosing nothing */
+	if (!c)
 	{
-#ifdef DEBUG
-		/* Remember current path */
-		cur_path[best_path_pos] = legal[i];
-#endif
+		/* Check for batch */
+		if (b) return add_batch(b, 0);
+
+		/* Try empty combination */
+		if (!stop_choose) return ai_choose_combo(g, chooser, who,
+		                                         choices, 0, best, b_s,
+		                                         callback, data);
 
-		/* Avoid unnecessary work when checking for forced retreat */
-		if (checking_retreat && !must_retreat) break;
+		/* Done */
+		return 0;
+	}
 
-		/* Copy game */
-		simulate_game(&sim, g);
+	/* First bitmask past all combinations */
+	limit = 1U << n;
 
-		/* Perform action */
-		perform_act(&sim, legal[i]);
+	/* Start with lowest combination */
+	chosen = (1U << c) - 1;
 
-		/* Check for retreat */
-		if (legal[i].act == ACT_RETREAT && node_pos == node_len)
-		{
-			/* Are we checking for forced retreat */
-			if (checking_retreat)
-			{
-				/* Score is unimportant */
-				score = 0;
-			}
-			else
-			{
-				/* Get score */
-				score = eval_game(&sim, sim.sim_turn);
-			}
-		}
+	/* Loop until all combinations are tried */
+	while (chosen < limit)
+	{
+		/* Check for no need to look further */
+		if (stop_choose) return 0;
 
-		/* Normal action */
-		else
+		/* Check for batch */
+		if (b)
 		{
-			/* Continue searching */
-			score = find_action(&sim);
+			/* Add combination */
+			if (add_batch(b, (int)chosen)) return -1;
 		}
 
-		/* Check for better score among actions */
-		if (score >= b_s)
-		{
-			/* Remember best */
-			b_s = score;
-			best_act = legal[i];
-		}
-	}
+		/* Try this combination */
+		else if (ai_choose_combo(g, chooser, who, choices, (int)chosen,
+		                         best, b_s, callback, data)) return -1;
 
-	/* Return to current path position */
-	best_path_pos--;
+		/* Find lowest set bit */
+		low = chosen & -chosen;
 
-	/* Check for better actions than previously discovered */
-	if (!checking_retreat && b_s >= best_path_score)
-	{
-		/* Store action in best path */
-		best_path[best_path_pos] = best_act;
+		/* Move lowest block of set bits up one position */
+		ripple = chosen + low;
 
-		/* Save best score seen */
-		best_path_score = b_s;
+		/* Move rest of block back down to the bottom */
+		chosen = ripple | (((chosen ^ ripple) >> 2) / low);
 	}
 
-	/* Return best score */
-	return b_s;
+	/* All combinations tried */
+	return 0;
 }
 
 /*
- * Have the AI player take an action.
+ * Generic card chooser.
  */
-static void ai_take_action(game *g)
+static void ai_choose(game *g, int chooser, int who, design **choices,
+                      int num_choices, int min, int max, choose_result callback,
+                      void *data, char *prompt)
 {
-	game sim;
-	player *p;
-	action current;
-	int old_turn;
+	double b_s = -2;
+	int best = 0;
+	int c, i;
+	design *chosen[DECK_SIZE];
+	int num_chosen = 0;
+	choice_batch *b = NULL;
 
-	/* Get player pointer */
-	p = &g->p[g->turn];
+	/* Check for unsimulated game */
+	if ((!g->simulation && chooser == g->turn) || assist_str)
+	{
+		/* Check current action */
+		if (best_path[best_path_pos].act == ACT_CHOOSE)
+		{
+			/* Get best from stored choice */
+			best = best_path[best_path_pos].chosen;
 
-	/* Save current turn */
-	old_turn = g->turn;
+			/* Loop over chosen cards */
+			for (i = 0; (1 << i) <= best; i++)
+			{
+				/* Check for bit set */
+				if (best & (1 << i))
+				{
+					/* Add card to list */
+					chosen[num_chosen++] = choices[i];
+				}
+			}
 
-	/* Clear best path */
-	best_path_pos = 0;
-	best_path_score = -1;
+			/* Advance to next path position */
+			best_path_pos++;
 
-	/* Check for beginning of turn */
-	if (p->phase == PHASE_START)
-	{
-		/* Train networks with past inputs */
-		perform_training(g, g->turn, NULL);
-		perform_training(g, !g->turn, NULL);
+			/* Just use previously computed choice */
+			callback(g, who, chosen, num_chosen, data);
+
+			/* Check for assist string */
+			if (assist_str)
+			{
+				/* Add assist message */
+				choose_assist(chosen, num_chosen);
+			}
+
+			/* Done */
+			return;
+		}
+		else
+		{
+			/* Error */
+			printf("No choice action next in path?!\n");
+		}
 	}
 
-	/* Clear random event flag */
-	g->random_event = 0;
+	/* Restrict maximum */
+	if (max > num_choices) max = num_choices;
 
-	/* Check for error in handling choice nodes */
-	if (node_len > 0 || node_pos > 0)
+	/* Check for error */
+	if (min > num_choices)
 	{
-		printf("Choice nodes around\n");
+		/* Error */
+		printf("Can't choose %d from %d!\n", min, num_choices);
+		return;
 	}
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+	/* Check for error */
+	if (!num_choices)
+	{
+		/* Error */
+		fprintf(stderr, "No choices available ('%s')\n", prompt);
+		return;
+	}
 
-#ifdef DEBUG
-	printf("START\n");
-#endif
+	/* Prevent recursive calls to ai_choose() */
+	if (inside_choose) return;
+	
+	/* We are inside choose function */
+	inside_choose = 1;
 
-	/* Find best action path */
-	find_action(&sim);
+	/* Check for chooser's turn */
+	if (chooser == g->turn)
+	{
+		/* Set choice data */
+		nodes[node_len].callback = callback;
+		nodes[node_len].data = data;
+		nodes[node_len].num_legal = 0;
+		nodes[node_len].who = who;
 
-#ifdef DEBUG
-	printf("END\n");
-#endif
+		/* Set choices */
+		for (i = 0; i < num_choices; i++)
+		{
+			/* Set choice */
+			nodes[node_len].choices[i] = choices[i];
+		}
+	}
 
-	/* Start at beginning of path */
-	best_path_pos = 0;
+	/* Do not stop looking */
+	stop_choose = 0;
 
-	/* Loop until end */
-	while (1)
+	/* Check for opponent's choice that may be evaluated in parallel */
+	if (chooser != g->turn && ai_threads > 1 && !checking_retreat &&
+	    !assist_str && !search_net)
 	{
-		/* Get current action */
-		current = best_path[best_path_pos];
+		/* Set batch information */
+		batch.g = g;
+		batch.chooser = chooser;
+		batch.who = who;
+		batch.choices = choices;
+		batch.callback = callback;
+		batch.data = data;
+		b = &batch;
+
+		/* Clear combinations */
+		batch.num_combo = 0;
+	}
 
-		/* Check for error */
-		if (current.act == ACT_CHOOSE)
+	/* Loop over number of cards allowed */
+	for (c = min; c <= max; c++)
+	{
+		/* Try choosing this many cards */
+		if (ai_choose_aux(g, chooser, who, choices, num_choices, c,
+		                  &best, &b_s, callback, data, b))
 		{
-			printf("Trying to perform choose action!\n");
+			/* Error */
+			printf("Too many legal combinations, using first %d!\n",
+			       MAX_LEGAL);
+
+			/* Choose from combinations already found */
 			break;
 		}
+	}
 
-		/* Advance to next */
-		best_path_pos++;
+	/* Evaluate batched combinations */
+	if (b) run_batch(&best, &b_s);
 
-		/* Perform current action */
-		perform_act(g, current);
+	/* Check for chooser's turn */
+	if (chooser == g->turn)
+	{
+		/* One more choice to make */
+		node_len++;
+	}
+	else
+	{
+		/* Loop over chosen cards */
+		for (i = 0; (1 << i) <= best; i++)
+		{
+			/* Check for bit set */
+			if (best & (1 << i))
+			{
+				/* Add card to list */
+				chosen[num_chosen++] = choices[i];
+			}
+		}
 
-		/* Check for random event */
-		if (g->random_event) break;
+		/* Go ahead and perform choice */
+		callback(g, who, chosen, num_chosen, data);
+	}
 
-		/* Check for retreat */
-		if (current.act == ACT_RETREAT) break;
+	/* No longer inside choose function */
+	inside_choose = 0;
+}
 
-		/* Check for turn change */
-		if (g->turn != old_turn) break;
+#ifdef HAVE_PTHREAD_H
+/*
+ * Destroy this thread's storage for legal combinations.
+ */
+static void free_nodes(void)
+{
+	int i;
 
-		/* Check for game over */
-		if (g->game_over) break;
+	/* Loop over choice nodes */
+	for (i = 0; i < 10; i++)
+	{
+		/* Free storage */
+		free(nodes[i].legal);
+
+		/* Clear pointer and size */
+		nodes[i].legal = NULL;
+		nodes[i].max_legal = 0;
 	}
 }
 
 /*
- * Return a string containing the AI's assumption about the best possible
- * move.
+ * Information passed to a second search thread.
  */
-void ai_assist(game *g, char *buf)
+typedef struct search_job
 {
-	game sim;
-	action current;
-	char tmp[1024];
+	/* Game to search from */
+	game *g;
+
+	/* Score of best outcome */
+	double score;
+
+#ifdef STATS
+	/* Statistics of search */
+	search_stats stats;
+#endif
+
+} search_job;
+
+/*
+ * Search from a game state in a second thread.
+ */
+static void *search_worker(void *arg)
+{
+	search_job *job = (search_job *)arg;
+
+	/* Use helper networks */
+	search_net = helper_net;
 
 	/* Clear best path */
 	best_path_pos = 0;
 	best_path_score = -1;
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+	/* Search */
+	job->score = find_action(job->g);
 
-	/* Find best action path */
-	find_action(&sim);
+#ifdef STATS
+	/* Save statistics */
+	job->stats = stats;
+#endif
 
-	/* Check for no legal moves */
-	if (best_path_score == -1)
-	{
-		/* Add message */
-		strcpy(buf, "No legal moves!\n");
-		return;
-	}
+	/* Free choice storage */
+	free_nodes();
+
+	/* Free search frames */
+	free_frames();
+
+	/* Done */
+	return NULL;
+}
+#endif
+
+/*
+ * Search whether calling a bluff is better than not.
+ *
+ * We search both the result of not calling the bluff and the result of
+ * calling it.  If more than one thread is allowed, the second search is
+ * run at the same time in a helper thread.
+ *
+ * This does not halve the time of the decision.  The two searches are
+ * seldom the same size, and the helper cannot use the retreat, leaf and
+ * solve caches this thread has filled, so even with a free core only
+ * about a third of the time is saved.  With a single core it is slower.
+ */
+static int bluff_search(game *g)
+{
+	game sim, called;
+	card *c;
+	double score, called_score;
+	int i;
+#ifdef HAVE_PTHREAD_H
+	search_job job;
+	pthread_t thread;
+	pthread_attr_t attr;
+	int helper = 0;
+#endif
 
-	/* Start back at beginning */
+	/* Clear best path */
+	best_path_pos = 0;
+
+	/* Simulate game */
 	simulate_game(&sim, g);
 
-	/* Clear buffer */
-	strcpy(buf, "");
+	/* XXX Force our turn */
+	sim.turn = !sim.turn;
+	sim.sim_turn = sim.turn;
 
-	/* Use buffer for assist messages */
-	assist_str = buf;
+	/* Start at beginning of turn */
+	sim.p[sim.turn].phase = PHASE_START;
 
-	/* Start at beginning of path */
-	best_path_pos = 0;
+	/* Copy game for called bluff */
+	simulate_game(&called, &sim);
 
-	/* Loop until done */
-	while (sim.p[g->turn].phase <= PHASE_ANNOUNCE)
+	/* Loop over opponent's cards */
+	for (i = 1; i < DECK_SIZE; i++)
 	{
-		/* Get current action */
-		current = best_path[best_path_pos];
+		/* Get card pointer */
+		c = &called.p[!called.turn].deck[i];
 
-		/* Advance position */
-		best_path_pos++;
+		/* Skip non-bluff cards */
+		if (!c->bluff) continue;
 
-		/* Check current action */
-		switch (current.act)
-		{
-			/* None */
-			case ACT_NONE:
+		/* Discard bluff */
+		reveal_bluff(&called, !called.turn, c->d_ptr);
 
-				/* No message */
-				strcpy(tmp, "");
-				break;
+		/* Mark card as fake */
+		c->random_fake = 1;
+	}
 
-			/* Retreat */
-			case ACT_RETREAT:
+	/* Give opponent dragon */
+	attract_dragon(&called, !called.turn);
 
-				/* Add message */
-				sprintf(tmp, "Retreat\n");
-				break;
+#ifdef HAVE_PTHREAD_H
+	/* Set game to search */
+	job.g = &called;
 
-			/* Retrieve */
-			case ACT_RETRIEVE:
+	/* Check for more than one thread allowed */
+	if (ai_threads > 1 && !search_net)
+	{
+		/* Share weights of both networks */
+		make_evaluator(&helper_net[0], &learner[0]);
+		make_evaluator(&helper_net[1], &learner[1]);
 
-				/* Add message */
-				sprintf(tmp, "Retrieve %s\n",
-				             current.arg->name);
-				break;
+		/* Give helper thread a large stack for deep searches */
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, SEARCH_STACK);
 
-			/* Play */
-			case ACT_PLAY:
+		/* Search called bluff in helper thread */
+		helper = !pthread_create(&thread, &attr, search_worker, &job);
 
-				/* Add message */
-				sprintf(tmp, "Play %s\n",
-				              current.arg->name);
-				break;
+		/* Destroy attributes */
+		pthread_attr_destroy(&attr);
+	}
+#endif
 
-			/* Play with no effect */
-			case ACT_PLAY_NO:
+#ifdef DEBUG
+	printf("NO CALL BLUFF START\n");
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Play %s with no effect\n",
-				              current.arg->name);
-				break;
+	/* Get score of not calling */
+	score = find_action(&sim);
 
-			/* Announce fire */
-			case ACT_ANN_FIRE:
+#ifdef DEBUG
+	printf("NO CALL BLUFF END\n");
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Announce fire\n");
-				break;
+#ifdef HAVE_PTHREAD_H
+	/* Check for helper thread */
+	if (helper)
+	{
+		/* Wait for helper */
+		pthread_join(thread, NULL);
 
-			/* Announce earth */
-			case ACT_ANN_EARTH:
+#ifdef STATS
+		/* Add helper's statistics */
+		merge_stats(&job.stats);
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Announce earth\n");
-				break;
+		/* Check for better options than before */
+		return job.score >= score;
+	}
+#endif
 
-			/* Use special */
-			case ACT_USE:
+#ifdef DEBUG
+	printf("CALLED BLUFF START\n");
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Use %s special text\n",
-				              current.arg->name);
-				break;
+	/* Get score of calling */
+	called_score = find_action(&called);
 
-			/* Satisfy */
-			case ACT_SATISFY:
+#ifdef DEBUG
+	printf("CALLED BLUFF END\n");
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Satisfy %s\n",
-				              current.arg->name);
-				break;
+	/* Call bluff if better than before */
+	return called_score >= score;
+}
 
-			/* Land ship */
-			case ACT_LAND:
+/*
+ * Decide whether to call bluff.
+ */
+static int ai_call_bluff(game *g)
+{
+	player *opp;
+	card *c;
+	ponder_entry *e_ptr;
+	int i, unknown = 0, bluff = 0, call;
+#ifdef STATS
+	struct timeval start;
+#endif
 
-				/* Add message */
-				sprintf(tmp, "Land %s\n",
-				              current.arg->name);
-				break;
+	/* Stop thinking ahead */
+	ai_ponder_stop();
 
-			/* Load ship */
-			case ACT_LOAD:
+	/* Get bluffing player's pointer (it is still their turn) */
+	opp = &g->p[g->turn];
 
-				/* Add message */
-				sprintf(tmp, "Load %s onto %s\n",
-				              current.arg->name,
-				              current.target->name);
-				break;
+	/* Loop over opponent cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &opp->deck[i];
 
-			/* Play bluff */
-			case ACT_BLUFF:
+		/* Check for correct bluff icon */
+		if (c->d_ptr->icons & (ICON_BLUFF_F << g->fight_element))
+		{
+			/* Count cards with unknown locations */
+			if (!c->loc_known) unknown++;
+		}
 
-				/* Add message */
-				sprintf(tmp, "Bluff %s\n",
-				              current.arg->name);
-				break;
+		/* Count bluff cards */
+		if (c->bluff) bluff++;
+	}
 
-			/* Reveal bluff */
-			case ACT_REVEAL:
+	/* Always call impossible bluffs */
+	if (bluff > unknown) return 1;
 
-				/* Add message */
-				sprintf(tmp, "Reveal %s\n",
-				              current.arg->name);
-				break;
-		}
+	/* Look for decision made while opponent was thinking */
+	e_ptr = ponder_lookup(PONDER_BLUFF, view_key(g, !g->turn));
 
-		/* Add message to buffer */
-		strcat(buf, tmp);
+	/* Use pondered decision if available */
+	if (e_ptr) return e_ptr->call;
 
-		/* Perform action */
-		perform_act(&sim, current);
+#ifdef STATS
+	/* Start counting */
+	start_stats(&start);
+#endif
 
-		/* Check for retreat */
-		if (current.act == ACT_RETREAT) break;
+	/* Search for best decision */
+	call = bluff_search(g);
 
-		/* Check for game over */
-		if (sim.game_over) break;
-	}
+#ifdef STATS
+	/* Report statistics */
+	report_stats("call_bluff", &start);
+#endif
 
-	/* Clear assist string */
-	assist_str = NULL;
+	/* Return decision */
+	return call;
 }
 
+#ifdef HAVE_PTHREAD_H
 /*
- * Add message to assist string from chooser.
+ * Store a decision made while pondering.
  */
-static void choose_assist(design *chosen[DECK_SIZE], int num_chosen)
+static ponder_entry *ponder_store(int kind, unsigned long long key)
 {
-	char tmp[1024];
-	int i;
+	ponder_entry *e_ptr;
 
-	/* Start message */
-	if (num_chosen)
-	{
-		/* Format message */
-		sprintf(tmp, "Choose %d: ", num_chosen);
-	}
-	else
-	{
-		/* Add message */
-		strcat(assist_str, "Choose none\n");
-		return;
-	}
+	/* Check for stop request (results may be incomplete) */
+	if (ponder_abort) return NULL;
 
-	/* Loop over chosen */
-	for (i = 0; i < num_chosen; i++)
-	{
-		/* Add choice */
-		strcat(tmp, chosen[i]->name);
+	/* Get next entry (replacing the oldest once full) */
+	e_ptr = &ponder_result[ponder_pos];
 
-		/* Add spaces */
-		if (i + 1 < num_chosen) strcat(tmp, ", ");
-	}
+	/* Advance to next entry */
+	ponder_pos = (ponder_pos + 1) % PONDER_MAX;
 
-	/* Add newline */
-	strcat(tmp, "\n");
+	/* Count entries */
+	if (num_ponder < PONDER_MAX) num_ponder++;
 
-	/* Add to string */
-	strcat(assist_str, tmp);
+	/* Set kind and key */
+	e_ptr->kind = kind;
+	e_ptr->key = key;
+
+	/* Return entry */
+	return e_ptr;
 }
 
 /*
- * Flag to stop searching for legal combinations.
- *
- * Sometimes when checking for opponent forced retreat, we don't care to
- * search for the best combination, just one that works.
+ * Think ahead about the start of our turn.
  */
-static int stop_choose;
+static void ponder_turn(game *g, int who)
+{
+	game sim;
+	ponder_entry *e_ptr;
+	unsigned long long key;
+
+	/* Check for game over or not our turn */
+	if (g->game_over || g->turn != who) return;
+
+	/* Compute key as we will see the real game */
+	key = view_key(g, who);
+
+	/* Check for decision already made */
+	if (ponder_lookup(PONDER_TURN, key)) return;
+
+	/* Copy game */
+	simulate_game(&sim, g);
+
+	/* Search from our point of view */
+	sim.sim_turn = who;
+
+	/* Clear best path */
+	best_path_pos = 0;
+	best_path_score = -1;
+
+	/* Find best action path */
+	find_action(&sim);
 
+	/* Store path */
+	e_ptr = ponder_store(PONDER_TURN, key);
+
+	/* Copy path if stored */
+	if (e_ptr) memcpy(e_ptr->path, best_path, sizeof(action) * MAX_ACTION);
+}
 
 /*
- * Card chooser helper function.
+ * Think ahead while the opponent takes their turn.
  *
- * This function recursively calls itself to check all combinations.
+ * We predict the states we will face if the opponent retreats or
+ * announces power now, decide whether we would call any bluff, and
+ * search the beginning of our following turn.
  */
-static void ai_choose_aux(game *g, int chooser, int who, design **choices,
-                          int n, int c, int chosen, int *best, double *b_s,
-                          choose_result callback, void *data)
+static void ponder(game *g)
 {
 	game sim;
-	design *list[DECK_SIZE];
-	int i, num_chosen = 0;
-	int num_legal;
-	int callback_value;
-	double score;
+	ponder_entry *e_ptr;
+	player *opp;
+	card *c;
+	int who, element, old_turn, i, bluff, call;
 
-	/* Check for no need to look further */
-	if (stop_choose) return;
+	/* We are the player not taking their turn */
+	who = !g->turn;
 
-	/* Check for too few choices */
-	if (c > n) return;
+	/* Get opponent pointer */
+	opp = &g->p[g->turn];
 
-	/* Check for end */
-	if (!n)
+	/* Check for retreat possible */
+	if (g->fight_started && opp->phase <= PHASE_RETREAT)
 	{
-		/* Loop over chosen cards */
-		for (i = 0; (1 << i) <= chosen; i++)
-		{
-			/* Check for bit set */
-			if (chosen & (1 << i))
-			{
-				/* Add card to list */
-				list[num_chosen++] = choices[i];
-			}
-		}
-
 		/* Copy game */
 		simulate_game(&sim, g);
 
-		/* Apply result */
-		callback_value = callback(&sim, who, list, num_chosen, data);
+		/* Opponent retreats */
+		retreat(&sim);
 
-		/* Check for illegal combination */
-		if (!callback_value)
-		{
-			/* Combination was illegal */
-			return;
-		}
+		/* Search our turn */
+		ponder_turn(&sim, who);
+	}
+
+	/* Loop over elements */
+	for (element = 0; element < 2; element++)
+	{
+		/* Check for stop request */
+		if (ponder_abort) break;
+
+		/* Skip announcements that are not possible */
+		if (!opp->char_played) break;
+		if (g->fight_started && element != g->fight_element) continue;
+
+		/* Copy game */
+		simulate_game(&sim, g);
 
-		/* Check for ability to stop looking if desired */
-		if (callback_value > 1 && checking_retreat) stop_choose = 1;
+		/* Save current turn */
+		old_turn = sim.turn;
 
-		/* Check for chooser's turn */
-		if (chooser == g->turn)
-		{
-			/* Get number of legal combinations */
-			num_legal = nodes[node_len].num_legal;
+		/* Opponent ends support phase and announces power */
+		end_support(&sim);
+		announce_power(&sim, element);
 
-			/* Add combination */
-			nodes[node_len].legal[num_legal] = chosen;
+		/* Check for end of fight */
+		if (!sim.fight_started) continue;
+
+		/* Assume no bluff */
+		bluff = 0;
+
+		/* Look for bluff cards */
+		for (i = 1; i < DECK_SIZE; i++)
+		{
+			/* Get card pointer */
+			c = &sim.p[old_turn].deck[i];
 
-			/* One more combination */
-			nodes[node_len].num_legal++;
+			/* Check for bluff */
+			if (c->bluff && !c->value_ignored) bluff = 1;
 		}
-		else
+
+		/* Check for bluff to call */
+		if (bluff)
 		{
-			/* Evaluate result */
-			score = eval_game(&sim, chooser);
+			/* Look for decision made from an earlier position */
+			e_ptr = ponder_lookup(PONDER_BLUFF, view_key(&sim, who));
 
-			/* Check for better score */
-			if (score >= *b_s)
+			/* Check for decision made */
+			if (e_ptr)
 			{
-				/* Save better */
-				*b_s = score;
-				*best = chosen;
+				/* Use decision */
+				call = e_ptr->call;
+			}
+			else
+			{
+				/* Decide whether to call */
+				call = bluff_search(&sim);
+
+				/* Store decision */
+				e_ptr = ponder_store(PONDER_BLUFF,
+				                     view_key(&sim, who));
+
+				/* Save decision if stored */
+				if (e_ptr) e_ptr->call = call;
 			}
+
+			/* Following state is unknown if we call */
+			if (call) continue;
 		}
 
-		/* Done */
-		return;
-	}
+		/* Opponent refreshes hand and ends turn */
+		refresh_phase(&sim);
+		end_turn(&sim);
 
-	/* Try without current card */
-	ai_choose_aux(g, chooser, who, choices, n - 1, c, chosen << 1,
-	              best, b_s, callback, data);
+		/* Check for no change of turn yet */
+		if (sim.turn == old_turn)
+		{
+			/* Go to next player */
+			sim.p[old_turn].phase = PHASE_NONE;
+			sim.turn = !old_turn;
+			sim.p[sim.turn].phase = PHASE_START;
+		}
 
-	/* Try with current card (if more cards can be chosen) */
-	if (c) ai_choose_aux(g, chooser, who, choices, n - 1, c - 1,
-	                     (chosen << 1) + 1, best, b_s, callback, data);
+		/* Search our turn */
+		ponder_turn(&sim, who);
+	}
 }
 
 /*
- * Generic card chooser.
+ * Ponder each position handed to us by ai_ponder_start().
+ *
+ * "arg" points to where the next position is placed.
  */
-static void ai_choose(game *g, int chooser, int who, design **choices,
-                      int num_choices, int min, int max, choose_result callback,
-                      void *data, char *prompt)
+static void *ponder_worker(void *arg)
 {
-	double b_s = -2;
-	int best = 0;
-	int c, i;
-	design *chosen[DECK_SIZE];
-	int num_chosen = 0;
-
-	/* Check for unsimulated game */
-	if ((!g->simulation && chooser == g->turn) || assist_str)
-	{
-		/* Check current action */
-		if (best_path[best_path_pos].act == ACT_CHOOSE)
-		{
-			/* Get best from stored choice */
-			best = best_path[best_path_pos].chosen;
+	game *next = (game *)arg;
 
-			/* Loop over chosen cards */
-			for (i = 0; (1 << i) <= best; i++)
-			{
-				/* Check for bit set */
-				if (best & (1 << i))
-				{
-					/* Add card to list */
-					chosen[num_chosen++] = choices[i];
-				}
-			}
+	/* We are pondering */
+	in_ponder = 1;
 
-			/* Advance to next path position */
-			best_path_pos++;
+	/* Stop when asked */
+	stop_flag = &ponder_abort;
 
-			/* Just use previously computed choice */
-			callback(g, who, chosen, num_chosen, data);
+	/* Loop forever */
+	while (1)
+	{
+		/* Acquire lock */
+		pthread_mutex_lock(&ponder_lock);
 
-			/* Check for assist string */
-			if (assist_str)
-			{
-				/* Add assist message */
-				choose_assist(chosen, num_chosen);
-			}
+		/* Wait for position to ponder */
+		while (!ponder_queued) pthread_cond_wait(&ponder_cond,
+		                                         &ponder_lock);
 
-			/* Done */
-			return;
-		}
-		else
-		{
-			/* Error */
-			printf("No choice action next in path?!\n");
-		}
-	}
+		/* Take position */
+		ponder_game = *next;
+		ponder_queued = 0;
 
-	/* Restrict maximum */
-	if (max > num_choices) max = num_choices;
+		/* Clear stop request */
+		ponder_abort = 0;
 
-	/* Check for error */
-	if (min > num_choices)
-	{
-		/* Error */
-		printf("Can't choose %d from %d!\n", min, num_choices);
-		return;
-	}
+		/* We are working */
+		ponder_busy = 1;
 
-	/* Check for error */
-	if (!num_choices)
-	{
-		/* Error */
-		fprintf(stderr, "No choices available ('%s')\n", prompt);
-		return;
-	}
+		/* Release lock */
+		pthread_mutex_unlock(&ponder_lock);
 
-	/* Prevent recursive calls to ai_choose() */
-	if (inside_choose) return;
-	
-	/* We are inside choose function */
-	inside_choose = 1;
+		/* Share weights of both networks */
+		make_evaluator(&ponder_net[0], &learner[0]);
+		make_evaluator(&ponder_net[1], &learner[1]);
 
-	/* Check for chooser's turn */
-	if (chooser == g->turn)
-	{
-		/* Set choice data */
-		nodes[node_len].callback = callback;
-		nodes[node_len].data = data;
-		nodes[node_len].num_legal = 0;
-		nodes[node_len].who = who;
+		/* Use pondering networks */
+		search_net = ponder_net;
 
-		/* Set choices */
-		for (i = 0; i < num_choices; i++)
-		{
-			/* Set choice */
-			nodes[node_len].choices[i] = choices[i];
-		}
-	}
+		/* Think ahead */
+		ponder(&ponder_game);
 
-	/* Do not stop looking */
-	stop_choose = 0;
+		/* Acquire lock */
+		pthread_mutex_lock(&ponder_lock);
 
-	/* Loop over number of cards allowed */
-	for (c = min; c <= max; c++)
-	{
-		/* Try choosing this many cards */
-		ai_choose_aux(g, chooser, who, choices, num_choices, c, 0,
-		              &best, &b_s, callback, data);
-	}
+		/* Done working */
+		ponder_busy = 0;
 
-	/* Check for chooser's turn */
-	if (chooser == g->turn)
-	{
-		/* One more choice to make */
-		node_len++;
-	}
-	else
-	{
-		/* Loop over chosen cards */
-		for (i = 0; (1 << i) <= best; i++)
-		{
-			/* Check for bit set */
-			if (best & (1 << i))
-			{
-				/* Add card to list */
-				chosen[num_chosen++] = choices[i];
-			}
-		}
+		/* Wake anyone waiting for us to stop */
+		pthread_cond_broadcast(&ponder_cond);
 
-		/* Go ahead and perform choice */
-		callback(g, who, chosen, num_chosen, data);
+		/* Release lock */
+		pthread_mutex_unlock(&ponder_lock);
 	}
 
-	/* No longer inside choose function */
-	inside_choose = 0;
+	/* Never reached */
+	return NULL;
 }
+#endif
 
 /*
- * Decide whether to call bluff.
+ * Start thinking ahead while the opponent takes their turn.
+ *
+ * Pondering is done in a separate thread on a copy of the game.  Any
+ * decisions made are used by ai_take_action() and ai_call_bluff() if we
+ * end up in the same situation.
+ *
+ * Nothing is done if the position looks the same to us as the last one.
+ * Otherwise the thread drops its current work and moves on to the new
+ * position; we do not wait for it to do so.
  */
-static int ai_call_bluff(game *g)
+void ai_ponder_start(game *g)
 {
-	game sim;
-	player *opp;
-	card *c;
-	double score;
-	int i, unknown = 0, bluff = 0;
+#ifdef HAVE_PTHREAD_H
+	pthread_attr_t attr;
+	unsigned long long key;
 
-	/* Get bluffing player's pointer (it is still their turn) */
-	opp = &g->p[g->turn];
+	/* Check for network not loaded */
+	if (!learner[!g->turn].num_inputs) return;
 
-	/* Loop over opponent cards */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &opp->deck[i];
+	/* Compute key of position as we see it */
+	key = view_key(g, !g->turn);
 
-		/* Check for correct bluff icon */
-		if (c->d_ptr->icons & (ICON_BLUFF_F << g->fight_element))
-		{
-			/* Count cards with unknown locations */
-			if (!c->loc_known) unknown++;
-		}
+	/* Acquire lock */
+	pthread_mutex_lock(&ponder_lock);
 
-		/* Count bluff cards */
-		if (c->bluff) bluff++;
+	/* Check for same position as before */
+	if (key == ponder_key)
+	{
+		/* Keep working on it */
+		pthread_mutex_unlock(&ponder_lock);
+		return;
 	}
 
-	/* Always call impossible bluffs */
-	if (bluff > unknown) return 1;
+	/* Ask thread to drop what it is doing */
+	ponder_abort = 1;
 
-	/* Clear best path */
-	best_path_pos = 0;
+	/* Hand over copy of game */
+	ponder_next = *g;
+	ponder_key = key;
+	ponder_queued = 1;
 
-	/* Simulate game */
-	simulate_game(&sim, g);
+	/* Wake thread */
+	pthread_cond_broadcast(&ponder_cond);
 
-	/* XXX Force our turn */
-	sim.turn = !sim.turn;
-	sim.sim_turn = sim.turn;
+	/* Release lock */
+	pthread_mutex_unlock(&ponder_lock);
 
-	/* Start at beginning of turn */
-	sim.p[sim.turn].phase = PHASE_START;
+	/* Check for thread already running */
+	if (ponder_started) return;
 
-#ifdef DEBUG
-	printf("NO CALL BLUFF START\n");
+	/* Give thread a large stack for deep searches */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, SEARCH_STACK);
+
+	/* Start pondering thread */
+	if (!pthread_create(&ponder_thread, &attr, ponder_worker,
+	                    &ponder_next)) ponder_started = 1;
+
+	/* Destroy attributes */
+	pthread_attr_destroy(&attr);
 #endif
+}
 
-	/* Get score of not calling */
-	score = find_action(&sim);
+/*
+ * Stop thinking ahead, and wait until the pondering thread is idle.
+ *
+ * Decisions already made are kept.
+ */
+void ai_ponder_stop(void)
+{
+#ifdef HAVE_PTHREAD_H
+	/* Check for no pondering thread */
+	if (!ponder_started) return;
 
-#ifdef DEBUG
-	printf("NO CALL BLUFF END\n");
+	/* Acquire lock */
+	pthread_mutex_lock(&ponder_lock);
+
+	/* Forget waiting position */
+	ponder_queued = 0;
+
+	/* Ponder again from any position (our work may be incomplete) */
+	ponder_key = 0;
+
+	/* Ask thread to stop */
+	ponder_abort = 1;
+
+	/* Wait for thread */
+	while (ponder_busy) pthread_cond_wait(&ponder_cond, &ponder_lock);
+
+	/* Release lock */
+	pthread_mutex_unlock(&ponder_lock);
 #endif
+}
 
-	/* Restart simulated game */
-	simulate_game(&sim, g);
+/*
+ * Let searches on the calling thread be stopped early and report their
+ * progress.
+ *
+ * Once "stop" is set, the current decision is made from the best path
+ * found so far.  "nodes" is incremented for each position searched.
+ */
+void ai_search_control(volatile int *stop, volatile int *nodes)
+{
+	/* Save stop flag */
+	stop_flag = stop;
 
-	/* XXX Force our turn */
-	sim.turn = !sim.turn;
-	sim.sim_turn = sim.turn;
+	/* Save progress counter */
+	progress = nodes;
+}
 
-	/* Start at beginning of turn */
-	sim.p[sim.turn].phase = PHASE_START;
+/*
+ * Make the inference weights of one of this thread's trainers from its
+ * weights, if the learner searches with inference weights.
+ */
+static void quantize_trainer(int who)
+{
+	/* Check for search in full precision */
+	if (!learner[who].quantized) return;
 
-	/* Loop over opponent's cards */
-	for (i = 1; i < DECK_SIZE; i++)
-	{
-		/* Get card pointer */
-		c = &sim.p[!sim.turn].deck[i];
+	/* Make inference weights of same precision as learner's */
+	quantize_net(&trainer[who], learner[who].quantized);
 
-		/* Skip non-bluff cards */
-		if (!c->bluff) continue;
+	/* Search with them */
+	make_evaluator(&trainer_infer[who], &trainer[who]);
+}
 
-		/* Discard bluff */
-		reveal_bluff(&sim, !sim.turn, c->d_ptr);
+/*
+ * Have games played by the calling thread train networks of its own,
+ * which share the weights of the learners.
+ *
+ * This lets several threads play training games at once.  If "local" is
+ * set, the thread trains private copies of the weights, and its training
+ * is added to the learners only by ai_train_merge().
+ */
+void ai_train_start(int local)
+{
+	/* Create networks */
+	make_trainer(&trainer[0], &learner[0], local);
+	make_trainer(&trainer[1], &learner[1], local);
 
-		/* Mark card as fake */
-		c->random_fake = 1;
-	}
+	/* Search in the same precision as the learners */
+	quantize_trainer(0);
+	quantize_trainer(1);
 
-	/* Give opponent dragon */
-	attract_dragon(&sim, !sim.turn);
+	/* Search and train with them */
+	search_net = trainer;
 
-#ifdef DEBUG
-	printf("CALLED BLUFF START\n");
+	/* No positions trained yet */
+	train_count = 0;
+}
+
+/*
+ * Add the training done by the calling thread's private weights to the
+ * learners.
+ */
+void ai_train_merge(void)
+{
+#ifdef HAVE_PTHREAD_H
+	/* Merge one thread at a time */
+	pthread_mutex_lock(&train_lock);
 #endif
 
-	/* Check for better options than before */
-	if (find_action(&sim) >= score) return 1;
+	/* Merge both networks */
+	merge_net(&trainer[0], &learner[0]);
+	merge_net(&trainer[1], &learner[1]);
 
-#ifdef DEBUG
-	printf("CALLED BLUFF END\n");
+#ifdef HAVE_PTHREAD_H
+	/* Done merging */
+	pthread_mutex_unlock(&train_lock);
 #endif
 
-	/* Do not call bluff */
-	return 0;
+	/* Search with merged weights */
+	quantize_trainer(0);
+	quantize_trainer(1);
+}
+
+/*
+ * Stop training the calling thread's own networks.
+ *
+ * Return the number of positions trained by the thread.
+ */
+int ai_train_stop(void)
+{
+	/* Merge any remaining training */
+	ai_train_merge();
+
+	/* Use learners again */
+	search_net = NULL;
+
+	/* Return positions trained */
+	return train_count;
 }
 
 /*
@@ -2455,6 +6923,10 @@ static int ai_call_bluff(game *g)
 static void ai_game_over(game *g, int who)
 {
 	double result[2];
+	int copied;
+
+	/* Stop thinking ahead before training */
+	ai_ponder_stop();
 
 	/* Check for win */
 	if (g->p[who].crystals)
@@ -2480,11 +6952,30 @@ static void ai_game_over(game *g, int who)
 	/* Perform final training */
 	perform_training(g, who, result);
 
+	/* Write positions of game to shards */
+	if (ai_shard) shard_game_over(g, who);
+
 	/* Clear past input array */
-	clear_store(&learner[who]);
+	clear_store(train_learner(who));
+
+#ifdef HAVE_PTHREAD_H
+	/* Other threads may be counting games */
+	pthread_mutex_lock(&train_lock);
+#endif
 
 	/* One more training iteration done */
 	learner[who].num_training++;
+
+	/* Copy weights if checkpoint is due */
+	copied = copy_checkpoint(who);
+
+#ifdef HAVE_PTHREAD_H
+	/* Done counting */
+	pthread_mutex_unlock(&train_lock);
+#endif
+
+	/* Write checkpoint if copied */
+	if (copied) write_checkpoint(g, who);
 }
 
 /*
@@ -2494,11 +6985,23 @@ static void ai_shutdown(game *g, int who)
 {
 	char fname[1024];
 
+	/* Stop thinking ahead */
+	ai_ponder_stop();
+
+	/* Wait for last checkpoint to be written */
+	wait_checkpoint(who);
+
+	/* Finish writing positions */
+	close_shard();
+
 	/* Create network filename */
 	sprintf(fname, DATADIR "/networks/bluemoon.net.%s.%s",
 	                                     g->p[who].p_ptr->name,
 	                                     g->p[!who].p_ptr->name);
 
+	/* Apply any unfinished training batch */
+	flush_net(&learner[who]);
+
 	/* Save network weights to disk */
 	save_net(&learner[who], fname);
 }
@@ -0,0 +1,757 @@
+/*
+ * Bluemoon AI
+ *
+ * Copyright (C) 2007-2008 Keldon Jones
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "net.h"
+
+#include <sys/time.h>
+
+/*
+ * Micro-benchmarks of the neural net code.
+ *
+ * Run as "benchnet [network file]".  Without a file, a network with
+ * random weights is used.  Each time reported is the fastest of several
+ * runs, since other processes can only ever make a run slower.
+ */
+
+/*
+ * Number of runs of each timing.
+ */
+#define RUNS 7
+
+/*
+ * Number of evaluations in one run.
+ */
+#define EVALS 100000
+
+/*
+ * Number of inputs set in a typical position (as seen in self-play).
+ */
+#define ACTIVE 105
+
+/*
+ * Number of steps in a sequence of input changes.
+ */
+#define STEPS 4096
+
+/*
+ * Return the current time in seconds.
+ */
+static double now(void)
+{
+	struct timeval tv;
+
+	/* Get time */
+	gettimeofday(&tv, NULL);
+
+	/* Return seconds */
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * Return a random number between 0 and 1.
+ */
+static double random_unit(void)
+{
+	/* Return random value */
+	return (double)rand() / RAND_MAX;
+}
+
+/*
+ * Measure the error and speed of the fast sigmoid used by NET_FAST.
+ */
+static void bench_sigmoid(void)
+{
+	double x[HIDDEN_NODES], exact[HIDDEN_NODES], fast[HIDDEN_NODES];
+	double err, max_err = 0.0, max_x = 0.0, start, best[3];
+	int i, j, k, n = 0;
+
+	/* Sweep from -20 to 20 in steps of 1e-5 */
+	while (n < 4000000)
+	{
+		/* Make next set of values */
+		for (i = 0; i < HIDDEN_NODES; i++)
+		{
+			/* Compute value */
+			x[i] = -20.0 + 1e-5 * n++;
+		}
+
+		/* Copy values */
+		memcpy(exact, x, sizeof(x));
+		memcpy(fast, x, sizeof(x));
+
+		/* Normalize both ways */
+		normalize_values(exact, HIDDEN_NODES, NET_DOUBLE);
+		normalize_values(fast, HIDDEN_NODES, NET_DOUBLE | NET_FAST);
+
+		/* Loop over values */
+		for (i = 0; i < HIDDEN_NODES; i++)
+		{
+			/* Compute error */
+			err = fabs(fast[i] - exact[i]);
+
+			/* Track largest error */
+			if (err > max_err)
+			{
+				/* Save error and where it was */
+				max_err = err;
+				max_x = x[i];
+			}
+		}
+	}
+
+	/* Message */
+	printf("Fast sigmoid: largest error %.2e at %.5f\n", max_err, max_x);
+
+	/* Make typical hidden sums */
+	for (i = 0; i < HIDDEN_NODES; i++) x[i] = 16.0 * random_unit() - 8.0;
+
+	/* Loop over copying only, exact and fast normalization */
+	for (k = 0; k < 3; k++)
+	{
+		/* No time yet */
+		best[k] = 1e9;
+
+		/* Loop over runs */
+		for (j = 0; j < RUNS; j++)
+		{
+			/* Get start time */
+			start = now();
+
+			/* Normalize many sets of values */
+			for (i = 0; i < EVALS; i++)
+			{
+				/* Copy values */
+				memcpy(exact, x, sizeof(x));
+
+				/* Normalize copy */
+				if (k) normalize_values(exact, HIDDEN_NODES,
+				                        k == 2 ? NET_FAST : 0);
+			}
+
+			/* Track fastest run */
+			if (now() - start < best[k]) best[k] = now() - start;
+		}
+	}
+
+	/* Message */
+	printf("Sigmoid of %d values: exact %.2f ns, fast %.2f ns per value\n",
+	       HIDDEN_NODES,
+	       (best[1] - best[0]) * 1e9 / EVALS / HIDDEN_NODES,
+	       (best[2] - best[0]) * 1e9 / EVALS / HIDDEN_NODES);
+}
+
+/*
+ * Make a sequence of input changes, each changing "k" inputs of a
+ * position with about ACTIVE inputs set.
+ *
+ * The inputs of the network are set to the position at the start of the
+ * sequence.
+ */
+static void make_changes(net *learn, int *change, int k)
+{
+	int i, j, n;
+
+	/* Clear inputs */
+	memset(learn->input_value, 0, sizeof(int) * learn->num_inputs);
+
+	/* Set random inputs */
+	for (i = 0; i < ACTIVE; i++)
+	{
+		/* Set input */
+		learn->input_value[rand() % learn->num_inputs] = 1;
+	}
+
+	/* Loop over steps */
+	for (i = 0; i < STEPS; i++)
+	{
+		/* Loop over changes */
+		for (j = 0; j < k; j++)
+		{
+			/* Look for input to clear (or set for odd changes) */
+			do
+			{
+				/* Pick input */
+				n = rand() % learn->num_inputs;
+
+			} while (learn->input_value[n] == (j & 1));
+
+			/* Change input */
+			learn->input_value[n] = !learn->input_value[n];
+
+			/* Remember change */
+			change[i * k + j] = n;
+		}
+	}
+
+	/* Undo changes, to return to the start */
+	for (i = 0; i < STEPS * k; i++)
+	{
+		/* Change input back */
+		learn->input_value[change[i]] = !learn->input_value[change[i]];
+	}
+}
+
+/*
+ * Return the time (in microseconds) of one compute_net() call in a run,
+ * with "k" inputs changed before each call.
+ *
+ * The sequence of changes is played forward and then backward, so that
+ * positions stay typical however many calls are timed.
+ */
+static double time_run(net *learn, int *change, int k)
+{
+	double start;
+	int i, s, *c;
+
+	/* Compute from scratch */
+	reset_net(learn);
+	compute_net(learn);
+
+	/* Get start time */
+	start = now();
+
+	/* Loop over calls */
+	for (i = 0; i < EVALS; i++)
+	{
+		/* Get step of sequence */
+		s = i % (2 * STEPS);
+		if (s >= STEPS) s = 2 * STEPS - 1 - s;
+
+		/* Get changes of step */
+		c = change + s * k;
+
+		/* Loop over changes */
+		for (s = 0; s < k; s++)
+		{
+			/* Change input */
+			learn->input_value[c[s]] = !learn->input_value[c[s]];
+		}
+
+		/* Compute result */
+		compute_net(learn);
+	}
+
+	/* Return time of one call */
+	return (now() - start) * 1e6 / EVALS;
+}
+
+/*
+ * Return the time (in microseconds) of one call of a training function
+ * in a run.
+ *
+ * The network's result is computed once, and the position trained
+ * repeatedly towards alternating results.  Training does not need a
+ * current result, so this times training alone.
+ */
+static double time_train(net *learn, void (*train)(net *, double, double *))
+{
+	double start, desired[2];
+	int i;
+
+	/* Compute result */
+	compute_net(learn);
+
+	/* Get start time */
+	start = now();
+
+	/* Loop over calls */
+	for (i = 0; i < EVALS; i++)
+	{
+		/* Set desired result */
+		desired[0] = i & 1;
+		desired[1] = !desired[0];
+
+		/* Train towards it */
+		train(learn, 1.0, desired);
+	}
+
+	/* Return time of one call */
+	return (now() - start) * 1e6 / EVALS;
+}
+
+/*
+ * Time compute_net() with each precision, with and without fast
+ * normalization.
+ */
+static void bench_precision(net *learn)
+{
+	net eval;
+	int change[STEPS * 4];
+	int i, j, r;
+	double t, best;
+	char *name[3] = { "double", "float", "int8" };
+
+	/* Make sequence of changes */
+	make_changes(learn, change, 4);
+
+	/* Message */
+	printf("compute_net() with 4 inputs changed (us per call):\n");
+	printf("            exact    fast\n");
+
+	/* Clear evaluation network */
+	memset(&eval, 0, sizeof(net));
+
+	/* Loop over precisions */
+	for (i = 0; i < 3; i++)
+	{
+		/* Message */
+		printf("  %-8s", name[i]);
+
+		/* Loop over exact and fast normalization */
+		for (j = 0; j < 2; j++)
+		{
+			/* Make weights of precision */
+			quantize_net(learn, i | (j ? NET_FAST : 0));
+
+			/* Make network using them */
+			make_evaluator(&eval, learn);
+
+			/* Copy inputs */
+			memcpy(eval.input_value, learn->input_value,
+			       sizeof(int) * learn->num_inputs);
+
+			/* Loop over runs */
+			for (best = 1e9, r = 0; r < RUNS; r++)
+			{
+				/* Time run */
+				t = time_run(&eval, change, 4);
+
+				/* Track fastest run */
+				if (t < best) best = t;
+			}
+
+			/* Message */
+			printf("%7.3f ", best);
+		}
+
+		/* End line */
+		printf("\n");
+	}
+
+	/* Evaluate in full precision again */
+	quantize_net(learn, NET_DOUBLE);
+}
+
+/*
+ * Compare the kernels specialized for the AI's network shape with the
+ * generic loops, in full precision.
+ *
+ * Runs of the two alternate, so that both see the same machine load.
+ */
+static void bench_kernels(net *learn)
+{
+	int *change, k[4] = { 2, 6, 20, 60 };
+	int i, r, g;
+	double t, best[4][2];
+
+	/* Loop over numbers of changed inputs */
+	for (i = 0; i < 4; i++)
+	{
+		/* Make sequence of changes */
+		change = (int *)malloc(sizeof(int) * STEPS * k[i]);
+		make_changes(learn, change, k[i]);
+
+		/* No times yet */
+		best[i][0] = best[i][1] = 1e9;
+
+		/* Loop over runs */
+		for (r = 0; r < RUNS; r++)
+		{
+			/* Loop over fixed and generic kernels */
+			for (g = 0; g < 2; g++)
+			{
+				/* Choose kernels */
+				net_generic = g;
+
+				/* Time run */
+				t = time_run(learn, change, k[i]);
+
+				/* Track fastest run */
+				if (t < best[i][g]) best[i][g] = t;
+			}
+		}
+
+		/* Done with changes */
+		free(change);
+	}
+
+	/* Use specialized kernels again */
+	net_generic = 0;
+
+	/* Message */
+	printf("compute_net() in full precision (us per call):\n");
+	printf("  inputs changed");
+	for (i = 0; i < 4; i++) printf("%8d", k[i]);
+	printf("\n  generic       ");
+	for (i = 0; i < 4; i++) printf("%8.3f", best[i][1]);
+	printf("\n  fixed         ");
+	for (i = 0; i < 4; i++) printf("%8.3f", best[i][0]);
+	printf("\n");
+}
+
+/*
+ * Return the largest difference between the weights of two networks.
+ */
+static double weight_diff(net *a, net *b)
+{
+	double diff, max_diff = 0.0;
+	int i, j;
+
+	/* Loop over hidden weight rows */
+	for (i = 0; i < a->num_inputs + 1; i++)
+	{
+		/* Loop over weights */
+		for (j = 0; j < a->num_hidden; j++)
+		{
+			/* Compare weights */
+			diff = fabs(a->hidden_weight[i][j] -
+			            b->hidden_weight[i][j]);
+			if (diff > max_diff) max_diff = diff;
+		}
+	}
+
+	/* Loop over output weight rows */
+	for (i = 0; i < a->num_hidden + 1; i++)
+	{
+		/* Loop over weights */
+		for (j = 0; j < a->num_output; j++)
+		{
+			/* Compare weights */
+			diff = fabs(a->output_weight[i][j] -
+			            b->output_weight[i][j]);
+			if (diff > max_diff) max_diff = diff;
+		}
+	}
+
+	/* Return difference */
+	return max_diff;
+}
+
+/*
+ * Train two copies of a network through the same "n" positions, each with
+ * its own training function, and with generic loops if given.
+ *
+ * Positions follow the sequence of changes, 6 inputs at a time.
+ */
+static void train_pair(net *copy, void (**train)(net *, double, double *),
+                       int *generic, int *change, int n)
+{
+	double desired[2];
+	int i, j, g, *c;
+
+	/* Loop over positions */
+	for (i = 0; i < n; i++)
+	{
+		/* Set desired result */
+		desired[0] = i & 1;
+		desired[1] = !desired[0];
+
+		/* Get changes of position */
+		c = change + (i % STEPS) * 6;
+
+		/* Loop over copies */
+		for (g = 0; g < 2; g++)
+		{
+			/* Choose kernels */
+			net_generic = generic[g];
+
+			/* Loop over changes */
+			for (j = 0; j < 6; j++)
+			{
+				/* Change input */
+				copy[g].input_value[c[j]] =
+				                     !copy[g].input_value[c[j]];
+			}
+
+			/* Compute result and train */
+			compute_net(&copy[g]);
+			train[g](&copy[g], 1.0, desired);
+		}
+	}
+
+	/* Use specialized kernels again */
+	net_generic = 0;
+}
+
+/*
+ * Make two copies of a network's weights to train, with inputs set to
+ * the start of a sequence of changes of 6 inputs.
+ */
+static void make_pair(net *copy, net *learn, int *change)
+{
+	int g;
+
+	/* Make sequence of changes */
+	make_changes(learn, change, 6);
+
+	/* Loop over copies */
+	for (g = 0; g < 2; g++)
+	{
+		/* Make copy of weights to train */
+		make_trainer(&copy[g], learn, 1);
+
+		/* Copy inputs */
+		memcpy(copy[g].input_value, learn->input_value,
+		       sizeof(int) * learn->num_inputs);
+	}
+}
+
+/*
+ * Compare training with the specialized kernels and the generic loops.
+ *
+ * Each kernel trains its own copy of the weights through the same
+ * positions, so the copies must end up identical.
+ */
+static void bench_training(net *learn)
+{
+	net copy[2];
+	int change[STEPS * 6], generic[2] = { 0, 1 };
+	void (*train[2])(net *, double, double *) = { train_net, train_net };
+	int r, g;
+	double t, best[2] = { 1e9, 1e9 };
+
+	/* Make copies to train */
+	make_pair(copy, learn, change);
+
+	/* Train both through the same positions */
+	train_pair(copy, train, generic, change, 20000);
+
+	/* Loop over runs */
+	for (r = 0; r < RUNS; r++)
+	{
+		/* Loop over fixed and generic kernels */
+		for (g = 0; g < 2; g++)
+		{
+			/* Choose kernels */
+			net_generic = g;
+
+			/* Time run */
+			t = time_train(&copy[g], train_net);
+
+			/* Track fastest run */
+			if (t < best[g]) best[g] = t;
+		}
+	}
+
+	/* Use specialized kernels again */
+	net_generic = 0;
+
+	/* Message */
+	printf("train_net(): generic %.3f us, fixed %.3f us per call\n",
+	       best[1], best[0]);
+	printf("  weights differ by at most %g after 20000 positions\n",
+	       weight_diff(&copy[0], &copy[1]));
+}
+
+/*
+ * The train_net() of earlier versions, kept to check the current one
+ * against.
+ *
+ * This computes the softmax derivative with an exp() for every pair of
+ * outputs, changes output weights before using them for the errors of
+ * later outputs, and allocates the hidden corrections on every call.
+ */
+static void old_train_net(net *learn, double lambda, double *desired)
+{
+	int i, j, k;
+	double error, corr, deriv, hderiv;
+	double *hidden_corr;
+
+	/* Loop over output nodes */
+	for (i = 0; i < learn->num_output; i++)
+	{
+		/* Compute error */
+		error = lambda * (learn->win_prob[i] - desired[i]);
+
+		/* Output portion of partial derivatives */
+		deriv = learn->win_prob[i] * (1.0 - learn->win_prob[i]);
+
+		/* Loop over node's weights */
+		for (j = 0; j < learn->num_hidden; j++)
+		{
+			/* Compute correction */
+			corr = -error * learn->hidden_result[j] * deriv;
+
+			/* Compute hidden node's effect on output */
+			hderiv = deriv * learn->output_weight[j][i];
+
+			/* Loop over other output nodes */
+			for (k = 0; k < learn->num_output; k++)
+			{
+				/* Skip this output node */
+				if (i == k) continue;
+
+				/* Subtract this node's factor */
+				hderiv -= learn->output_weight[j][k] *
+				          exp(learn->net_result[i] +
+				              learn->net_result[k]) /
+				          (learn->prob_sum * learn->prob_sum);
+			}
+
+			/* Compute hidden node's error */
+			learn->hidden_error[j] += error * hderiv;
+
+			/* Apply correction */
+			learn->output_weight[j][i] += learn->alpha * corr;
+		}
+
+		/* Compute bias weight's correction */
+		learn->output_weight[j][i] += learn->alpha * -error * deriv;
+	}
+
+	/* Create array of hidden weight correction factors */
+	hidden_corr = (double *)malloc(sizeof(double) * learn->num_hidden);
+
+	/* Loop over hidden nodes */
+	for (i = 0; i < learn->num_hidden; i++)
+	{
+		/* Output portion of partial derivatives */
+		deriv = learn->hidden_result[i] *
+			(1.0 - learn->hidden_result[i]);
+
+		/* Calculate correction factor */
+		hidden_corr[i] = deriv * -learn->hidden_error[i] * learn->alpha;
+	}
+
+	/* Loop over inputs */
+	for (i = 0; i < learn->num_inputs + 1; i++)
+	{
+		/* Skip zero inputs */
+		if (!learn->input_value[i]) continue;
+
+		/* Loop over hidden nodes */
+		for (j = 0; j < learn->num_hidden; j++)
+		{
+			/* Adjust weight */
+			learn->hidden_weight[i][j] += hidden_corr[j];
+		}
+	}
+
+	/* Destroy hidden correction factor array */
+	free(hidden_corr);
+
+	/* Clear hidden errors */
+	memset(learn->hidden_error, 0, sizeof(double) * learn->num_hidden);
+
+	/* Forget previous inputs, since weights have changed */
+	reset_net(learn);
+}
+
+/*
+ * Compare the current train_net() with the old one.
+ *
+ * Two copies of the weights are trained through the same positions, one
+ * with each, and their weights and results compared.  The old code
+ * changes some weights before using them, so small differences are
+ * expected, growing with the number of calls.
+ */
+static void bench_old_training(net *learn)
+{
+	net copy[2];
+	int change[STEPS * 6], generic[2] = { 0, 0 };
+	void (*train[2])(net *, double, double *) = { train_net,
+	                                              old_train_net };
+	int r, g;
+	double t, best[2] = { 1e9, 1e9 };
+
+	/* Make copies to train */
+	make_pair(copy, learn, change);
+
+	/* Message */
+	printf("train_net() against the old version:\n");
+
+	/* Train through one position */
+	train_pair(copy, train, generic, change, 1);
+
+	/* Message */
+	printf("  weights differ by at most %.2e after 1 call\n",
+	       weight_diff(&copy[0], &copy[1]));
+
+	/* Train through more positions */
+	train_pair(copy, train, generic, change, 19999);
+
+	/* Compute results of last position */
+	compute_net(&copy[0]);
+	compute_net(&copy[1]);
+
+	/* Message */
+	printf("  weights differ by at most %.2e after 20000 calls,\n",
+	       weight_diff(&copy[0], &copy[1]));
+	printf("  results by %.2e\n",
+	       fabs(copy[0].win_prob[0] - copy[1].win_prob[0]));
+
+	/* Loop over runs */
+	for (r = 0; r < RUNS; r++)
+	{
+		/* Loop over current and old versions */
+		for (g = 0; g < 2; g++)
+		{
+			/* Time run */
+			t = time_train(&copy[g], train[g]);
+
+			/* Track fastest run */
+			if (t < best[g]) best[g] = t;
+		}
+	}
+
+	/* Message */
+	printf("  old %.3f us, current %.3f us per call\n", best[1], best[0]);
+}
+
+/*
+ * Run benchmarks.
+ */
+int main(int argc, char *argv[])
+{
+	net learner;
+
+	/* Make results repeatable */
+	srand(1);
+
+	/* Create network */
+	make_learner(&learner, NET_INPUT, HIDDEN_NODES, NET_OUTPUT);
+
+	/* Train at the rate the AI uses */
+	learner.alpha = 0.0001;
+
+	/* Load weights if given */
+	if (argc > 1 && map_net(&learner, argv[1], 1))
+	{
+		/* Error */
+		printf("Couldn't load %s!\n", argv[1]);
+		return 1;
+	}
+
+	/* Measure normalization */
+	bench_sigmoid();
+
+	/* Measure evaluation in each precision */
+	bench_precision(&learner);
+
+	/* Compare specialized and generic kernels */
+	bench_kernels(&learner);
+	bench_training(&learner);
+
+	/* Compare training with the old version */
+	bench_old_training(&learner);
+
+	/* Done */
+	return 0;
+}
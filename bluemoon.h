@@ -59,6 +59,12 @@
  */
 #define DECK_SIZE	31
 
+/*
+ * Stack size for a thread that searches (search frames are kept
+ * elsewhere).
+ */
+#define SEARCH_STACK (2 * 1024 * 1024)
+
 /*
  * Card icons.
  */
@@ -470,6 +476,9 @@ typedef struct card
 	/* This card is in the hand, but face-up */
 	int disclosed;
 
+	/* Chance card is in hand, as far as the opponent knows */
+	double hand_prob;
+
 } card;
 
 /*
@@ -592,6 +601,15 @@ typedef struct game
 	/* Seed used to start the game */
 	unsigned int start_seed;
 
+	/* Player whose card legality is cached */
+	int legal_turn;
+
+	/* Cards whose eligibility is known, and those that are eligible */
+	unsigned int eligible_known, eligible_ok;
+
+	/* Cards whose legality is known, and those that are allowed */
+	unsigned int allowed_known, allowed_ok;
+
 } game;
 
 
@@ -613,6 +631,7 @@ extern card *find_card(game *g, int who, design *d_ptr);
 extern void move_card(game *g, int who, design *d_ptr, int to, int faceup);
 extern design *random_card(game *g, int who, int stack);
 extern void reset_cards(game *g);
+extern void clear_legal(game *g);
 extern int retrieve_legal(game *g, card *c);
 extern void retrieve_card(game *g, design *d_ptr);
 extern int card_allowed(game *g, design *d_ptr);
@@ -643,5 +662,24 @@ extern void read_cards(void);
 extern void init_game(game *g, int first);
 
 extern void ai_assist(game *g, char *buf);
+extern void ai_debug_stats(char *buf);
+extern void ai_ponder_start(game *g);
+extern void ai_ponder_stop(void);
+extern void ai_search_control(volatile int *stop, volatile int *nodes);
+extern void ai_train_start(int local);
+extern void ai_train_merge(void);
+extern int ai_train_stop(void);
+extern int ai_threads;
+extern double ai_prune;
+extern int ai_endgame;
+extern int ai_samples;
+extern int ai_batch;
+extern int ai_precision;
+extern int ai_fast;
+extern int ai_checkpoint_games;
+extern int ai_checkpoint_mins;
+extern int ai_resume;
+extern char *ai_shard;
+extern int ai_shard_size;
 
 extern void message_add(char *msg);
@@ -37,13 +37,13 @@ int main(int argc, char *argv[])
 
 	srand(time(NULL));
 
-	make_learner(&learner, 443, 50, 2);
+	make_learner(&learner, NET_INPUT, HIDDEN_NODES, NET_OUTPUT);
 
 	learner.alpha = 0.1;
 
-	load_net(&learner, argv[1]);
+	map_net(&learner, argv[1], 1);
 
-	for (i = 0; i < 443; i++) learner.input_value[i] = 0;
+	for (i = 0; i < NET_INPUT; i++) learner.input_value[i] = 0;
 
 	/* Set "game over" input */
 	learner.input_value[271] = 1;
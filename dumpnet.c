@@ -96,13 +96,13 @@ int main(int argc, char *argv[])
 
 	read_cards();
 
-	make_learner(&learner, 443, 50, 2);
+	make_learner(&learner, NET_INPUT, HIDDEN_NODES, NET_OUTPUT);
 
-	load_net(&learner, argv[1]);
+	map_net(&learner, argv[1], 0);
 
 	for (i = 0; i < 9; i++) if (strstr(argv[1], peoples[i].name)) peep[n++] = peoples[i];
 
-	for (i = 0; i < 443; i++) learner.input_value[i] = 0;
+	for (i = 0; i < NET_INPUT; i++) learner.input_value[i] = 0;
 
 	compute_net(&learner);
 
@@ -110,7 +110,7 @@ int main(int argc, char *argv[])
 
 	start = learner.win_prob[who];
 
-	for (i = 0; i < 443; i++)
+	for (i = 0; i < NET_INPUT; i++)
 	{
 		learner.input_value[i] = 1;
 
@@ -126,6 +126,19 @@ void deactivate_card(card *c)
 	c->used = 0;
 }
 
+/*
+ * Forget cached card legality.
+ *
+ * This must be called whenever anything "card_allowed()" or
+ * "card_eligible()" depend on changes.
+ */
+void clear_legal(game *g)
+{
+	/* Nothing is known */
+	g->eligible_known = 0;
+	g->allowed_known = 0;
+}
+
 /*
  * Check if draw pile is empty and all cards in discard pile are known to
  * be there.  If this is true, then all cards in the hand will also be known.
@@ -169,6 +182,84 @@ static void check_all_known(game *g, int who)
 	}
 }
 
+/*
+ * Update the opponent's belief about where a player's unknown cards are.
+ *
+ * Known cards are simply where they are.  Unknown cards in the hand or draw
+ * pile keep the chance they had of being in hand, scaled so that the chances
+ * add up to the number of unknown cards in hand.  A card drawn face-down thus
+ * raises the chance of every unknown card in the draw pile equally, and a
+ * card revealed from the hand lowers the chance of the rest.
+ */
+static void update_belief(game *g, int who)
+{
+	player *p;
+	card *c;
+	double sum = 0, scale;
+	int i, n = 0, hand = 0;
+
+	/* Get player pointer */
+	p = &g->p[who];
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Check for known location */
+		if (c->loc_known)
+		{
+			/* Card is in hand only if it is there */
+			c->hand_prob = c->where == LOC_HAND;
+			continue;
+		}
+
+		/* Skip cards not in hand or draw pile */
+		if (c->where != LOC_HAND && c->where != LOC_DRAW) continue;
+
+		/* Count unknown cards */
+		n++;
+
+		/* Count unknown cards in hand */
+		if (c->where == LOC_HAND) hand++;
+
+		/* Add chance of being in hand */
+		sum += c->hand_prob;
+	}
+
+	/* Check for chances adding up already */
+	if (sum == hand) return;
+
+	/* Loop over cards */
+	for (i = 1; i < DECK_SIZE; i++)
+	{
+		/* Get card pointer */
+		c = &p->deck[i];
+
+		/* Skip known cards */
+		if (c->loc_known) continue;
+
+		/* Skip cards not in hand or draw pile */
+		if (c->where != LOC_HAND && c->where != LOC_DRAW) continue;
+
+		/* Check for too many cards believed in hand */
+		if (sum > hand)
+		{
+			/* Reduce chance of being in hand */
+			c->hand_prob *= hand / sum;
+		}
+		else
+		{
+			/* Get scale for chance of being in draw pile */
+			scale = (n - hand) / (n - sum);
+
+			/* Reduce chance of being in draw pile */
+			c->hand_prob = 1 - (1 - c->hand_prob) * scale;
+		}
+	}
+}
+
 /*
  * Check if any "random_fake" flags can be removed from cards.
  */
@@ -343,6 +434,12 @@ void move_card(game *g, int who, design *d_ptr, int to, int faceup)
 
 	/* Check for removable fake flags */
 	remove_fake(g, who);
+
+	/* Update opponent's belief about unknown cards */
+	update_belief(g, who);
+
+	/* Card legality may have changed */
+	clear_legal(g);
 }
 
 /*
@@ -1162,6 +1259,9 @@ void notice_effect_1(game *g)
 		/* Remove card from list */
 		list[b_i] = list[--num];
 	}
+
+	/* Card legality may have changed */
+	clear_legal(g);
 }
 
 /*
@@ -1424,6 +1524,9 @@ void retrieve_card(game *g, design *d_ptr)
 	/* Card's location in hand is known */
 	c->loc_known = 1;
 
+	/* Update opponent's belief about unknown cards */
+	update_belief(g, g->turn);
+
 	/* Take notice of affected special texts */
 	notice_effect_1(g);
 }
@@ -1655,7 +1758,7 @@ static int card_text_matches(game *g, design *d_ptr)
  *
  * FREE, PAIR, and GANG icons affect this.
  */
-int card_allowed(game *g, design *d_ptr)
+static int check_allowed(game *g, design *d_ptr)
 {
 	player *p, *opp;
 	card *c;
@@ -2064,7 +2167,7 @@ int card_allowed(game *g, design *d_ptr)
  * needs to be on a landed ship.  Of course there are special power texts
  * that cause exceptions.
  */
-int card_eligible(game *g, design *d_ptr)
+static int check_eligible(game *g, design *d_ptr)
 {
 	player *p;
 	card *c, *playing;
@@ -2128,6 +2231,100 @@ int card_eligible(game *g, design *d_ptr)
 	return 0;
 }
 
+/*
+ * Return the bit for a card of the current player in the legality cache.
+ *
+ * The cache is cleared if it was filled for the other player.
+ */
+static unsigned int legal_bit(game *g, design *d_ptr)
+{
+	card *c;
+
+	/* Check for results belonging to other player */
+	if (g->legal_turn != g->turn)
+	{
+		/* Forget other player's results */
+		clear_legal(g);
+
+		/* Results now belong to current player */
+		g->legal_turn = g->turn;
+	}
+
+	/* Find card */
+	c = find_card(g, g->turn, d_ptr);
+
+	/* Return bit for card's position in deck */
+	return 1U << (c - g->p[g->turn].deck);
+}
+
+/*
+ * Return true if a given card design can be played.
+ *
+ * Results are remembered until the game state changes.
+ */
+int card_allowed(game *g, design *d_ptr)
+{
+	unsigned int bit;
+
+	/* Get card's cache bit */
+	bit = legal_bit(g, d_ptr);
+
+	/* Check for known result */
+	if (g->allowed_known & bit) return (g->allowed_ok & bit) != 0;
+
+	/* Check legality (this may clear the cache) */
+	if (check_allowed(g, d_ptr))
+	{
+		/* Remember card is allowed */
+		g->allowed_ok |= bit;
+	}
+	else
+	{
+		/* Remember card is not allowed */
+		g->allowed_ok &= ~bit;
+	}
+
+	/* Result is known */
+	g->allowed_known |= bit;
+
+	/* Return result */
+	return (g->allowed_ok & bit) != 0;
+}
+
+/*
+ * Return true if the given card is eligible to be played.
+ *
+ * Results are remembered until the game state changes.
+ */
+int card_eligible(game *g, design *d_ptr)
+{
+	unsigned int bit;
+
+	/* Get card's cache bit */
+	bit = legal_bit(g, d_ptr);
+
+	/* Check for known result */
+	if (g->eligible_known & bit) return (g->eligible_ok & bit) != 0;
+
+	/* Check eligibility */
+	if (check_eligible(g, d_ptr))
+	{
+		/* Remember card is eligible */
+		g->eligible_ok |= bit;
+	}
+	else
+	{
+		/* Remember card is not eligible */
+		g->eligible_ok &= ~bit;
+	}
+
+	/* Result is known */
+	g->eligible_known |= bit;
+
+	/* Return result */
+	return (g->eligible_ok & bit) != 0;
+}
+
 /*
  * Return true if we can play an additional "support" card.
  *
@@ -2796,6 +2993,9 @@ static int load_callback(game *g, int who, design **list, int num, void *data)
 
 		/* Clear "recent" flag */
 		c->recent = 0;
+
+		/* Card legality may have changed */
+		clear_legal(g);
 	}
 
 	/* Success */
@@ -2826,6 +3026,9 @@ static int favor2_callback(game *g, int who, design **list, int num, void *data)
 	/* Clear "recent" flag */
 	c->recent = 0;
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Choice is valid */
 	return 1;
 }
@@ -3623,6 +3826,9 @@ static void handle_effect_4(game *g, card *c_ptr, int time)
 		/* No need to do anything but mark character as played */
 		p->char_played = 1;
 
+		/* Card legality may have changed */
+		clear_legal(g);
+
 		/* Done */
 		return;
 	}
@@ -3926,6 +4132,9 @@ static void handle_effect_8(game *g, card *c_ptr, int time)
 			c->loc_known = 1;
 		}
 
+		/* Update our belief about opponent's cards */
+		update_belief(g, !g->turn);
+
 		/* Have AI reevaluate options */
 		g->random_event = 1;
 
@@ -4058,6 +4267,9 @@ void play_card(game *g, design *d_ptr, int no_effect, int check)
 		break;
 	}
 
+	/* Update opponent's belief about unknown cards */
+	update_belief(g, g->turn);
+
 	/* Check for first to run out of cards */
 	if (p->stack[LOC_HAND] + p->stack[LOC_DRAW] == 0)
 	{
@@ -4344,6 +4556,9 @@ void play_card(game *g, design *d_ptr, int no_effect, int check)
 		    d_ptr->type == TYPE_BOOSTER) c->used = 1;
 	}
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Check special text targets and possibly ask to disambiguate */
 	check_targets(g, g->turn, check);
 }
@@ -4481,6 +4696,9 @@ void play_bluff(game *g, design *d_ptr)
 		if (c->d_ptr->special_effect & S7_PLAY_SUPPORT) c->used = 1;
 	}
 
+	/* Update opponent's belief about unknown cards */
+	update_belief(g, g->turn);
+
 	/* Notice special texts */
 	notice_effect_1(g);
 }
@@ -4660,6 +4878,9 @@ void load_card(game *g, design *d_ptr, design *ship_dptr)
 	/* Card was recently played */
 	c->recent = 1;
 
+	/* Update opponent's belief about unknown cards */
+	update_belief(g, g->turn);
+
 	/* Check for running out of cards */
 	if (p->stack[LOC_HAND] + p->stack[LOC_DRAW] == 0)
 	{
@@ -4699,6 +4920,9 @@ void land_ship(game *g, design *d_ptr)
 
 	/* Land ship */
 	c->landed = 1;
+
+	/* Card legality may have changed */
+	clear_legal(g);
 }
 
 /*
@@ -4821,6 +5045,9 @@ void use_special(game *g, design *d_ptr)
 	/* Card is used */
 	c->used = 1;
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Check for category 4 effect */
 	if (d_ptr->special_cat == 4)
 	{
@@ -4992,6 +5219,9 @@ static int satisfy_callback(game *g, int who, design **list, int num,
 	/* Mark card as satisfied */
 	c->used = 1;
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Success */
 	return 2;
 }
@@ -5281,6 +5511,9 @@ void start_turn(game *g)
 		c->used = 0;
 	}
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Look for active storm cards */
 	for (i = 1; i < DECK_SIZE; i++)
 	{
@@ -5336,6 +5569,9 @@ void game_over(game *g)
 	/* End any fight in progress */
 	g->fight_started = 0;
 
+	/* Card legality may have changed */
+	clear_legal(g);
+
 	/* Set game over flag */
 	g->game_over = 1;
 
@@ -5385,6 +5621,9 @@ void attract_dragon(game *g, int who)
 		/* Remove a dragon */
 		g->p[!who].dragons--;
 
+		/* Card legality may have changed */
+		clear_legal(g);
+
 		/* Done */
 		return;
 	}
@@ -5404,6 +5643,9 @@ void attract_dragon(game *g, int who)
 
 	/* Add a dragon to us */
 	g->p[who].dragons++;
+
+	/* Card legality may have changed */
+	clear_legal(g);
 }
 
 /*
@@ -5642,6 +5884,9 @@ void retreat(game *g)
 
 		/* Ship is no longer landed */
 		c->landed = 0;
+
+		/* Card legality may have changed */
+		clear_legal(g);
 	}
 
 	/* Check for fight started */
@@ -5733,6 +5978,9 @@ void retreat(game *g)
 		/* Clear fight started flag */
 		g->fight_started = 0;
 
+		/* Card legality may have changed */
+		clear_legal(g);
+
 		/* Retreating player plays again, but at beginning */
 		p->phase = PHASE_START;
 
@@ -5986,6 +6234,9 @@ void end_support(game *g)
 
 		/* Ship is no longer landed */
 		c->landed = 0;
+
+		/* Card legality may have changed */
+		clear_legal(g);
 	}
 
 	/* Check special text targets (and ask if necessary) */
@@ -6110,6 +6361,9 @@ void end_turn(game *g)
 		/* Card was no longer played recently */
 		c->recent = 0;
 
+		/* Card legality may have changed */
+		clear_legal(g);
+
 		/* Skip inactive cards */
 		if (!c->active) continue;
 
@@ -88,6 +88,8 @@ static GtkWidget *choose_dialog, *choose_ok;
 static GtkWidget *choice_area;
 static GtkWidget *our_frame, *opp_frame;
 static GtkWidget *popup_menu;
+static GtkWidget *progress_bar, *move_button;
+static GtkWidget *new_item, *select_item, *debug_item, *assist_item;
 
 /*
  * Card design we have a popup menu for.
@@ -105,6 +107,88 @@ static void *choice_data;
 static choose_result choice_callback;
 static game *choice_game;
 
+/*
+ * Main (GTK) thread, and thread making AI decisions.
+ */
+static GThread *main_thread, *ai_thread;
+
+/*
+ * Lock and condition used to pass work between threads.
+ */
+static GMutex *ai_mutex;
+static GCond *ai_cond;
+
+/*
+ * Copy of the game the AI thread works on.
+ */
+static game ai_game;
+
+/*
+ * Kinds of work for the AI thread.
+ */
+#define AI_JOB_ACTION   1
+#define AI_JOB_ANNOUNCE 2
+
+/*
+ * Work waiting for the AI thread (zero for none).
+ */
+static int ai_job;
+
+/*
+ * Element we are announcing, for the AI thread to finish announcing.
+ */
+static int ai_element;
+
+/*
+ * AI is taking its turn.
+ */
+static int ai_busy;
+
+/*
+ * Ask AI to move using the best path found so far.
+ */
+static volatile int ai_move_now;
+
+/*
+ * Positions searched by the AI this turn.
+ */
+static volatile int ai_nodes;
+
+/*
+ * Timer updating the progress bar.
+ */
+static guint progress_timer;
+
+/*
+ * Request from the AI thread to be run on the main thread.
+ */
+static void (*main_func)(void *arg);
+static void *main_arg;
+static int main_done;
+
+/*
+ * Arguments of a choice to be made by the user for the AI thread.
+ */
+typedef struct choose_request
+{
+	game *g;
+	int chooser, who;
+	design **choices;
+	int num_choices, min, max;
+	choose_result callback;
+	void *data;
+	char *prompt;
+} choose_request;
+
+/*
+ * Arguments and result of a bluff decision made for the AI thread.
+ */
+typedef struct bluff_request
+{
+	game *g;
+	int call;
+} bluff_request;
+
 /*
  * Text buffer for message area.
  */
@@ -122,6 +206,24 @@ static void redraw_hand(void);
 static void redraw_table(void);
 static void redraw_status(void);
 static void redraw_choice(void);
+static void choose_main(void *arg);
+static gboolean ai_done(gpointer data);
+static void bluff_main(void *arg);
+
+/*
+ * Add a message passed from the AI thread.
+ */
+static gboolean message_idle(gpointer data)
+{
+	/* Add message */
+	message_add((char *)data);
+
+	/* Free copy of message */
+	g_free(data);
+
+	/* Do not call again */
+	return FALSE;
+}
 
 /*
  * Add text to the message buffer.
@@ -132,6 +234,16 @@ void message_add(char *msg)
 	GtkTextBuffer *message_buffer;
 	GtkWidget *dialog;
 
+	/* Check for message from AI thread */
+	if (main_thread && g_thread_self() != main_thread)
+	{
+		/* Have main thread add a copy of the message */
+		g_idle_add(message_idle, g_strdup(msg));
+
+		/* Done */
+		return;
+	}
+
 	/* Check for uninitialized GUI */
 	if (!message_view)
 	{
@@ -321,6 +433,24 @@ static gboolean card_revealed(GtkWidget *widget, GdkEventButton *event,
 	return TRUE;
 }
 
+/*
+ * Let the AI think ahead while we take our turn.
+ */
+static void start_ponder(void)
+{
+	/* Check for game over or not our turn */
+	if (real_game.game_over || real_game.turn != player_us) return;
+
+	/* Check for human opponent */
+	if (real_game.p[!player_us].control != &ai_func) return;
+
+	/* Do not disturb a decision the AI is making now */
+	if (ai_busy) return;
+
+	/* Start AI thinking (unless it already is about this position) */
+	ai_ponder_start(&real_game);
+}
+
 /*
  * Set the sensitivity of the retreat and announce buttons.
  */
@@ -403,6 +533,9 @@ static void set_buttons(void)
 	gtk_widget_set_sensitive(retreat_button, retreat);
 	gtk_widget_set_sensitive(fire_button, fire);
 	gtk_widget_set_sensitive(earth_button, earth);
+
+	/* Let AI think about our possible announcements */
+	start_ponder();
 }
 
 /*
@@ -1533,35 +1666,244 @@ static void redraw_status(void)
 }
 
 /*
- * After our turn, let the AI take actions until it is our turn again,
- * then refresh the drawing areas so that we can take our next turn.
+ * Run a request from the AI thread.
  */
-static void handle_end_turn(void)
+static gboolean main_request(gpointer data)
 {
-	/* Deactivate "retreat" button */
-	gtk_widget_set_sensitive(retreat_button, FALSE);
+	/* Show the game as the AI thread sees it */
+	real_game = ai_game;
 
-	/* Deactivate "undo" button */
-	gtk_widget_set_sensitive(undo_button, FALSE);
+	/* Run request */
+	main_func(main_arg);
 
-	/* Deactivate "announce" buttons */
-	gtk_widget_set_sensitive(fire_button, FALSE);
-	gtk_widget_set_sensitive(earth_button, FALSE);
+	/* Acquire lock */
+	g_mutex_lock(ai_mutex);
 
-	/* Have AI take actions until it is our turn */
-	while (real_game.turn != player_us && !real_game.game_over)
+	/* Request is done */
+	main_done = 1;
+
+	/* Wake AI thread */
+	g_cond_broadcast(ai_cond);
+
+	/* Release lock */
+	g_mutex_unlock(ai_mutex);
+
+	/* Do not call again */
+	return FALSE;
+}
+
+/*
+ * Have the main thread run the given function and wait for it to finish.
+ *
+ * This is used when the AI thread needs input from the user.
+ */
+static void run_in_main(void (*func)(void *arg), void *arg)
+{
+	/* Acquire lock */
+	g_mutex_lock(ai_mutex);
+
+	/* Save request */
+	main_func = func;
+	main_arg = arg;
+	main_done = 0;
+
+	/* Have main thread run request */
+	g_idle_add(main_request, NULL);
+
+	/* Wait for request to finish */
+	while (!main_done) g_cond_wait(ai_cond, ai_mutex);
+
+	/* Release lock */
+	g_mutex_unlock(ai_mutex);
+}
+
+/*
+ * Update the AI progress bar.
+ */
+static gboolean update_progress(gpointer data)
+{
+	char buf[1024];
+
+	/* Check for AI finished */
+	if (!ai_busy)
 	{
-		/* Request action from AI */
-		real_game.p[real_game.turn].control->take_action(&real_game);
+		/* Clear progress bar */
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(progress_bar), 0);
+		gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), "");
 
-		/* Redraw everything */
-		redraw_table();
-		redraw_hand();
-		redraw_status();
+		/* Timer stopped */
+		progress_timer = 0;
+
+		/* Do not call again */
+		return FALSE;
+	}
+
+	/* Make progress text */
+	sprintf(buf, _("Thinking... %d positions"), ai_nodes);
+
+	/* Set progress text */
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(progress_bar), buf);
+
+	/* Show activity */
+	gtk_progress_bar_pulse(GTK_PROGRESS_BAR(progress_bar));
+
+	/* Call again */
+	return TRUE;
+}
+
+/*
+ * Note whether the AI is taking its turn.
+ */
+static void set_ai_busy(int busy)
+{
+	/* Save state */
+	ai_busy = busy;
+
+	/* "Move now" is only useful while AI is thinking */
+	gtk_widget_set_sensitive(move_button, busy);
+
+	/* Do not change the game while the AI is thinking */
+	gtk_widget_set_sensitive(new_item, !busy);
+	gtk_widget_set_sensitive(select_item, !busy);
+	gtk_widget_set_sensitive(debug_item, !busy);
+	gtk_widget_set_sensitive(assist_item, !busy);
 
-		/* Loop until all GTK events are handled */
-		while (g_main_context_iteration(NULL, FALSE));
+	/* Start progress timer if needed */
+	if (busy && !progress_timer)
+	{
+		/* Update progress bar regularly */
+		progress_timer = g_timeout_add(50, update_progress, NULL);
 	}
+}
+
+/*
+ * Finish our announcement of power.
+ *
+ * This is run by the AI thread, since the AI may search whether to call
+ * our bluff.
+ */
+static void finish_announce(game *g, int element)
+{
+	int old_turn = g->turn;
+
+	/* Handle end of support phase */
+	end_support(g);
+
+	/* Announce power */
+	announce_power(g, element);
+
+	/* Check for end of fight due to forced retreat */
+	if (!g->fight_started) return;
+
+	/* Refresh hand */
+	refresh_phase(g);
+
+	/* End turn */
+	end_turn(g);
+
+	/* Check for change of turn due to forced retreat */
+	if (g->turn != old_turn) return;
+
+	/* Turn over */
+	g->p[player_us].phase = PHASE_NONE;
+
+	/* Go to next player */
+	g->turn = !g->turn;
+
+	/* Start next player's turn */
+	g->p[g->turn].phase = PHASE_START;
+}
+
+/*
+ * Make AI decisions handed to us by the main thread.
+ */
+static gpointer ai_worker(gpointer data)
+{
+	int job;
+
+	/* Let our searches be cut short and report progress */
+	ai_search_control(&ai_move_now, &ai_nodes);
+
+	/* Loop forever */
+	while (1)
+	{
+		/* Acquire lock */
+		g_mutex_lock(ai_mutex);
+
+		/* Wait for decision to make */
+		while (!ai_job) g_cond_wait(ai_cond, ai_mutex);
+
+		/* Remember kind of work */
+		job = ai_job;
+
+		/* Decision taken */
+		ai_job = 0;
+
+		/* Release lock */
+		g_mutex_unlock(ai_mutex);
+
+		/* Check for our announcement to finish */
+		if (job == AI_JOB_ANNOUNCE)
+		{
+			/* Announce power (AI may decide to call our bluff) */
+			finish_announce(&ai_game, ai_element);
+		}
+		else
+		{
+			/* Request action from AI */
+			ai_game.p[ai_game.turn].control->take_action(&ai_game);
+		}
+
+		/* Have main thread apply the result */
+		g_idle_add(ai_done, GINT_TO_POINTER(job));
+	}
+
+	/* Never reached */
+	return NULL;
+}
+
+/*
+ * Hand work to the AI thread.
+ */
+static void ai_start_job(int job)
+{
+	/* Give AI thread a copy of the game */
+	ai_game = real_game;
+
+	/* Think normally */
+	ai_move_now = 0;
+
+	/* Acquire lock */
+	g_mutex_lock(ai_mutex);
+
+	/* Ask for decision */
+	ai_job = job;
+
+	/* Wake AI thread */
+	g_cond_broadcast(ai_cond);
+
+	/* Release lock */
+	g_mutex_unlock(ai_mutex);
+}
+
+/*
+ * Hand the next AI decision to the AI thread, or set up for our turn
+ * once the AI is done.
+ */
+static void ai_continue(void)
+{
+	/* Check for AI still taking actions */
+	if (real_game.turn != player_us && !real_game.game_over)
+	{
+		/* Ask AI thread for next action */
+		ai_start_job(AI_JOB_ACTION);
+
+		/* Done */
+		return;
+	}
+
+	/* AI is done */
+	set_ai_busy(0);
 
 	/* No undo available */
 	backup_set = 0;
@@ -1579,6 +1921,97 @@ static void handle_end_turn(void)
 	redraw_table();
 	redraw_hand();
 	redraw_status();
+
+	/* Let AI think while we take our turn */
+	start_ponder();
+}
+
+/*
+ * Apply a decision made by the AI thread.
+ */
+static gboolean ai_done(gpointer data)
+{
+	int job = GPOINTER_TO_INT(data);
+
+	/* Copy game back */
+	real_game = ai_game;
+
+	/* Check for finished announcement */
+	if (job == AI_JOB_ANNOUNCE)
+	{
+		/* Let our cards be used again */
+		gtk_widget_set_sensitive(hand_area, TRUE);
+		gtk_widget_set_sensitive(our_area, TRUE);
+
+		/* Check for our turn continuing after opponent's retreat */
+		if (real_game.turn == player_us)
+		{
+			/* AI is done */
+			set_ai_busy(0);
+
+			/* Undo is available again if it was before */
+			gtk_widget_set_sensitive(undo_button, backup_set);
+
+			/* Redraw everything */
+			redraw_table();
+			redraw_hand();
+			redraw_status();
+
+			/* Set retreat and announce buttons */
+			set_buttons();
+
+			/* Do not call again */
+			return FALSE;
+		}
+	}
+
+	/* Redraw everything */
+	redraw_table();
+	redraw_hand();
+	redraw_status();
+
+	/* Continue with next decision */
+	ai_continue();
+
+	/* Do not call again */
+	return FALSE;
+}
+
+/*
+ * After our turn, let the AI take actions until it is our turn again,
+ * then refresh the drawing areas so that we can take our next turn.
+ *
+ * The AI thinks in its own thread, so this returns at once.
+ */
+static void handle_end_turn(void)
+{
+	/* Deactivate "retreat" button */
+	gtk_widget_set_sensitive(retreat_button, FALSE);
+
+	/* Deactivate "undo" button */
+	gtk_widget_set_sensitive(undo_button, FALSE);
+
+	/* Deactivate "announce" buttons */
+	gtk_widget_set_sensitive(fire_button, FALSE);
+	gtk_widget_set_sensitive(earth_button, FALSE);
+
+	/* No positions searched yet */
+	ai_nodes = 0;
+
+	/* AI is thinking */
+	set_ai_busy(1);
+
+	/* Have AI take actions until it is our turn */
+	ai_continue();
+}
+
+/*
+ * Handle press of the "move now" button.
+ */
+static void move_now_clicked(GtkButton *button, gpointer data)
+{
+	/* Ask AI to use best path found so far */
+	ai_move_now = 1;
 }
 
 /*
@@ -1628,54 +2061,31 @@ static void undo_clicked(GtkButton *button, gpointer data)
  */
 static void announce_clicked(GtkButton *button, gpointer data)
 {
-	int element = GPOINTER_TO_INT(data);
-	int old_turn = real_game.turn;
-
-	/* Handle end of support phase */
-	end_support(&real_game);
-
-	/* Announce power */
-	announce_power(&real_game, element);
-
-	/* Check for end of fight due to forced retreat */
-	if (!real_game.fight_started)
-	{
-		/* Redraw everything */
-		redraw_hand();
-		redraw_table();
-		redraw_status();
-
-		/* Done */
-		return;
-	}
+	/* Deactivate "retreat" button */
+	gtk_widget_set_sensitive(retreat_button, FALSE);
 
-	/* Refresh hand */
-	refresh_phase(&real_game);
+	/* Deactivate "undo" button */
+	gtk_widget_set_sensitive(undo_button, FALSE);
 
-	/* End turn */
-	end_turn(&real_game);
+	/* Deactivate "announce" buttons */
+	gtk_widget_set_sensitive(fire_button, FALSE);
+	gtk_widget_set_sensitive(earth_button, FALSE);
 
-	/* Check for change of turn due to forced retreat */
-	if (real_game.turn != old_turn)
-	{
-		/* Let AI take turn */
-		handle_end_turn();
+	/* Do not let our cards be used until the announcement is done */
+	gtk_widget_set_sensitive(hand_area, FALSE);
+	gtk_widget_set_sensitive(our_area, FALSE);
 
-		/* Done */
-		return;
-	}
+	/* No positions searched yet */
+	ai_nodes = 0;
 
-	/* Turn over */
-	real_game.p[player_us].phase = PHASE_NONE;
+	/* AI may be thinking about calling our bluff */
+	set_ai_busy(1);
 
-	/* Go to next player */
-	real_game.turn = !real_game.turn;
+	/* Save element */
+	ai_element = GPOINTER_TO_INT(data);
 
-	/* Start next player's turn */
-	real_game.p[real_game.turn].phase = PHASE_START;
-
-	/* Let AI take turn */
-	handle_end_turn();
+	/* Have AI thread finish the announcement */
+	ai_start_job(AI_JOB_ANNOUNCE);
 }
 
 /*
@@ -1856,6 +2266,7 @@ static void gui_choose(game *g, int chooser, int who, design **choices,
 	GtkWidget *prompt_label, *minmax_label;
 	char minmax[1024];
 	design *chosen[DECK_SIZE];
+	choose_request r;
 	int i, n = 0;
 
 	/* Check for no real choice */
@@ -1870,6 +2281,28 @@ static void gui_choose(game *g, int chooser, int who, design **choices,
 
 	/* Check for simulated choice */
 	if (g->simulation) return;
+
+	/* Check for choice needed by AI thread */
+	if (g_thread_self() != main_thread)
+	{
+		/* Save arguments */
+		r.g = g;
+		r.chooser = chooser;
+		r.who = who;
+		r.choices = choices;
+		r.num_choices = num_choices;
+		r.min = min;
+		r.max = max;
+		r.callback = callback;
+		r.data = data;
+		r.prompt = prompt;
+
+		/* Have main thread ask user */
+		run_in_main(choose_main, &r);
+
+		/* Done */
+		return;
+	}
 	
 	/* Redraw everything */
 	redraw_table();
@@ -1989,14 +2422,40 @@ static void gui_choose(game *g, int chooser, int who, design **choices,
 	g->random_event = 1;
 }
 
+/*
+ * Ask the user to make a choice for the AI thread.
+ */
+static void choose_main(void *arg)
+{
+	choose_request *r = (choose_request *)arg;
+
+	/* Ask user */
+	gui_choose(r->g, r->chooser, r->who, r->choices, r->num_choices,
+	           r->min, r->max, r->callback, r->data, r->prompt);
+}
+
 /*
  * Ask the user to choose whether to call the opponent's bluff or not.
  */
 static int gui_call_bluff(struct game *g)
 {
 	GtkWidget *bluff_dialog, *label;
+	bluff_request r;
 	int response;
 
+	/* Check for decision needed by AI thread */
+	if (g_thread_self() != main_thread)
+	{
+		/* Save game */
+		r.g = g;
+
+		/* Have main thread ask user */
+		run_in_main(bluff_main, &r);
+
+		/* Return answer */
+		return r.call;
+	}
+
 	/* Redraw stuff */
 	redraw_table();
 	redraw_hand();
@@ -2031,6 +2490,17 @@ static int gui_call_bluff(struct game *g)
 	return 0;
 }
 
+/*
+ * Ask the user whether to call a bluff for the AI thread.
+ */
+static void bluff_main(void *arg)
+{
+	bluff_request *r = (bluff_request *)arg;
+
+	/* Ask user */
+	r->call = gui_call_bluff(r->g);
+}
+
 static interface gui_func =
 {
 	NULL,
@@ -2331,7 +2801,7 @@ static void select_matchup(GtkMenuItem *menu_item, gpointer data)
 static void dump_debug(GtkMenuItem *menu_item, gpointer data)
 {
 	GtkWidget *dialog, *disclose;
-	GtkWidget *label;
+	GtkWidget *label, *stats_label;
 	player *p;
 	card *c;
 	int i;
@@ -2348,11 +2818,25 @@ static void dump_debug(GtkMenuItem *menu_item, gpointer data)
 	/* Create label with game start seed */
 	label = gtk_label_new(buf);
 
+	/* Get statistics of AI's last decision */
+	ai_debug_stats(buf);
+
+	/* Create label with statistics */
+	stats_label = gtk_label_new(buf);
+
+	/* Allow long statistics report to wrap */
+	gtk_label_set_line_wrap(GTK_LABEL(stats_label), TRUE);
+
+	/* Allow statistics to be copied */
+	gtk_label_set_selectable(GTK_LABEL(stats_label), TRUE);
+
 	/* Create checkbox for disclosing opponent's cards */
 	disclose = gtk_check_button_new_with_label(_("Disclose opponent hand"));
 
 	/* Pack widgets into dialog box */
 	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), label);
+	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox),
+	                  stats_label);
 	gtk_container_add(GTK_CONTAINER(GTK_DIALOG(dialog)->vbox), disclose);
 
 	/* Show everything */
@@ -2467,13 +2951,12 @@ int main(int argc, char *argv[])
 	GtkWidget *left_vbox;
 	GtkWidget *right_vbox;
 	GtkWidget *v_sep, *h_sep;
-	GtkWidget *b_box1, *b_box2;
+	GtkWidget *b_box1, *b_box2, *b_box3;
 	GtkWidget *msg_scroll;
 	GtkWidget *opp_view, *our_view, *opp_hand_view;
 	GtkWidget *game_item, *game_menu;
 	GtkWidget *help_item, *help_menu;
-	GtkWidget *new_item, *select_item, *debug_item;
-	GtkWidget *assist_item, *quit_item;
+	GtkWidget *quit_item;
 	GtkWidget *about_item;
 	GtkWidget *menu_bar;
 	GtkTextIter end_iter;
@@ -2483,6 +2966,9 @@ int main(int argc, char *argv[])
 	/* Set random seed */
 	real_game.random_seed = time(NULL);
 
+	/* Initialize thread support */
+	if (!g_thread_supported()) g_thread_init(NULL);
+
 	/* Parse GTK options */
 	gtk_init(&argc, &argv);
 
@@ -2499,6 +2985,11 @@ int main(int argc, char *argv[])
 	/* Load card designs */
 	read_cards();
 
+#ifdef _SC_NPROCESSORS_ONLN
+	/* Use a thread per processor when evaluating AI choices */
+	ai_threads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
 	/* Set people */
 	human_people = 0;
 	ai_people = 1;
@@ -2547,6 +3038,18 @@ int main(int argc, char *argv[])
 	/* Set people pointers */
 	set_people();
 
+	/* Remember main thread */
+	main_thread = g_thread_self();
+
+	/* Create lock and condition shared with AI thread */
+	ai_mutex = g_mutex_new();
+	ai_cond = g_cond_new();
+
+	/* Create AI thread with room for deep searches */
+	ai_thread = g_thread_create_full(ai_worker, NULL, SEARCH_STACK,
+	                                 FALSE, FALSE,
+	                                 G_THREAD_PRIORITY_NORMAL, NULL);
+
 	/* Create toplevel window */
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
 
@@ -2660,6 +3163,10 @@ int main(int argc, char *argv[])
 	fire_button = gtk_button_new_with_label(_("Announce Fire"));
 	earth_button = gtk_button_new_with_label(_("Announce Earth"));
 	undo_button = gtk_button_new_with_label(_("Undo Turn"));
+	move_button = gtk_button_new_with_label(_("Move Now"));
+
+	/* Create AI progress bar */
+	progress_bar = gtk_progress_bar_new();
 
 	/* Attach events */
 	g_signal_connect(G_OBJECT(retreat_button), "clicked",
@@ -2670,16 +3177,21 @@ int main(int argc, char *argv[])
 	                 G_CALLBACK(announce_clicked), GINT_TO_POINTER(1));
 	g_signal_connect(G_OBJECT(undo_button), "clicked",
 	                 G_CALLBACK(undo_clicked), NULL);
+	g_signal_connect(G_OBJECT(move_button), "clicked",
+	                 G_CALLBACK(move_now_clicked), NULL);
 
 	/* Create boxes for buttons */
 	b_box1 = gtk_hbox_new(FALSE, 0);
 	b_box2 = gtk_hbox_new(FALSE, 0);
+	b_box3 = gtk_hbox_new(FALSE, 0);
 
 	/* Pack buttons into box */
 	gtk_box_pack_start(GTK_BOX(b_box1), retreat_button, TRUE, TRUE, 0);
 	gtk_box_pack_start(GTK_BOX(b_box1), undo_button, TRUE, TRUE, 0);
 	gtk_box_pack_start(GTK_BOX(b_box2), fire_button, TRUE, TRUE, 0);
 	gtk_box_pack_start(GTK_BOX(b_box2), earth_button, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(b_box3), progress_bar, TRUE, TRUE, 0);
+	gtk_box_pack_start(GTK_BOX(b_box3), move_button, FALSE, FALSE, 0);
 
 	/* Create text view for message area */
 	message_view = gtk_text_view_new();
@@ -2719,6 +3231,7 @@ int main(int argc, char *argv[])
 	gtk_box_pack_start(GTK_BOX(left_vbox), opp_frame, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(left_vbox), b_box1, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(left_vbox), b_box2, FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(left_vbox), b_box3, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(left_vbox), our_frame, FALSE, FALSE, 0);
 	gtk_box_pack_start(GTK_BOX(left_vbox), msg_scroll, TRUE, TRUE, 0);
 
@@ -585,12 +585,18 @@ void init_game(game *g, int first)
 			/* Card was not recently played */
 			c->recent = 0;
 
+			/* Card's special power has not been used */
+			c->used = 0;
+
 			/* Cards are not fake */
 			c->random_fake = 0;
 
 			/* Card locations are unknown */
 			c->loc_known = 0;
 			c->disclosed = 0;
+
+			/* Card is not believed to be in hand */
+			c->hand_prob = 0;
 		}
 
 		/* Draw six cards */
@@ -613,4 +619,7 @@ void init_game(game *g, int first)
 
 	/* Reset card flags */
 	reset_cards(g);
+
+	/* No card legality known yet */
+	clear_legal(g);
 }
@@ -21,6 +21,11 @@
 #include "bluemoon.h"
 
 #include <signal.h>
+#include <sys/time.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 
 /*
  * Be noisy?
@@ -36,14 +41,201 @@ void message_add(char *msg)
 	if (verbose) printf("%s", msg);
 }
 
+/*
+ * Most training threads.
+ */
+#define MAX_TRAIN 64
+
+/*
+ * Stack size for a training thread.
+ */
+#define TRAIN_STACK (2 * 1024 * 1024)
+
+/*
+ * Number of games each training thread plays between adding its training
+ * to the shared networks (0 trains the shared weights directly).
+ */
+static int merge_games;
+
+/*
+ * Information passed to a training thread.
+ */
+typedef struct train_job
+{
+	/* Game played by this thread */
+	game g;
+
+	/* Number of games to play */
+	int n;
+
+	/* Number of positions trained */
+	int positions;
+
+} train_job;
+
+/*
+ * Have AIs take all actions of one game, then start the next.
+ */
+static void play_game(game *g)
+{
+	player *p;
+
+	/* Take actions until game is over */
+	while (1)
+	{
+		/* Get current player */
+		p = &g->p[g->turn];
+
+		/* Have AI take action */
+		p->control->take_action(g);
+
+		/* Check for end of game */
+		if (g->game_over)
+		{
+			/* Quit playing */
+			break;
+		}
+	}
+
+	/* Call game over functions */
+	g->p[0].control->game_over(g, 0);
+	g->p[1].control->game_over(g, 1);
+
+	/* Message */
+	printf("Crystals: %d %d\n", g->p[0].crystals, g->p[1].crystals);
+
+	/* Restart game */
+	init_game(g, 1);
+}
+
+/*
+ * Play training games in a separate thread.
+ *
+ * All threads train the same networks.
+ */
+static void *train_worker(void *arg)
+{
+	train_job *job = (train_job *)arg;
+	int i;
+
+	/* Train this thread's own networks */
+	ai_train_start(merge_games > 0);
+
+	/* Play games */
+	for (i = 0; i < job->n; i++)
+	{
+		/* Play one game */
+		play_game(&job->g);
+
+		/* Check for time to merge training */
+		if (merge_games && (i + 1) % merge_games == 0) ai_train_merge();
+	}
+
+	/* Stop training and count positions */
+	job->positions = ai_train_stop();
+
+	/* Done */
+	return NULL;
+}
+
+/*
+ * Play games in several threads at once.
+ *
+ * Print how quickly positions were trained.
+ */
+static void train_threads(game *g, int n, int threads)
+{
+	train_job *job;
+	struct timeval start, end;
+	double secs;
+	int i, positions = 0;
+#ifdef HAVE_PTHREAD_H
+	pthread_attr_t attr;
+	pthread_t thread[MAX_TRAIN];
+	int made[MAX_TRAIN];
+#endif
+
+	/* Restrict number of threads */
+	if (threads > MAX_TRAIN) threads = MAX_TRAIN;
+
+	/* Create thread information */
+	job = (train_job *)malloc(sizeof(train_job) * threads);
+
+	/* Loop over threads */
+	for (i = 0; i < threads; i++)
+	{
+		/* Copy game */
+		job[i].g = *g;
+
+		/* Give each thread different games */
+		job[i].g.random_seed = g->start_seed + i;
+
+		/* Start first game again */
+		init_game(&job[i].g, 1);
+
+		/* Split games among threads */
+		job[i].n = n / threads + (i < n % threads);
+	}
+
+	/* Get start time */
+	gettimeofday(&start, NULL);
+
+#ifdef HAVE_PTHREAD_H
+	/* Give threads enough stack for searches */
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, TRAIN_STACK);
+
+	/* Start threads */
+	for (i = 0; i < threads; i++)
+	{
+		/* Start thread */
+		made[i] = !pthread_create(&thread[i], &attr, train_worker,
+		                          &job[i]);
+
+		/* Play games in this thread instead if that failed */
+		if (!made[i]) train_worker(&job[i]);
+	}
+
+	/* Destroy attributes */
+	pthread_attr_destroy(&attr);
+
+	/* Wait for threads */
+	for (i = 0; i < threads; i++)
+	{
+		/* Wait for thread if made */
+		if (made[i]) pthread_join(thread[i], NULL);
+	}
+#else
+	/* Play each thread's games in turn */
+	for (i = 0; i < threads; i++) train_worker(&job[i]);
+#endif
+
+	/* Get end time */
+	gettimeofday(&end, NULL);
+
+	/* Count positions trained */
+	for (i = 0; i < threads; i++) positions += job[i].positions;
+
+	/* Compute time taken */
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_usec - start.tv_usec) / 1000000.0;
+
+	/* Message */
+	printf("Trained %d positions with %d threads in %.2f seconds "
+	       "(%.0f per second)\n", positions, threads, secs,
+	       secs > 0 ? positions / secs : 0.0);
+
+	/* Destroy thread information */
+	free(job);
+}
+
 /*
  * Initialize game and have AIs take all actions.
  */
 int main(int argc, char *argv[])
 {
 	game my_game;
-	player *p;
-	int i, j, n = 100;
+	int i, j, n = 100, threads = 0;
 
 	/* Initialize random seed */
 	my_game.random_seed = time(NULL);
@@ -91,6 +283,104 @@ int main(int argc, char *argv[])
 			i++;
 		}
 
+		/* Check for number of threads */
+		else if (!strcmp(argv[i], "-t"))
+		{
+			/* Set number of AI threads */
+			ai_threads = atoi(argv[++i]);
+		}
+
+		/* Check for leaf pruning margin */
+		else if (!strcmp(argv[i], "-p"))
+		{
+			/* Set pruning margin */
+			ai_prune = atof(argv[++i]);
+		}
+
+		/* Check for endgame search depth */
+		else if (!strcmp(argv[i], "-e"))
+		{
+			/* Set turns to search exactly */
+			ai_endgame = atoi(argv[++i]);
+		}
+
+		/* Check for search precision */
+		else if (!strcmp(argv[i], "-q"))
+		{
+			/* Set precision of evaluations while searching */
+			ai_precision = atoi(argv[++i]);
+		}
+
+		/* Check for fast normalization */
+		else if (!strcmp(argv[i], "-f"))
+		{
+			/* Normalize approximately while searching */
+			ai_fast = 1;
+		}
+
+		/* Check for games between checkpoints */
+		else if (!strcmp(argv[i], "-c"))
+		{
+			/* Set games trained before saving a checkpoint */
+			ai_checkpoint_games = atoi(argv[++i]);
+		}
+
+		/* Check for minutes between checkpoints */
+		else if (!strcmp(argv[i], "-w"))
+		{
+			/* Set minutes of training before saving a checkpoint */
+			ai_checkpoint_mins = atoi(argv[++i]);
+		}
+
+		/* Check for resuming from checkpoints */
+		else if (!strcmp(argv[i], "-R"))
+		{
+			/* Continue from checkpoints newer than networks */
+			ai_resume = 1;
+		}
+
+		/* Check for shard files to write positions to */
+		else if (!strcmp(argv[i], "-d"))
+		{
+			/* Set prefix of shard filenames */
+			ai_shard = argv[++i];
+		}
+
+		/* Check for size of shard files */
+		else if (!strcmp(argv[i], "-z"))
+		{
+			/* Set megabytes written before starting a new shard */
+			ai_shard_size = atoi(argv[++i]);
+		}
+
+		/* Check for training batch size */
+		else if (!strcmp(argv[i], "-b"))
+		{
+			/* Set positions trained before changing weights */
+			ai_batch = atoi(argv[++i]);
+		}
+
+		/* Check for number of training threads */
+		else if (!strcmp(argv[i], "-j"))
+		{
+			/* Set number of games played at once */
+			threads = atoi(argv[++i]);
+		}
+
+		/* Check for games between merges */
+		else if (!strcmp(argv[i], "-m"))
+		{
+			/* Set games each thread plays before merging */
+			merge_games = atoi(argv[++i]);
+		}
+
+		/* Check for number of hand guesses */
+		else if (!strcmp(argv[i], "-s"))
+		{
+			/* Set guesses used when checking for forced retreat */
+			ai_samples = atoi(argv[++i]);
+		}
+
 		/* Check for random seed setting */
 		else if (!strcmp(argv[i], "-r"))
 		{
@@ -116,36 +406,16 @@ int main(int argc, char *argv[])
 		my_game.p[i].control->init(&my_game, i);
 	}
 
-	/* Play a number of games */
-	for (i = 0; i < n; i++)
+	/* Check for games played by training threads */
+	if (threads > 0)
 	{
-		/* Take actions until game is over */
-		while (1)
-		{
-			/* Get current player */
-			p = &my_game.p[my_game.turn];
-
-			/* Have AI take action */
-			p->control->take_action(&my_game);
-
-			/* Check for end of game */
-			if (my_game.game_over)
-			{
-				/* Quit playing */
-				break;
-			}
-		}
-
-		/* Call game over functions */
-		my_game.p[0].control->game_over(&my_game, 0);
-		my_game.p[1].control->game_over(&my_game, 1);
-
-		/* Message */
-		printf("Crystals: %d %d\n", my_game.p[0].crystals,
-		                            my_game.p[1].crystals);
-
-		/* Restart game */
-		init_game(&my_game, 1);
+		/* Play games in threads */
+		train_threads(&my_game, n, threads);
+	}
+	else
+	{
+		/* Play a number of games */
+		for (i = 0; i < n; i++) play_game(&my_game);
 	}
 
 	/* Call interface shutdown */
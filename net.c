@@ -18,8 +18,18 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include "config.h"
 #include "net.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 /* #define NOISY */
 
 /*
@@ -27,6 +37,90 @@
  */
 #define PAST_MAX 50
 
+/*
+ * Most network files whose weights are kept by the image cache.
+ */
+#define MAX_CACHE 80
+
+/*
+ * Offset of the weights in a network image file.
+ */
+#define IMAGE_START 64
+
+/*
+ * Identifies an image file (changed whenever the header changes).
+ */
+#define IMAGE_MAGIC "BMNETIM2"
+
+/*
+ * Header of a network image file.
+ *
+ * Image files hold the weights of a network file in native binary form,
+ * so that they can be mapped instead of parsed.  They are only a cache of
+ * the network file, and are made again whenever it changes.
+ */
+typedef struct net_header
+{
+	/* Identifies an image file */
+	char magic[8];
+
+	/* Size of network */
+	int input, hidden, output;
+
+	/* Training iterations */
+	int num_training;
+
+	/* Modification time and size of network file the image was made from */
+	time_t stamp;
+	off_t source_size;
+
+	/* Nanoseconds of modification time and inode of network file */
+	long stamp_nsec;
+	ino_t source_inode;
+
+} net_header;
+
+/*
+ * Weights of one network file, shared by every network loaded from it.
+ */
+typedef struct net_cache
+{
+	/* Network file name */
+	char fname[1024];
+
+	/* Modification time and size of network file when weights were read */
+	time_t stamp;
+	off_t source_size;
+
+	/* Nanoseconds of modification time and inode of network file */
+	long stamp_nsec;
+	ino_t source_inode;
+
+	/* Size of network */
+	int input, hidden, output;
+
+	/* Training iterations */
+	int num_training;
+
+	/* Hidden weights, followed by output weights (read-only) */
+	double *weight;
+
+	/* Image file descriptor and size (-1 if weights are not mapped) */
+	int fd;
+	size_t size;
+
+} net_cache;
+
+/*
+ * Cached network files.
+ */
+static net_cache cache[MAX_CACHE];
+
+/*
+ * Number of cached network files.
+ */
+static int num_cache;
+
 /*
  * Create a random weight value.
  */
@@ -37,12 +131,31 @@ static double random_weight(void)
 }
 
 /*
- * Create a network of the given size.
+ * Create a set of weights, stored in one block with a pointer to each row.
  */
-void make_learner(net *learn, int input, int hidden, int output)
+static double **make_weights(int rows, int cols)
 {
-	int i, j;
+	double **weight;
+	int i;
+
+	/* Create row pointers */
+	weight = (double **)malloc(sizeof(double *) * rows);
 
+	/* Create block of weights */
+	weight[0] = (double *)malloc(sizeof(double) * rows * cols);
+
+	/* Point to each row */
+	for (i = 1; i < rows; i++) weight[i] = weight[0] + i * cols;
+
+	/* Return weights */
+	return weight;
+}
+
+/*
+ * Create the input, result and training space of a network.
+ */
+static void make_space(net *learn, int input, int hidden, int output)
+{
 	/* Set number of outputs */
 	learn->num_output = output;
 
@@ -73,21 +186,74 @@ void make_learner(net *learn, int input, int hidden, int output)
 	/* Create output probability array */
 	learn->win_prob = (double *)malloc(sizeof(double) * output);
 
+	/* Create output training arrays */
+	learn->output_error = (double *)malloc(sizeof(double) * output);
+	learn->output_corr = (double *)malloc(sizeof(double) * output);
+
 	/* Last input and hidden result are always 1 (for bias) */
 	learn->input_value[input] = 1;
 	learn->hidden_result[hidden] = 1.0;
 
-	/* Create rows of hidden weights */
-	learn->hidden_weight = (double **)malloc(sizeof(double *) *
-	                                         (input + 1));
+	/* Clear hidden sums */
+	memset(learn->hidden_sum, 0, sizeof(double) * hidden);
+
+	/* Clear hidden errors */
+	memset(learn->hidden_error, 0, sizeof(double) * hidden);
+
+	/* Clear previous inputs */
+	memset(learn->prev_input, 0, sizeof(int) * (input + 1));
+
+	/* Create slots for sets of past inputs */
+	learn->past_input = (int *)malloc(sizeof(int) * PAST_MAX * 2 *
+	                                  (input + 1));
+	learn->past_size = (int *)malloc(sizeof(int) * PAST_MAX);
+
+	/* No past inputs available */
+	learn->past_first = 0;
+	learn->num_past = 0;
+
+	/* Weights are not merged */
+	learn->base_hidden = NULL;
+	learn->base_output = NULL;
+
+	/* Weights are changed at once */
+	learn->batch_size = 0;
+	learn->num_batch = 0;
+	learn->hidden_grad = NULL;
+	learn->output_grad = NULL;
+	learn->grad_used = NULL;
+
+	/* Weights are not mapped or shared */
+	learn->weight_map = NULL;
+	learn->map_size = 0;
+	learn->shared = 0;
+
+	/* Results are computed in full precision */
+	learn->precision = NET_DOUBLE;
+	learn->quantized = NET_DOUBLE;
+	learn->hidden_float = NULL;
+	learn->hidden_int8 = NULL;
+	learn->hidden_scale = NULL;
+	learn->hidden_fsum = NULL;
+	learn->hidden_isum = NULL;
+}
+
+/*
+ * Create a network of the given size.
+ */
+void make_learner(net *learn, int input, int hidden, int output)
+{
+	int i, j;
+
+	/* Create input, result and training space */
+	make_space(learn, input, hidden, output);
+
+	/* Create hidden weights */
+	learn->hidden_weight = make_weights(input + 1, hidden);
 
 	/* Loop over hidden weight rows */
 	for (i = 0; i < input + 1; i++)
 	{
-		/* Create weight row */
-		learn->hidden_weight[i] = (double *)malloc(sizeof(double) *
-		                                           hidden);
-
 		/* Randomize weights */
 		for (j = 0; j < hidden; j++)
 		{
@@ -96,17 +262,12 @@ void make_learner(net *learn, int input, int hidden, int output)
 		}
 	}
 
-	/* Create rows of output weights */
-	learn->output_weight = (double **)malloc(sizeof(double *) *
-	                                         (hidden + 1));
+	/* Create output weights */
+	learn->output_weight = make_weights(hidden + 1, output);
 
 	/* Loop over output weight rows */
 	for (i = 0; i < hidden + 1; i++)
 	{
-		/* Create weight row */
-		learn->output_weight[i] = (double *)malloc(sizeof(double) *
-		                                           output);
-
 		/* Randomize weights */
 		for (j = 0; j < output; j++)
 		{
@@ -115,23 +276,282 @@ void make_learner(net *learn, int input, int hidden, int output)
 		}
 	}
 
-	/* Clear hidden sums */
-	memset(learn->hidden_sum, 0, sizeof(double) * hidden);
+	/* No training done */
+	learn->num_training = 0;
+}
 
-	/* Clear hidden errors */
-	memset(learn->hidden_error, 0, sizeof(double) * hidden);
+/*
+ * Create a network that shares the weights of another.
+ *
+ * The new network has its own input and result space, so that it may be
+ * used to compute results at the same time as the original (for instance
+ * from another thread).  It should not be trained.
+ */
+void make_evaluator(net *eval, net *learn)
+{
+	int input = learn->num_inputs, hidden = learn->num_hidden;
+	int output = learn->num_output;
 
-	/* Clear previous inputs */
-	memset(learn->prev_input, 0, sizeof(int) * (input + 1));
+	/* Check for space already created for a network of this size */
+	if (!eval->input_value || eval->num_inputs != input ||
+	    eval->num_hidden != hidden || eval->num_output != output)
+	{
+		/* Check for space for a different size network */
+		if (eval->input_value)
+		{
+			/* Destroy old space */
+			free(eval->input_value);
+			free(eval->prev_input);
+			free(eval->hidden_sum);
+			free(eval->hidden_result);
+			free(eval->net_result);
+			free(eval->win_prob);
+			free(eval->hidden_fsum);
+			free(eval->hidden_isum);
+		}
 
-	/* Create set of previous inputs */
-	learn->past_input = (int **)malloc(sizeof(int *) * PAST_MAX);
+		/* Create input arrays */
+		eval->input_value = (int *)malloc(sizeof(int) * (input + 1));
+		eval->prev_input = (int *)malloc(sizeof(int) * (input + 1));
+
+		/* Create hidden node arrays */
+		eval->hidden_sum = (double *)malloc(sizeof(double) * hidden);
+		eval->hidden_result = (double *)malloc(sizeof(double) *
+		                                       (hidden + 1));
+
+		/* Create reduced precision hidden sums */
+		eval->hidden_fsum = (float *)malloc(sizeof(float) * hidden);
+		eval->hidden_isum = (int *)malloc(sizeof(int) * hidden);
+
+		/* Create output arrays */
+		eval->net_result = (double *)malloc(sizeof(double) * output);
+		eval->win_prob = (double *)malloc(sizeof(double) * output);
+
+		/* Last input and hidden result are always 1 (for bias) */
+		eval->input_value[input] = 1;
+		eval->hidden_result[hidden] = 1.0;
+
+		/* No past inputs or errors */
+		eval->hidden_error = NULL;
+		eval->output_error = NULL;
+		eval->output_corr = NULL;
+		eval->past_input = NULL;
+		eval->past_size = NULL;
+		eval->past_first = 0;
+		eval->num_past = 0;
+
+		/* Weights are not merged */
+		eval->base_hidden = NULL;
+		eval->base_output = NULL;
+
+		/* Network is not trained */
+		eval->batch_size = 0;
+		eval->num_batch = 0;
+		eval->hidden_grad = NULL;
+		eval->output_grad = NULL;
+		eval->grad_used = NULL;
+
+		/* Network makes no inference weights of its own */
+		eval->quantized = NET_DOUBLE;
+	}
 
-	/* No past inputs available */
-	learn->num_past = 0;
+	/* Copy sizes */
+	eval->num_inputs = input;
+	eval->num_hidden = hidden;
+	eval->num_output = output;
 
-	/* No training done */
-	learn->num_training = 0;
+	/* Share weights */
+	eval->hidden_weight = learn->hidden_weight;
+	eval->output_weight = learn->output_weight;
+
+	/* Weights belong to the original network */
+	eval->weight_map = NULL;
+	eval->map_size = 0;
+	eval->shared = 1;
+
+	/* Share inference weights, and compute results with them */
+	eval->hidden_float = learn->hidden_float;
+	eval->hidden_int8 = learn->hidden_int8;
+	eval->hidden_scale = learn->hidden_scale;
+	eval->precision = learn->quantized;
+
+	/* Copy training information */
+	eval->alpha = 0.0;
+	eval->num_training = learn->num_training;
+
+	/* Start from scratch */
+	reset_net(eval);
+}
+
+/*
+ * Create a copy of a set of weights.
+ */
+static double **copy_weights(double **weight, int rows, int cols)
+{
+	double **copy;
+	int i;
+
+	/* Create weights */
+	copy = make_weights(rows, cols);
+
+	/* Loop over rows */
+	for (i = 0; i < rows; i++)
+	{
+		/* Copy weights */
+		memcpy(copy[i], weight[i], sizeof(double) * cols);
+	}
+
+	/* Return copy */
+	return copy;
+}
+
+/*
+ * Copy the weights and training count of one network to another of the
+ * same size (which has weights of its own).
+ */
+void copy_net(net *dest, net *learn)
+{
+	int i;
+
+	/* Loop over hidden weight rows */
+	for (i = 0; i < learn->num_inputs + 1; i++)
+	{
+		/* Copy weights */
+		memcpy(dest->hidden_weight[i], learn->hidden_weight[i],
+		       sizeof(double) * learn->num_hidden);
+	}
+
+	/* Loop over output weight rows */
+	for (i = 0; i < learn->num_hidden + 1; i++)
+	{
+		/* Copy weights */
+		memcpy(dest->output_weight[i], learn->output_weight[i],
+		       sizeof(double) * learn->num_output);
+	}
+
+	/* Copy training count */
+	dest->num_training = learn->num_training;
+}
+
+/*
+ * Create a network that trains the weights of another.
+ *
+ * The new network has its own input, result and training space, so that
+ * it may be trained from another thread.  Normally training changes the
+ * original weights directly, without any locking, so several threads may
+ * train the same weights at once.  An occasional lost update only costs
+ * a little training.
+ *
+ * If "local" is set, training changes a private copy of the weights
+ * instead, and merge_net() adds the changes back to the original.
+ */
+void make_trainer(net *train, net *learn, int local)
+{
+	int input = learn->num_inputs, hidden = learn->num_hidden;
+	int output = learn->num_output;
+
+	/* Create input, result and training space */
+	make_space(train, input, hidden, output);
+
+	/* Check for private weights */
+	if (local)
+	{
+		/* Copy weights */
+		train->hidden_weight = copy_weights(learn->hidden_weight,
+		                                    input + 1, hidden);
+		train->output_weight = copy_weights(learn->output_weight,
+		                                    hidden + 1, output);
+
+		/* Remember weights at time of copy */
+		train->base_hidden = copy_weights(learn->hidden_weight,
+		                                  input + 1, hidden);
+		train->base_output = copy_weights(learn->output_weight,
+		                                  hidden + 1, output);
+	}
+	else
+	{
+		/* Share weights */
+		train->hidden_weight = learn->hidden_weight;
+		train->output_weight = learn->output_weight;
+	}
+
+	/* Copy training information */
+	train->alpha = learn->alpha;
+	train->num_training = learn->num_training;
+
+	/* Train in batches of the same size */
+	set_batch(train, learn->batch_size);
+}
+
+/*
+ * Add the changes made to one set of private weights to the original,
+ * and start again from the result.
+ */
+static void merge_weights(double **orig, double **weight, double **base,
+                          int rows, int cols)
+{
+	int i, j;
+
+	/* Loop over rows */
+	for (i = 0; i < rows; i++)
+	{
+		/* Loop over weights */
+		for (j = 0; j < cols; j++)
+		{
+			/* Add change since last merge */
+			orig[i][j] += weight[i][j] - base[i][j];
+
+			/* Continue from merged weight */
+			weight[i][j] = base[i][j] = orig[i][j];
+		}
+	}
+}
+
+/*
+ * Add the training done by a network made by make_trainer() to the
+ * network it was made from.
+ *
+ * Only one thread should merge into a network at a time.
+ */
+void merge_net(net *train, net *learn)
+{
+	/* Apply any unfinished batch */
+	flush_net(train);
+
+	/* Nothing to do if weights are shared */
+	if (!train->base_hidden) return;
+
+	/* Merge hidden weights */
+	merge_weights(learn->hidden_weight, train->hidden_weight,
+	              train->base_hidden, train->num_inputs + 1,
+	              train->num_hidden);
+
+	/* Merge output weights */
+	merge_weights(learn->output_weight, train->output_weight,
+	              train->base_output, train->num_hidden + 1,
+	              train->num_output);
+
+	/* Start over from the current results */
+	reset_net(train);
+}
+
+/*
+ * Forget previous inputs, so that the next result is computed from
+ * scratch instead of from the changes since the last result.
+ */
+void reset_net(net *learn)
+{
+	/* Clear hidden sums */
+	memset(learn->hidden_sum, 0, sizeof(double) * learn->num_hidden);
+
+	/* Clear previous inputs */
+	memset(learn->prev_input, 0, sizeof(int) * (learn->num_inputs + 1));
+
+	/* Clear reduced precision sums */
+	if (learn->hidden_fsum)
+		memset(learn->hidden_fsum, 0, sizeof(float) * learn->num_hidden);
+	if (learn->hidden_isum)
+		memset(learn->hidden_isum, 0, sizeof(int) * learn->num_hidden);
 }
 
 /*
@@ -144,12 +564,169 @@ static double sigmoid(double x)
 }
 
 /*
- * Compute a neural net's result.
+ * Range of the table used by fast_sigmoid(), and entries per unit.
  */
-void compute_net(net *learn)
+#define FAST_RANGE 16
+#define FAST_STEPS 128
+
+/*
+ * Sigmoid values at evenly spaced points from -FAST_RANGE to FAST_RANGE.
+ */
+static double sigmoid_table[2 * FAST_RANGE * FAST_STEPS + 2];
+
+/*
+ * Fill in the table of sigmoid values, if not done yet.
+ */
+static void make_sigmoid_table(void)
+{
+	int i;
+
+	/* Check for table already made */
+	if (sigmoid_table[1] > 0.0) return;
+
+	/* Loop over table entries */
+	for (i = 0; i < 2 * FAST_RANGE * FAST_STEPS + 2; i++)
+	{
+		/* Compute value at this point */
+		sigmoid_table[i] = sigmoid((double)i / FAST_STEPS - FAST_RANGE);
+	}
+}
+
+/*
+ * Approximate a sigmoid by interpolating between table entries.
+ *
+ * The result is within 7.4e-7 of the exact sigmoid everywhere (the error
+ * of linear interpolation with this spacing is at most 1/128^2 / 8 times
+ * the largest second derivative, about 0.096).  Outside the table the
+ * result is that of the table's end, which is closer than 1.2e-7.
+ *
+ * The benchnet program measures the error and speed of this function.
+ */
+static double fast_sigmoid(double x)
+{
+	int k;
+	double t;
+
+	/* Check for values past ends of table */
+	if (x <= -FAST_RANGE) return sigmoid_table[0];
+	if (x >= FAST_RANGE) return sigmoid_table[2 * FAST_RANGE * FAST_STEPS];
+
+	/* Compute position in table */
+	t = (x + FAST_RANGE) * FAST_STEPS;
+
+	/* Get entry below position */
+	k = (int)t;
+
+	/* Interpolate between entries */
+	return sigmoid_table[k] + (t - k) *
+	       (sigmoid_table[k + 1] - sigmoid_table[k]);
+}
+
+/*
+ * Normalize a set of values in place, as a network of the given precision
+ * normalizes its hidden nodes.
+ */
+void normalize_values(double *value, int n, int precision)
+{
+	int i;
+
+	/* Check for approximate normalization */
+	if (precision & NET_FAST)
+	{
+		/* Make table if needed */
+		make_sigmoid_table();
+
+		/* Loop over values */
+		for (i = 0; i < n; i++)
+		{
+			/* Set approximate normalized value */
+			value[i] = fast_sigmoid(value[i]);
+		}
+	}
+	else
+	{
+		/* Loop over values */
+		for (i = 0; i < n; i++)
+		{
+			/* Set normalized value */
+			value[i] = sigmoid(value[i]);
+		}
+	}
+}
+
+/*
+ * Always use the generic loops, even for networks of the shape used by
+ * the AI (for comparing the two, as benchnet does).
+ */
+int net_generic;
+
+/*
+ * Check whether a network has the shape used by the AI, so that kernels
+ * specialized for that shape may be used.
+ */
+static int fixed_shape(net *learn)
+{
+	/* Compare sizes unless generic loops are forced */
+	return !net_generic &&
+	       learn->num_inputs == NET_INPUT &&
+	       learn->num_hidden == HIDDEN_NODES &&
+	       learn->num_output == NET_OUTPUT;
+}
+
+/*
+ * Compute hidden node sums in full precision, for a network of the
+ * shape used by the AI.
+ *
+ * With the (even) number of hidden nodes known, sums are updated in pairs
+ * that the compiler can vectorize, with no remainder loop.
+ */
+static void compute_fixed(net *learn)
+{
+	int i, j, change;
+	double *sum = learn->hidden_sum, *weight, s0, s1;
+
+	/* Loop over inputs */
+	for (i = 0; i < NET_INPUT + 1; i++)
+	{
+		/* Skip unchanged inputs */
+		if (learn->input_value[i] == learn->prev_input[i]) continue;
+
+		/* Compute change of input */
+		change = learn->input_value[i] - learn->prev_input[i];
+
+		/* Get row of weights */
+		weight = learn->hidden_weight[i];
+
+		/* Adjust sums two at a time */
+		for (j = 0; j < HIDDEN_NODES; j += 2)
+		{
+			/* Compute new sums */
+			s0 = sum[j] + weight[j] * change;
+			s1 = sum[j + 1] + weight[j + 1] * change;
+
+			/* Store new sums */
+			sum[j] = s0;
+			sum[j + 1] = s1;
+		}
+
+		/* Store input */
+		learn->prev_input[i] = learn->input_value[i];
+	}
+
+	/* Loop over hidden nodes */
+	for (i = 0; i < HIDDEN_NODES; i++)
+	{
+		/* Set result before normalizing */
+		learn->hidden_result[i] = sum[i];
+	}
+}
+
+/*
+ * Compute a network's hidden node results in full precision.
+ */
+static void compute_double(net *learn)
 {
 	int i, j;
-	double sum;
 
 	/* Loop over inputs */
 	for (i = 0; i < learn->num_inputs + 1; i++)
@@ -172,35 +749,189 @@ void compute_net(net *learn)
 		}
 	}
 	
-	/* Normalize hidden node results */
+	/* Loop over hidden nodes */
 	for (i = 0; i < learn->num_hidden; i++)
 	{
-		/* Set normalized result */
-		learn->hidden_result[i] = sigmoid(learn->hidden_sum[i]);
+		/* Set result before normalizing */
+		learn->hidden_result[i] = learn->hidden_sum[i];
 	}
+}
 
-	/* Clear probability sum */
-	learn->prob_sum = 0.0;
+/*
+ * Compute a network's hidden node results using float weights.
+ */
+static void compute_float(net *learn)
+{
+	int i, j, change;
+	int hidden = learn->num_hidden;
+	float *weight;
+	double *bias = learn->hidden_weight[learn->num_inputs];
 
-	/* Then compute output nodes */
-	for (i = 0; i < learn->num_output; i++)
+	/* Loop over inputs (except bias) */
+	for (i = 0; i < learn->num_inputs; i++)
+	{
+		/* Skip unchanged inputs */
+		if (learn->input_value[i] == learn->prev_input[i]) continue;
+
+		/* Compute change of input */
+		change = learn->input_value[i] - learn->prev_input[i];
+
+		/* Get row of weights */
+		weight = learn->hidden_float + i * hidden;
+
+		/* Adjust sums */
+		for (j = 0; j < hidden; j++)
+		{
+			/* Adjust sum */
+			learn->hidden_fsum[j] += weight[j] * change;
+		}
+
+		/* Store input */
+		learn->prev_input[i] = learn->input_value[i];
+	}
+
+	/* Loop over hidden nodes */
+	for (i = 0; i < hidden; i++)
+	{
+		/* Add bias and set result before normalizing */
+		learn->hidden_result[i] = learn->hidden_fsum[i] + bias[i];
+	}
+}
+
+/*
+ * Compute a network's hidden node results using 8-bit integer weights.
+ *
+ * Sums are kept as integers, and scaled only when normalized.
+ */
+static void compute_int8(net *learn)
+{
+	int i, j, change;
+	int hidden = learn->num_hidden;
+	signed char *weight;
+	double *bias = learn->hidden_weight[learn->num_inputs];
+
+	/* Loop over inputs (except bias) */
+	for (i = 0; i < learn->num_inputs; i++)
+	{
+		/* Skip unchanged inputs */
+		if (learn->input_value[i] == learn->prev_input[i]) continue;
+
+		/* Compute change of input */
+		change = learn->input_value[i] - learn->prev_input[i];
+
+		/* Get row of weights */
+		weight = learn->hidden_int8 + i * hidden;
+
+		/* Adjust sums */
+		for (j = 0; j < hidden; j++)
+		{
+			/* Adjust sum */
+			learn->hidden_isum[j] += weight[j] * change;
+		}
+
+		/* Store input */
+		learn->prev_input[i] = learn->input_value[i];
+	}
+
+	/* Loop over hidden nodes */
+	for (i = 0; i < hidden; i++)
+	{
+		/* Scale sum, add bias and set result before normalizing */
+		learn->hidden_result[i] = learn->hidden_isum[i] *
+		                          learn->hidden_scale[i] + bias[i];
+	}
+}
+
+/*
+ * Compute a neural net's result.
+ *
+ * Networks with the NET_FAST flag in their precision normalize with
+ * fast_sigmoid() instead of calling exp(), and find the probabilities of
+ * two outputs from a single sigmoid.  Their results may differ from exact
+ * ones by about 1e-6, so they should be used only for searching.
+ */
+void compute_net(net *learn)
+{
+	int i, j, fixed;
+	double sum, r0, r1, *result, **weight;
+
+	/* Check for network of the shape used by the AI */
+	fixed = fixed_shape(learn);
+
+	/* Compute hidden node sums in the network's precision */
+	if ((learn->precision & NET_WEIGHTS) == NET_FLOAT) compute_float(learn);
+	else if ((learn->precision & NET_WEIGHTS) == NET_INT8)
+		compute_int8(learn);
+	else if (fixed) compute_fixed(learn);
+	else compute_double(learn);
+
+	/* Normalize hidden node results */
+	normalize_values(learn->hidden_result, learn->num_hidden,
+	                 learn->precision);
+
+	/* Check for two outputs of the shape used by the AI */
+	if (fixed)
 	{
-		/* Start sum at zero */
-		sum = 0.0;
+		/* Get hidden results and output weights */
+		result = learn->hidden_result;
+		weight = learn->output_weight;
+
+		/* Start sums at zero */
+		r0 = r1 = 0.0;
 
 		/* Loop over hidden results */
-		for (j = 0; j < learn->num_hidden + 1; j++)
+		for (j = 0; j < HIDDEN_NODES + 1; j++)
 		{
-			/* Add weighted result to sum */
-			sum += learn->hidden_result[j] *
-			       learn->output_weight[j][i];
+			/* Add weighted result to both sums */
+			r0 += result[j] * weight[j][0];
+			r1 += result[j] * weight[j][1];
 		}
 
-		/* Save sum */
-		learn->net_result[i] = sum;
+		/* Save sums */
+		learn->net_result[0] = r0;
+		learn->net_result[1] = r1;
+	}
+	else
+	{
+		/* Compute output nodes one at a time */
+		for (i = 0; i < learn->num_output; i++)
+		{
+			/* Start sum at zero */
+			sum = 0.0;
+
+			/* Loop over hidden results */
+			for (j = 0; j < learn->num_hidden + 1; j++)
+			{
+				/* Add weighted result to sum */
+				sum += learn->hidden_result[j] *
+				       learn->output_weight[j][i];
+			}
+
+			/* Save sum */
+			learn->net_result[i] = sum;
+		}
+	}
+
+	/* Check for approximate probabilities of two outputs */
+	if ((learn->precision & NET_FAST) && learn->num_output == 2)
+	{
+		/* Two-way softmax is a sigmoid of the difference */
+		learn->win_prob[0] = fast_sigmoid(learn->net_result[0] -
+		                                  learn->net_result[1]);
+		learn->win_prob[1] = 1.0 - learn->win_prob[0];
+
+		/* Done */
+		return;
+	}
+
+	/* Clear probability sum */
+	learn->prob_sum = 0.0;
 
+	/* Loop over outputs */
+	for (i = 0; i < learn->num_output; i++)
+	{
 		/* Track total output */
-		learn->prob_sum += exp(sum);
+		learn->prob_sum += exp(learn->net_result[i]);
 	}
 
 	/* Then compute output probabilities */
@@ -212,68 +943,303 @@ void compute_net(net *learn)
 	}
 }
 
+/*
+ * Make reduced precision copies of a network's hidden weights, for
+ * networks made from it by make_evaluator() to compute results with.
+ *
+ * The bias weights are kept in full precision.  8-bit weights are scaled
+ * separately for each hidden node, so that its largest weight is 127.
+ *
+ * Copies must be made again after the network is trained.  The NET_FAST
+ * flag may be added to the precision (even NET_DOUBLE) to have those
+ * networks normalize results approximately.
+ */
+void quantize_net(net *learn, int precision)
+{
+	int i, j;
+	int input = learn->num_inputs, hidden = learn->num_hidden;
+	double x;
+
+	/* Remember precision */
+	learn->quantized = precision;
+
+	/* Make table used for fast normalization if needed */
+	if (precision & NET_FAST) make_sigmoid_table();
+
+	/* Check for float weights */
+	if ((precision & NET_WEIGHTS) == NET_FLOAT)
+	{
+		/* Create space if needed */
+		if (!learn->hidden_float)
+		{
+			/* Create float weights */
+			learn->hidden_float = (float *)malloc(sizeof(float) *
+			                                      input * hidden);
+		}
+
+		/* Loop over inputs */
+		for (i = 0; i < input; i++)
+		{
+			/* Loop over hidden nodes */
+			for (j = 0; j < hidden; j++)
+			{
+				/* Copy weight */
+				learn->hidden_float[i * hidden + j] =
+				                     learn->hidden_weight[i][j];
+			}
+		}
+	}
+
+	/* Check for 8-bit weights */
+	if ((precision & NET_WEIGHTS) == NET_INT8)
+	{
+		/* Create space if needed */
+		if (!learn->hidden_int8)
+		{
+			/* Create 8-bit weights and scales */
+			learn->hidden_int8 = (signed char *)malloc(input * hidden);
+			learn->hidden_scale = (double *)malloc(sizeof(double) *
+			                                       hidden);
+		}
+
+		/* Clear largest weights */
+		for (j = 0; j < hidden; j++) learn->hidden_scale[j] = 0.0;
+
+		/* Loop over inputs */
+		for (i = 0; i < input; i++)
+		{
+			/* Loop over hidden nodes */
+			for (j = 0; j < hidden; j++)
+			{
+				/* Get size of weight */
+				x = fabs(learn->hidden_weight[i][j]);
+
+				/* Track largest weight of hidden node */
+				if (x > learn->hidden_scale[j])
+					learn->hidden_scale[j] = x;
+			}
+		}
+
+		/* Loop over hidden nodes */
+		for (j = 0; j < hidden; j++)
+		{
+			/* Compute steps per unit of weight for now */
+			x = learn->hidden_scale[j];
+			learn->hidden_scale[j] = x > 0.0 ? 127 / x : 1.0;
+		}
+
+		/* Loop over inputs */
+		for (i = 0; i < input; i++)
+		{
+			/* Loop over hidden nodes */
+			for (j = 0; j < hidden; j++)
+			{
+				/* Compute weight in steps */
+				x = learn->hidden_weight[i][j] *
+				    learn->hidden_scale[j];
+
+				/* Round to nearest step */
+				learn->hidden_int8[i * hidden + j] = (signed char)
+				                                     floor(x + 0.5);
+			}
+		}
+
+		/* Loop over hidden nodes */
+		for (j = 0; j < hidden; j++)
+		{
+			/* Compute value of one step */
+			learn->hidden_scale[j] = 1.0 / learn->hidden_scale[j];
+		}
+	}
+}
+
 /*
  * Store the current inputs into the past set array.
+ *
+ * The sets are kept in a ring of slots made with the network, so that
+ * the oldest set is replaced once PAST_MAX sets are stored.  Only the
+ * nonzero inputs are saved.
  */
 void store_net(net *learn)
 {
-	int i;
+	int i, n = 0, slot;
+	int *pair;
 
 	/* Check for too many past inputs already */
 	if (learn->num_past == PAST_MAX)
 	{
-		/* Destroy oldest set */
-		free(learn->past_input[0]);
-
-		/* Move all inputs up one spot */
-		for (i = 0; i < PAST_MAX - 1; i++)
-		{
-			/* Move one set of inputs */
-			learn->past_input[i] = learn->past_input[i + 1];
-		}
+		/* Forget oldest set */
+		learn->past_first = (learn->past_first + 1) % PAST_MAX;
 
 		/* We now have one fewer set */
 		learn->num_past--;
 	}
 
-	/* Make space for new inputs */
-	learn->past_input[learn->num_past] = malloc(sizeof(int) *
-	                                            (learn->num_inputs + 1));
+	/* Get slot after newest set */
+	slot = (learn->past_first + learn->num_past) % PAST_MAX;
+
+	/* Get space of slot */
+	pair = learn->past_input + slot * 2 * (learn->num_inputs + 1);
+
+	/* Loop over inputs (including bias) */
+	for (i = 0; i < learn->num_inputs + 1; i++)
+	{
+		/* Skip zero inputs */
+		if (!learn->input_value[i]) continue;
+
+		/* Save input number and value */
+		pair[n++] = i;
+		pair[n++] = learn->input_value[i];
+	}
 
-	/* Copy inputs */
-	memcpy(learn->past_input[learn->num_past], learn->input_value,
-	       sizeof(int) * (learn->num_inputs + 1));
+	/* Remember number of inputs saved */
+	learn->past_size[slot] = n / 2;
 
 	/* One additional set */
 	learn->num_past++;
 }
 
+/*
+ * Copy a set of past inputs (0 is the oldest) back to the network's
+ * inputs.
+ */
+void recall_net(net *learn, int i)
+{
+	int j, slot;
+	int *pair;
+
+	/* Get slot of set */
+	slot = (learn->past_first + i) % PAST_MAX;
+
+	/* Get space of slot */
+	pair = learn->past_input + slot * 2 * (learn->num_inputs + 1);
+
+	/* Clear inputs */
+	memset(learn->input_value, 0, sizeof(int) * (learn->num_inputs + 1));
+
+	/* Loop over saved inputs */
+	for (j = 0; j < learn->past_size[slot]; j++)
+	{
+		/* Set input */
+		learn->input_value[pair[2 * j]] = pair[2 * j + 1];
+	}
+}
+
 /*
  * Clean up past stored inputs.
  */
 void clear_store(net *learn)
 {
-	int i;
+	/* Clear number of past inputs */
+	learn->past_first = 0;
+	learn->num_past = 0;
+}
+
+/*
+ * Add each hidden node's share of the output error to its total, and
+ * change the output weights, for a network of the shape used by the AI.
+ */
+static void train_output_fixed(net *learn, double **output_dest)
+{
+	int j;
+	double *out_error = learn->output_error;
+	double *out_corr = learn->output_corr;
+	double *row, *dest, corr;
+
+	/* Loop over hidden nodes */
+	for (j = 0; j < HIDDEN_NODES; j++)
+	{
+		/* Get row of output weights and where to change them */
+		row = learn->output_weight[j];
+		dest = output_dest[j];
+
+		/* Add hidden node's effect on output error */
+		learn->hidden_error[j] += out_error[0] * row[0] +
+		                          out_error[1] * row[1];
+
+		/* Get hidden node's result */
+		corr = learn->hidden_result[j];
+
+		/* Apply corrections */
+		dest[0] += corr * out_corr[0];
+		dest[1] += corr * out_corr[1];
+	}
+
+	/* Get where to change bias weights */
+	dest = output_dest[HIDDEN_NODES];
+
+	/* Apply corrections (bias result is always 1) */
+	dest[0] += out_corr[0];
+	dest[1] += out_corr[1];
+}
+
+/*
+ * Change the hidden weights of active inputs, for a network of the shape
+ * used by the AI.
+ */
+static void train_input_fixed(net *learn, double **hidden_dest)
+{
+	int i, j;
+	double *error = learn->hidden_error, *row, w0, w1, w2, w3;
+
+	/* Loop over inputs */
+	for (i = 0; i < NET_INPUT + 1; i++)
+	{
+		/* Skip zero inputs */
+		if (!learn->input_value[i]) continue;
+
+		/* Get row of hidden weights to change */
+		row = hidden_dest[i];
+
+		/* Mark row of saved changes as used */
+		if (learn->batch_size) learn->grad_used[i] = 1;
+
+		/* Adjust weights four at a time */
+		for (j = 0; j + 4 <= HIDDEN_NODES; j += 4)
+		{
+			/* Compute new weights */
+			w0 = row[j] + error[j];
+			w1 = row[j + 1] + error[j + 1];
+			w2 = row[j + 2] + error[j + 2];
+			w3 = row[j + 3] + error[j + 3];
+
+			/* Store new weights */
+			row[j] = w0;
+			row[j + 1] = w1;
+			row[j + 2] = w2;
+			row[j + 3] = w3;
+		}
 
-	/* Loop over previous stored inputs */
-	for (i = 0; i < learn->num_past; i++)
-	{
-		/* Free inputs */
-		free(learn->past_input[i]);
+		/* Adjust remaining weights */
+		for ( ; j < HIDDEN_NODES; j++) row[j] += error[j];
 	}
-
-	/* Clear number of past inputs */
-	learn->num_past = 0;
 }
 
 /*
  * Train a network so that the current results are more like the desired.
+ *
+ * With output probabilities p = softmax(r), the change of output i with
+ * respect to result k is p[i] * ((i == k) - p[k]).  So the effect of hidden
+ * node j on output i is p[i] * (w[j][i] - sum over k of p[k] * w[j][k]),
+ * which needs only one pass over the outputs.  All per-output factors are
+ * found first, so the weight updates are simple sweeps over the rows.
+ *
+ * If the network trains in batches (see set_batch()), the weight changes
+ * are saved, and applied together at the end of the batch.
  */
 void train_net(net *learn, double lambda, double *desired)
 {
-	int i, j, k;
-	double error, corr, deriv, hderiv;
-	double *hidden_corr;
+	int i, j;
+	int hidden = learn->num_hidden, output = learn->num_output;
+	double *win_prob = learn->win_prob;
+	double *out_error = learn->output_error;
+	double *out_corr = learn->output_corr;
+	double *hidden_error = learn->hidden_error;
+	double **hidden_dest, **output_dest;
+	double *row, *dest;
+	double error, error_sum, sum, corr;
+	double w0, w1, w2, w3;
+	int fixed = fixed_shape(learn);
 #ifdef NOISY
 	double orig[5];
 #endif
@@ -285,91 +1251,143 @@ void train_net(net *learn, double lambda, double *desired)
 	}
 #endif
 
+	/* Check for changes saved for a batch */
+	if (learn->batch_size)
+	{
+		/* Add changes to saved changes */
+		hidden_dest = learn->hidden_grad;
+		output_dest = learn->output_grad;
+	}
+	else
+	{
+		/* Change weights at once */
+		hidden_dest = learn->hidden_weight;
+		output_dest = learn->output_weight;
+	}
+
+	/* Clear total output error */
+	error_sum = 0.0;
+
 	/* Loop over output nodes */
-	for (i = 0; i < learn->num_output; i++)
+	for (i = 0; i < output; i++)
 	{
 		/* Compute error */
-		error = lambda * (learn->win_prob[i] - desired[i]);
+		error = lambda * (win_prob[i] - desired[i]);
 
-		/* Output portion of partial derivatives */
-		deriv = learn->win_prob[i] * (1.0 - learn->win_prob[i]);
+		/* Compute correction of weights leading to this node */
+		out_corr[i] = -learn->alpha * error * win_prob[i] *
+		              (1.0 - win_prob[i]);
 
-		/* Loop over node's weights */
-		for (j = 0; j < learn->num_hidden; j++)
-		{
-			/* Compute correction */
-			corr = -error * learn->hidden_result[j] * deriv;
+		/* Error scaled by this node's share of the output */
+		out_error[i] = error * win_prob[i];
 
-			/* Compute hidden node's effect on output */
-			hderiv = deriv * learn->output_weight[j][i];
+		/* Track total */
+		error_sum += out_error[i];
+	}
+
+	/* Loop over output nodes */
+	for (i = 0; i < output; i++)
+	{
+		/* Remove share of total, to account for other outputs */
+		out_error[i] -= error_sum * win_prob[i];
+	}
+
+	/* Check for network of the shape used by the AI */
+	if (fixed) train_output_fixed(learn, output_dest);
+	else
+	{
+		/* Loop over hidden nodes and bias */
+		for (j = 0; j < hidden + 1; j++)
+		{
+			/* Get row of output weights and where to change them */
+			row = learn->output_weight[j];
+			dest = output_dest[j];
 
-			/* Loop over other output nodes */
-			for (k = 0; k < learn->num_output; k++)
+			/* Check for hidden node (not bias) */
+			if (j < hidden)
 			{
-				/* Skip this output node */
-				if (i == k) continue;
-
-				/* Subtract this node's factor */
-				hderiv -= learn->output_weight[j][k] *
-				          exp(learn->net_result[i] +
-				              learn->net_result[k]) /
-				          (learn->prob_sum * learn->prob_sum);
+				/* Start sum at zero */
+				sum = 0.0;
+
+				/* Compute hidden node's effect on error */
+				for (i = 0; i < output; i++)
+					sum += out_error[i] * row[i];
+
+				/* Add to hidden node's error */
+				hidden_error[j] += sum;
 			}
 
-			/* Compute hidden node's error */
-			learn->hidden_error[j] += error * hderiv;
+			/* Get hidden node's result */
+			corr = learn->hidden_result[j];
 
-			/* Apply correction */
-			learn->output_weight[j][i] += learn->alpha * corr;
+			/* Apply corrections */
+			for (i = 0; i < output; i++)
+				dest[i] += corr * out_corr[i];
 		}
-
-		/* Compute bias weight's correction */
-		learn->output_weight[j][i] += learn->alpha * -error * deriv;
 	}
 
-	/* Create array of hidden weight correction factors */
-	hidden_corr = (double *)malloc(sizeof(double) * learn->num_hidden);
-
 	/* Loop over hidden nodes */
-	for (i = 0; i < learn->num_hidden; i++)
+	for (i = 0; i < hidden; i++)
 	{
 		/* Output portion of partial derivatives */
-		deriv = learn->hidden_result[i] *
-			(1.0 - learn->hidden_result[i]);
+		corr = learn->hidden_result[i] *
+		       (1.0 - learn->hidden_result[i]);
 
-		/* Calculate correction factor */
-		hidden_corr[i] = deriv * -learn->hidden_error[i] * learn->alpha;
+		/* Replace error with weight correction factor */
+		hidden_error[i] = corr * -hidden_error[i] * learn->alpha;
 	}
 
-	/* Loop over inputs */
-	for (i = 0; i < learn->num_inputs + 1; i++)
+	/* Check for network of the shape used by the AI */
+	if (fixed) train_input_fixed(learn, hidden_dest);
+	else
 	{
-		/* Skip zero inputs */
-		if (!learn->input_value[i]) continue;
-
-		/* Loop over hidden nodes */
-		for (j = 0; j < learn->num_hidden; j++)
+		/* Loop over inputs */
+		for (i = 0; i < learn->num_inputs + 1; i++)
 		{
-			/* Adjust weight */
-			learn->hidden_weight[i][j] += hidden_corr[j];
+			/* Skip zero inputs */
+			if (!learn->input_value[i]) continue;
+
+			/* Get row of hidden weights to change */
+			row = hidden_dest[i];
+
+			/* Mark row of saved changes as used */
+			if (learn->batch_size) learn->grad_used[i] = 1;
+
+			/* Adjust weights four at a time */
+			for (j = 0; j + 4 <= hidden; j += 4)
+			{
+				/* Compute new weights */
+				w0 = row[j] + hidden_error[j];
+				w1 = row[j + 1] + hidden_error[j + 1];
+				w2 = row[j + 2] + hidden_error[j + 2];
+				w3 = row[j + 3] + hidden_error[j + 3];
+
+				/* Store new weights */
+				row[j] = w0;
+				row[j + 1] = w1;
+				row[j + 2] = w2;
+				row[j + 3] = w3;
+			}
+
+			/* Adjust remaining weights */
+			for ( ; j < hidden; j++) row[j] += hidden_error[j];
 		}
 	}
 
-	/* Destroy hidden correction factor array */
-	free(hidden_corr);
+	/* Clear hidden errors */
+	memset(hidden_error, 0, sizeof(double) * hidden);
 
-	/* Loop over hidden nodes */
-	for (i = 0; i < learn->num_hidden; i++)
+	/* Check for changes saved for a batch */
+	if (learn->batch_size)
 	{
-		/* Clear node's error */
-		learn->hidden_error[i] = 0;
-
-		/* Clear node's stored sum */
-		learn->hidden_sum[i] = 0;
+		/* Apply changes at end of batch */
+		if (++learn->num_batch >= learn->batch_size) flush_net(learn);
+	}
+	else
+	{
+		/* Forget previous inputs, since weights have changed */
+		reset_net(learn);
 	}
-
-	/* Clear previous inputs */
-	memset(learn->prev_input, 0, sizeof(int) * (learn->num_inputs + 1));
 
 #ifdef NOISY
 	compute_net();
@@ -380,6 +1398,114 @@ void train_net(net *learn, double lambda, double *desired)
 #endif
 }
 
+/*
+ * Train a network in batches of the given number of positions.
+ *
+ * The weights are not changed until each batch is complete.  Changes are
+ * summed, not averaged, so the learning rate means the same for any size
+ * of batch.  A size of 0 or 1 changes the weights after each position.
+ */
+void set_batch(net *learn, int size)
+{
+	int input = learn->num_inputs, hidden = learn->num_hidden;
+	int output = learn->num_output;
+
+	/* Apply changes from any previous batch */
+	flush_net(learn);
+
+	/* Check for no batches */
+	if (size < 2)
+	{
+		/* Change weights at once */
+		learn->batch_size = 0;
+		return;
+	}
+
+	/* Check for space for changes not created yet */
+	if (!learn->hidden_grad)
+	{
+		/* Create space for weight changes */
+		learn->hidden_grad = make_weights(input + 1, hidden);
+		learn->output_grad = make_weights(hidden + 1, output);
+
+		/* Clear weight changes */
+		memset(learn->hidden_grad[0], 0,
+		       sizeof(double) * (input + 1) * hidden);
+		memset(learn->output_grad[0], 0,
+		       sizeof(double) * (hidden + 1) * output);
+
+		/* Create markers of used rows */
+		learn->grad_used = (char *)malloc(input + 1);
+
+		/* No rows used */
+		memset(learn->grad_used, 0, input + 1);
+	}
+
+	/* Set batch size */
+	learn->batch_size = size;
+}
+
+/*
+ * Apply the weight changes saved from an unfinished batch.
+ */
+void flush_net(net *learn)
+{
+	int i, j;
+	int hidden = learn->num_hidden, output = learn->num_output;
+	double *row, *grad;
+
+	/* Check for nothing saved */
+	if (!learn->num_batch) return;
+
+	/* Loop over hidden weight rows */
+	for (i = 0; i < learn->num_inputs + 1; i++)
+	{
+		/* Skip unused rows */
+		if (!learn->grad_used[i]) continue;
+
+		/* Get weights and changes */
+		row = learn->hidden_weight[i];
+		grad = learn->hidden_grad[i];
+
+		/* Loop over weights */
+		for (j = 0; j < hidden; j++)
+		{
+			/* Apply change */
+			row[j] += grad[j];
+
+			/* Clear change */
+			grad[j] = 0.0;
+		}
+
+		/* Row is no longer used */
+		learn->grad_used[i] = 0;
+	}
+
+	/* Loop over output weight rows */
+	for (i = 0; i < hidden + 1; i++)
+	{
+		/* Get weights and changes */
+		row = learn->output_weight[i];
+		grad = learn->output_grad[i];
+
+		/* Loop over weights */
+		for (j = 0; j < output; j++)
+		{
+			/* Apply change */
+			row[j] += grad[j];
+
+			/* Clear change */
+			grad[j] = 0.0;
+		}
+	}
+
+	/* Batch is empty */
+	learn->num_batch = 0;
+
+	/* Forget previous inputs, since weights have changed */
+	reset_net(learn);
+}
+
 /*
  * Load network weights from disk.
  */
@@ -447,14 +1573,31 @@ int load_net(net *learn, char *fname)
 
 /*
  * Save network weights to disk.
+ *
+ * The weights are written to a temporary file, flushed to disk and then
+ * renamed over the old file, so that a crash while saving never leaves a
+ * partial network behind.  Return -1 (leaving any old file alone) if the
+ * network could not be saved.
  */
-void save_net(net *learn, char *fname)
+int save_net(net *learn, char *fname)
 {
 	FILE *fff;
-	int i, j;
+	char tmp[1040];
+	int i, j, bad;
+
+	/* Create temporary file name */
+	sprintf(tmp, "%s.tmp", fname);
 
 	/* Open output file */
-	fff = fopen(fname, "w");
+	fff = fopen(tmp, "w");
+
+	/* Check for failure */
+	if (!fff)
+	{
+		/* Error */
+		printf("Couldn't open %s!\n", tmp);
+		return -1;
+	}
 
 	/* Save network size */
 	fprintf(fff, "%d %d %d\n", learn->num_inputs, learn->num_hidden,
@@ -485,6 +1628,439 @@ void save_net(net *learn, char *fname)
 		}
 	}
 
-	/* Done */
-	fclose(fff);
+	/* Flush weights to disk */
+	bad = fflush(fff) || fsync(fileno(fff)) || ferror(fff);
+
+	/* Close file */
+	if (fclose(fff)) bad = 1;
+
+	/* Check for failure */
+	if (bad)
+	{
+		/* Error */
+		printf("Couldn't write %s!\n", tmp);
+
+		/* Remove partial file */
+		unlink(tmp);
+		return -1;
+	}
+
+	/* Replace old file */
+	if (rename(tmp, fname))
+	{
+		/* Error */
+		printf("Couldn't rename %s!\n", tmp);
+
+		/* Remove temporary file */
+		unlink(tmp);
+		return -1;
+	}
+
+	/* Success */
+	return 0;
+}
+
+/*
+ * Make the name of the image file of a network file.
+ */
+static void image_name(char *buf, char *fname)
+{
+	/* Add suffix to network file name */
+	sprintf(buf, "%s.img", fname);
+}
+
+/*
+ * Write an image of a cached network file's weights.
+ *
+ * The image is written to a temporary file and renamed, so that other
+ * processes never see a partial image (and existing mappings of an older
+ * image stay valid).  Failure (for instance in a
+ * directory we cannot write to) is not an error, since the image is only
+ * a cache.
+ */
+static void write_image(net_cache *c)
+{
+	FILE *fff;
+	net_header head;
+	char img[1100], tmp[1120];
+	char pad[IMAGE_START];
+	size_t n;
+
+	/* Get image file name, and a temporary name unique to this process */
+	image_name(img, c->fname);
+	sprintf(tmp, "%s.%d", img, (int)getpid());
+
+	/* Open temporary file */
+	fff = fopen(tmp, "wb");
+
+	/* Check for failure */
+	if (!fff) return;
+
+	/* Fill in header */
+	memset(&head, 0, sizeof(net_header));
+	memcpy(head.magic, IMAGE_MAGIC, 8);
+	head.input = c->input;
+	head.hidden = c->hidden;
+	head.output = c->output;
+	head.num_training = c->num_training;
+	head.stamp = c->stamp;
+	head.source_size = c->source_size;
+	head.stamp_nsec = c->stamp_nsec;
+	head.source_inode = c->source_inode;
+
+	/* Pad header to start of weights */
+	memset(pad, 0, IMAGE_START);
+	memcpy(pad, &head, sizeof(net_header));
+
+	/* Count weights */
+	n = (size_t)(c->input + 1) * c->hidden + (c->hidden + 1) * c->output;
+
+	/* Write header and weights */
+	if (fwrite(pad, IMAGE_START, 1, fff) != 1 ||
+	    fwrite(c->weight, sizeof(double), n, fff) != n)
+	{
+		/* Forget partial image */
+		fclose(fff);
+		remove(tmp);
+		return;
+	}
+
+	/* Check for failure to finish writing */
+	if (fclose(fff))
+	{
+		/* Forget partial image */
+		remove(tmp);
+		return;
+	}
+
+	/* Replace any old image */
+	if (rename(tmp, img)) remove(tmp);
+}
+
+/*
+ * Read the weights of a cached network file from its image, if the image
+ * was made from the current network file.
+ *
+ * The image is mapped shared and read-only where possible, so that every
+ * process using it shares one copy.  Otherwise it is read into memory.
+ */
+static int read_image(net_cache *c)
+{
+	net_header head;
+	struct stat st;
+	char img[1100];
+	double *weight;
+	size_t n, size;
+	int fd;
+#ifdef HAVE_SYS_MMAN_H
+	void *map;
+#endif
+
+	/* Get image file name */
+	image_name(img, c->fname);
+
+	/* Open image */
+	fd = open(img, O_RDONLY);
+
+	/* Check for failure */
+	if (fd < 0) return -1;
+
+	/* Count weights */
+	n = (size_t)(c->input + 1) * c->hidden + (c->hidden + 1) * c->output;
+
+	/* Compute expected size of image */
+	size = IMAGE_START + n * sizeof(double);
+
+	/* Read header and get size of image */
+	if (read(fd, &head, sizeof(net_header)) != sizeof(net_header) ||
+	    fstat(fd, &st) || (size_t)st.st_size != size ||
+	    memcmp(head.magic, IMAGE_MAGIC, 8) ||
+	    head.input != c->input || head.hidden != c->hidden ||
+	    head.output != c->output || head.stamp != c->stamp ||
+	    head.source_size != c->source_size ||
+	    head.stamp_nsec != c->stamp_nsec ||
+	    head.source_inode != c->source_inode)
+	{
+		/* Image is missing, damaged or stale */
+		close(fd);
+		return -1;
+	}
+
+	/* Copy training iterations */
+	c->num_training = head.num_training;
+
+#ifdef HAVE_SYS_MMAN_H
+	/* Map image */
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+	/* Check for success */
+	if (map != MAP_FAILED)
+	{
+		/* Point to weights */
+		c->weight = (double *)((char *)map + IMAGE_START);
+
+		/* Keep image open to map it again for private use */
+		c->fd = fd;
+		c->size = size;
+		return 0;
+	}
+#endif
+
+	/* Create space for weights */
+	weight = (double *)malloc(sizeof(double) * n);
+
+	/* Read weights */
+	if (lseek(fd, IMAGE_START, SEEK_SET) != IMAGE_START ||
+	    read(fd, weight, sizeof(double) * n) !=
+	    (ssize_t)(sizeof(double) * n))
+	{
+		/* Failure */
+		free(weight);
+		close(fd);
+		return -1;
+	}
+
+	/* Use weights read */
+	c->weight = weight;
+
+	/* Weights are not mapped */
+	close(fd);
+	c->fd = -1;
+	return 0;
+}
+
+/*
+ * Return the nanoseconds of a file's modification time, where the system
+ * keeps them.
+ *
+ * Together with the inode (which changes whenever save_net replaces the
+ * file) this tells apart versions of a network file saved within one
+ * second, which often have the same size.
+ */
+static long stamp_nsec(struct stat *st)
+{
+#ifdef _STATBUF_ST_NSEC
+	/* Return nanoseconds */
+	return st->st_mtim.tv_nsec;
+#else
+	/* Only whole seconds are known */
+	return 0;
+#endif
+}
+
+/*
+ * Find the cached weights of a network file, loading them if needed.
+ *
+ * Weights are read from the file's image if it is current.  Otherwise the
+ * network file is parsed (into the given network's own weights) and an
+ * image is made from it for next time.
+ */
+static net_cache *find_cache(net *learn, char *fname)
+{
+	net_cache *c;
+	struct stat st;
+	double *copy;
+	size_t hidden_size, output_size;
+	int i;
+
+	/* Get modification time and size of network file */
+	if (stat(fname, &st)) return NULL;
+
+	/* Loop over cached files */
+	for (i = 0; i < num_cache; i++)
+	{
+		/* Get cache entry */
+		c = &cache[i];
+
+		/* Check for current weights of same file and size of network */
+		if (!strcmp(c->fname, fname) && c->stamp == st.st_mtime &&
+		    c->source_size == st.st_size &&
+		    c->stamp_nsec == stamp_nsec(&st) &&
+		    c->source_inode == st.st_ino &&
+		    c->input == learn->num_inputs &&
+		    c->hidden == learn->num_hidden &&
+		    c->output == learn->num_output) return c;
+	}
+
+	/* Check for full cache or long file name */
+	if (num_cache == MAX_CACHE || strlen(fname) >= 1024) return NULL;
+
+	/* Get new cache entry (older entries may still be in use) */
+	c = &cache[num_cache];
+
+	/* Fill in entry */
+	strcpy(c->fname, fname);
+	c->stamp = st.st_mtime;
+	c->source_size = st.st_size;
+	c->stamp_nsec = stamp_nsec(&st);
+	c->source_inode = st.st_ino;
+	c->input = learn->num_inputs;
+	c->hidden = learn->num_hidden;
+	c->output = learn->num_output;
+
+	/* Check for weights read from image */
+	if (!read_image(c))
+	{
+		/* Entry is ready */
+		num_cache++;
+		return c;
+	}
+
+	/* Parse network file */
+	if (load_net(learn, fname)) return NULL;
+
+	/* Copy training iterations */
+	c->num_training = learn->num_training;
+
+	/* Compute size of each layer's weights */
+	hidden_size = sizeof(double) * (c->input + 1) * c->hidden;
+	output_size = sizeof(double) * (c->hidden + 1) * c->output;
+
+	/* Copy weights */
+	copy = (double *)malloc(hidden_size + output_size);
+	memcpy(copy, learn->hidden_weight[0], hidden_size);
+	memcpy((char *)copy + hidden_size, learn->output_weight[0],
+	       output_size);
+
+	/* Use copy of weights */
+	c->weight = copy;
+	c->fd = -1;
+
+	/* Make image for next time */
+	write_image(c);
+
+	/* Use image instead of copy, to share it with other processes */
+	if (!read_image(c)) free(copy);
+
+	/* Entry is ready */
+	num_cache++;
+	return c;
+}
+
+/*
+ * Point a network's rows of weights into one block of weights (hidden
+ * weights followed by output weights).
+ */
+static void point_rows(net *learn, double *weight)
+{
+	int i;
+	int input = learn->num_inputs, hidden = learn->num_hidden;
+
+	/* Loop over hidden weight rows */
+	for (i = 0; i < input + 1; i++)
+	{
+		/* Point to row */
+		learn->hidden_weight[i] = weight + i * hidden;
+	}
+
+	/* Skip past hidden weights */
+	weight += (input + 1) * hidden;
+
+	/* Loop over output weight rows */
+	for (i = 0; i < hidden + 1; i++)
+	{
+		/* Point to row */
+		learn->output_weight[i] = weight + i * learn->num_output;
+	}
+}
+
+/*
+ * Load a network's weights through the image cache.
+ *
+ * Every network loaded from the same file shares one read-only copy of
+ * its weights, which is also shared with other processes when images can
+ * be mapped.  If "writable" is not set, the network's weights point into
+ * that copy, and it must not be trained.  Otherwise the network gets a
+ * private mapping of the image, whose pages are copied only once they are
+ * trained.  Without mapping, writable weights are copied from the cache.
+ *
+ * The network must have just been made by make_learner().  Weights are
+ * only read by one thread at a time.
+ */
+int map_net(net *learn, char *fname, int writable)
+{
+	net_cache *c;
+	size_t hidden_size, output_size;
+#ifdef HAVE_SYS_MMAN_H
+	void *map;
+#endif
+
+	/* Find cached weights */
+	c = find_cache(learn, fname);
+
+	/* Check for weights that cannot be cached */
+	if (!c) return load_net(learn, fname);
+
+	/* Copy training iterations */
+	learn->num_training = c->num_training;
+
+	/* Check for read-only use */
+	if (!writable)
+	{
+		/* Destroy own weights */
+		free(learn->hidden_weight[0]);
+		free(learn->output_weight[0]);
+
+		/* Use cached weights */
+		point_rows(learn, c->weight);
+
+		/* Weights must not be changed */
+		learn->shared = 1;
+		return 0;
+	}
+
+#ifdef HAVE_SYS_MMAN_H
+	/* Check for mapped image */
+	if (c->fd >= 0)
+	{
+		/* Map private copy of image */
+		map = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		           c->fd, 0);
+
+		/* Check for success */
+		if (map != MAP_FAILED)
+		{
+			/* Destroy own weights */
+			free(learn->hidden_weight[0]);
+			free(learn->output_weight[0]);
+
+			/* Use mapped weights */
+			point_rows(learn,
+			           (double *)((char *)map + IMAGE_START));
+
+			/* Remember mapping */
+			learn->weight_map = map;
+			learn->map_size = c->size;
+			return 0;
+		}
+	}
+#endif
+
+	/* Compute size of each layer's weights */
+	hidden_size = sizeof(double) * (c->input + 1) * c->hidden;
+	output_size = sizeof(double) * (c->hidden + 1) * c->output;
+
+	/* Copy cached weights */
+	memcpy(learn->hidden_weight[0], c->weight, hidden_size);
+	memcpy(learn->output_weight[0], (char *)c->weight + hidden_size,
+	       output_size);
+
+	/* Success */
+	return 0;
+}
+
+/*
+ * Release a network's private mapping of its weights, before the network
+ * is made again.
+ */
+void unmap_net(net *learn)
+{
+#ifdef HAVE_SYS_MMAN_H
+	/* Unmap weights */
+	if (learn->weight_map) munmap(learn->weight_map, learn->map_size);
+#endif
+
+	/* Weights are no longer mapped */
+	learn->weight_map = NULL;
+	learn->map_size = 0;
 }
@@ -23,6 +23,30 @@
 #include <string.h>
 #include <math.h>
 
+/*
+ * Shape of the networks used by the AI.
+ */
+#define NET_INPUT    443
+#define HIDDEN_NODES 50
+#define NET_OUTPUT   2
+
+/*
+ * Precisions used to compute a network's hidden layer.
+ */
+#define NET_DOUBLE 0
+#define NET_FLOAT  1
+#define NET_INT8   2
+
+/*
+ * Mask of the above in a network's precision.
+ */
+#define NET_WEIGHTS 3
+
+/*
+ * Flag added to a precision to normalize results approximately.
+ */
+#define NET_FAST 4
+
 /*
  * A two-layer neural net.
  */
@@ -46,12 +70,61 @@ typedef struct net
 	/* Output layer weights */
 	double **output_weight;
 
+	/* Mapped image holding the weights (NULL if not mapped) */
+	void *weight_map;
+	size_t map_size;
+
+	/* Weights belong to the image cache and must not be changed */
+	int shared;
+
+	/* Weights when last merged (NULL if weights are shared) */
+	double **base_hidden;
+	double **base_output;
+
 	/* Hidden node sums */
 	double *hidden_sum;
 
 	/* Cumulative hidden nod error */
 	double *hidden_error;
 
+	/* Output node error factors used while training */
+	double *output_error;
+
+	/* Output node weight corrections used while training */
+	double *output_corr;
+
+	/* Positions trained before weights are changed (0 changes at once) */
+	int batch_size;
+
+	/* Positions trained since weights were last changed */
+	int num_batch;
+
+	/* Weight changes not yet applied */
+	double **hidden_grad;
+	double **output_grad;
+
+	/* Rows of hidden weight changes that are in use */
+	char *grad_used;
+
+	/* Precision used to compute results */
+	int precision;
+
+	/* Precision of inference weights made by quantize_net() */
+	int quantized;
+
+	/* Hidden layer weights (without bias) as floats */
+	float *hidden_float;
+
+	/* Hidden layer weights (without bias) as 8-bit integers */
+	signed char *hidden_int8;
+
+	/* Value of one step of each hidden node's 8-bit weights */
+	double *hidden_scale;
+
+	/* Hidden node sums (without bias) in reduced precision */
+	float *hidden_fsum;
+	int *hidden_isum;
+
 	/* Set of input values */
 	int *input_value;
 
@@ -70,8 +143,15 @@ typedef struct net
 	/* Sum that we divide results by to get probablities */
 	double prob_sum;
 
-	/* Sets of past inputs */
-	int **past_input;
+	/* Sets of past inputs, each in its own slot as pairs of input number
+	 * and value for the nonzero inputs */
+	int *past_input;
+
+	/* Number of nonzero inputs in each slot */
+	int *past_size;
+
+	/* Slot holding oldest set of past inputs */
+	int past_first;
 
 	/* Number of past input sets available */
 	int num_past;
@@ -81,11 +161,26 @@ typedef struct net
 
 } net;
 
+/* External variables */
+extern int net_generic;
+
 /* External functions */
 extern void make_learner(net *learn, int inputs, int hidden, int output);
+extern void make_evaluator(net *eval, net *learn);
+extern void make_trainer(net *train, net *learn, int local);
+extern void merge_net(net *train, net *learn);
+extern void copy_net(net *dest, net *learn);
+extern void reset_net(net *learn);
+extern void normalize_values(double *value, int n, int precision);
 extern void compute_net(net *learn);
+extern void quantize_net(net *learn, int precision);
 extern void store_net(net *learn);
+extern void recall_net(net *learn, int i);
 extern void clear_store(net *learn);
 extern void train_net(net *learn, double lambda, double *desired);
+extern void set_batch(net *learn, int size);
+extern void flush_net(net *learn);
 extern int load_net(net *learn, char *fname);
-extern void save_net(net *learn, char *fname);
+extern int save_net(net *learn, char *fname);
+extern int map_net(net *learn, char *fname, int writable);
+extern void unmap_net(net *learn);